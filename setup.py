@@ -44,10 +44,9 @@ if (torch.cuda.is_available() and CUDA_HOME is not None) or (
     pybind_fn = f"snngrow/snngrow_backend/pybind_gemm_cuda.cu"
 else:
     device = "cpu"
-    # pybind_fn = f"pybind_{device}.cpp"
-    pybind_fn = None
+    pybind_fn = f"snngrow/snngrow_backend/pybind_{device}.cpp"
 
-sources = [os.path.join(pybind_fn) if pybind_fn is not None else None]
+sources = [os.path.join(pybind_fn)]
 
 include_dirs=['snngrow/snngrow_backend/cutlass_extension/include', 'snngrow/snngrow_backend/spikegemm']
 
@@ -57,6 +56,11 @@ for fpath in glob.glob(os.path.join("snngrow", "snngrow_backend", "torch_gemm",
     ):
         sources.append(fpath)
 
+# CPU spike kernels, built for every device. The ISA specific variants (kernels_avx2.cpp, ...)
+# set their own target through pragmas and the best one is picked at import time, so no -march
+# flag may be added here: the extension has to load on any x86-64 host.
+sources += sorted(glob.glob(os.path.join("snngrow", "snngrow_backend", "spike_cpu", "*.cpp")))
+
 extension_type = CUDAExtension if device == "cuda" else CppExtension
 
 extra_compile_args = {
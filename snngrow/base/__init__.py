@@ -1 +1,9 @@
-from .spiketensor import *
\ No newline at end of file
+from . import library
+from .spiketensor import *
+from .spiketrain import *
+from .sparsespiketensor import *
+from .spiketimetensor import *
+from .spikefile import *
+from .spikeloader import *
+from .statearena import *
+from .streampool import *
\ No newline at end of file
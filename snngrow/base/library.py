@@ -0,0 +1,124 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Fake (meta) kernels and autograd formulas of the ``torch.ops.snngrow`` custom ops that the backend
+registers (snngrow_backend/spike_cpu/library.cpp). With them torch.compile traces spike GEMMs,
+packing and neuron steps as single graph nodes, without graph breaks, and fuses the pointwise ops
+around them. neuron_step and neuron_multistep update the potential in place and know no surrogate
+function, they are for inference; training goes through the functional neuron_multistep_train,
+whose backward is the fused BPTT kernel.
+"""
+
+import torch
+
+try:
+    import snngrow_backend
+except ImportError:
+    snngrow_backend = None
+
+__all__ = []
+
+# whether torch.ops.snngrow.neuron_multistep_train has an autograd formula, set below
+neuron_autograd = False
+
+
+def _register_fake(name):
+    # register_fake is the torch >= 2.4 name of impl_abstract
+    register = getattr(torch.library, "register_fake", None) or getattr(torch.library, "impl_abstract", None)
+    if register is None:
+        return lambda fn: fn
+    return register(f"snngrow::{name}")
+
+
+def _spike_gemm_fake(tensor1, tensor2):
+    dtype = tensor2.dtype if tensor1.dtype is torch.bool else tensor1.dtype
+    return tensor1.new_empty((*tensor1.shape[:-1], tensor2.shape[1]), dtype=dtype)
+
+
+def _pack_spikes_fake(spikes):
+    return spikes.new_empty((*spikes.shape[:-1], (spikes.shape[-1] + 63) // 64), dtype=torch.int64)
+
+
+def _unpack_spikes_fake(packed, n):
+    return packed.new_empty((*packed.shape[:-1], n), dtype=torch.bool)
+
+
+def _neuron_step_fake(x, v, mode, tau, v_threshold, v_reset, spike_out):
+    return torch.empty_like(x, dtype=torch.bool if spike_out else x.dtype)
+
+
+def _neuron_multistep_fake(x_seq, v, mode, tau, v_threshold, v_reset, spike_format):
+    if spike_format == 2:
+        shape = (*x_seq.shape[:-1], (x_seq.shape[-1] + 63) // 64)
+        return x_seq.new_empty(shape, dtype=torch.int64)
+    return torch.empty_like(x_seq, dtype=torch.bool if spike_format == 1 else x_seq.dtype)
+
+
+def _neuron_multistep_train_fake(x_seq, v, mode, tau, v_threshold, v_reset, surrogate, alpha, detach_reset):
+    return torch.empty_like(x_seq), torch.empty_like(v), torch.empty_like(x_seq)
+
+
+def _neuron_multistep_backward_fake(grad_spike, grad_v, v_seq, mode, tau, v_threshold, v_reset, surrogate, alpha,
+                                    detach_reset):
+    return torch.empty_like(v_seq), v_seq.new_empty(v_seq.shape[1:])
+
+
+def _spike_gemm_setup_context(ctx, inputs, output):
+    ctx.save_for_backward(*inputs)
+
+
+def _spike_gemm_backward(ctx, grad):
+    # only the float operand has a gradient, both products are spike GEMMs again
+    tensor1, tensor2 = ctx.saved_tensors
+    if tensor1.dtype is torch.bool:
+        spikes = tensor1.reshape(-1, tensor1.shape[-1])
+        grad = grad.reshape(-1, grad.shape[-1])
+        return None, torch.ops.snngrow.spike_gemm(grad.t().contiguous(), spikes).t()
+    return torch.ops.snngrow.spike_gemm(grad.contiguous(), tensor2.t().contiguous()), None
+
+
+def _neuron_multistep_train_setup_context(ctx, inputs, output):
+    ctx.params = inputs[2:]
+    ctx.save_for_backward(output[2])
+    ctx.mark_non_differentiable(output[2])
+
+
+def _neuron_multistep_train_backward(ctx, grad_spike, grad_v, grad_v_seq):
+    # the fused reverse-time sweep of MultiStepNeuronFunction, as a custom op that the compiled
+    # backward graph can call
+    v_seq, = ctx.saved_tensors
+    if grad_spike is None:
+        grad_spike = torch.zeros_like(v_seq)
+    grad_x, grad_v0 = torch.ops.snngrow.neuron_multistep_backward(grad_spike.contiguous(), grad_v, v_seq,
+                                                                   *ctx.params)
+    return grad_x, grad_v0, None, None, None, None, None, None, None
+
+
+if snngrow_backend is not None and hasattr(torch.ops.snngrow, "spike_gemm"):
+    _register_fake("spike_gemm")(_spike_gemm_fake)
+    _register_fake("pack_spikes")(_pack_spikes_fake)
+    _register_fake("unpack_spikes")(_unpack_spikes_fake)
+    _register_fake("neuron_step")(_neuron_step_fake)
+    _register_fake("neuron_multistep")(_neuron_multistep_fake)
+    if hasattr(torch.library, "register_autograd"):
+        torch.library.register_autograd("snngrow::spike_gemm", _spike_gemm_backward,
+                                        setup_context=_spike_gemm_setup_context)
+    if hasattr(torch.ops.snngrow, "neuron_multistep_train"):
+        _register_fake("neuron_multistep_train")(_neuron_multistep_train_fake)
+        _register_fake("neuron_multistep_backward")(_neuron_multistep_backward_fake)
+        if hasattr(torch.library, "register_autograd"):
+            torch.library.register_autograd("snngrow::neuron_multistep_train", _neuron_multistep_train_backward,
+                                            setup_context=_neuron_multistep_train_setup_context)
+            neuron_autograd = True
@@ -13,12 +13,64 @@
 # limitations under the License.
 
 from abc import abstractmethod
-from typing import Callable
+from typing import Callable, Optional
 import torch
 import torch.nn as nn
+import torch.utils.checkpoint
 import copy
-from ..spiketensor import SpikeTensor
+from ..spiketensor import SpikeTensor, PackedSpikeTensor
 from ..surrogate import Sigmoid
+from ..surrogate.BaseFunction import SurrogateFunctionBase
+from .. import library
+
+try:
+    import snngrow_backend
+except ImportError:
+    snngrow_backend = None
+
+# Charge equations of the CPU neuron kernel, they must match ``NeuronMode`` in
+# snngrow_backend/spike_cpu/kernels.h
+NEURON_IF = 0
+NEURON_LIF_DECAY_INPUT_RESET0 = 1
+NEURON_LIF_DECAY_INPUT = 2
+NEURON_LIF_NO_DECAY_INPUT_RESET0 = 3
+NEURON_LIF_NO_DECAY_INPUT = 4
+
+
+class MultiStepNeuronFunction(torch.autograd.Function):
+    """
+    ``T`` steps of an IF / LIF population on the fused CPU kernels, for training. The forward saves only
+    the charged potential of every step (before the reset), the backward recomputes the spikes and the
+    surrogate derivatives from it in one reverse-time sweep instead of walking an autograd graph of
+    about 8 nodes per step. With ``recompute`` the input and the initial potential are saved instead
+    and the potentials are recomputed by the forward kernel at the start of the backward.
+    """
+
+    @staticmethod
+    def forward(ctx, x_seq, v, mode, tau, v_threshold, v_reset, surrogate, alpha, detach_reset, recompute=False):
+        v0 = v.detach().contiguous()
+        v = v0.clone()
+        spike, v_seq = snngrow_backend.neuron_multistep_train_cpu(x_seq, v, mode, tau, v_threshold, v_reset)
+        if recompute:
+            ctx.save_for_backward(x_seq, v0)
+        else:
+            ctx.save_for_backward(v_seq)
+        ctx.recompute = recompute
+        ctx.params = (mode, tau, v_threshold, v_reset, surrogate, alpha, detach_reset)
+        ctx.set_materialize_grads(False)
+        return spike, v
+
+    @staticmethod
+    def backward(ctx, grad_spike, grad_v):
+        if ctx.recompute:
+            x_seq, v0 = ctx.saved_tensors
+            _, v_seq = snngrow_backend.neuron_multistep_train_cpu(x_seq, v0.clone(), *ctx.params[:4])
+        else:
+            v_seq, = ctx.saved_tensors
+        if grad_spike is None:
+            grad_spike = torch.zeros_like(v_seq)
+        grad_x, grad_v0 = snngrow_backend.neuron_multistep_backward_cpu(grad_spike, grad_v, v_seq, *ctx.params)
+        return grad_x, grad_v0, None, None, None, None, None, None, None, None
 
 class BaseNode(nn.Module):
     """
@@ -44,11 +96,31 @@ class BaseNode(nn.Module):
     :param spike_out: whether to output SpikeTensor
     :type spike_out: bool
 
+    :param packed_out: with ``spike_out`` and ``parallel_optim``, the fused CPU kernel outputs the spikes
+        bit-packed as a PackedSpikeTensor
+    :type packed_out: bool
+
+    :param checkpoint: with ``parallel_optim``, save only the input and the initial voltage of the sequence
+        in training and recompute the voltages of the ``T`` steps in backward
+    :type checkpoint: bool
+
+    :param time_parallel: with ``parallel_optim``, the CPU kernel in inference splits the ``T`` steps into
+        blocks that run in parallel and are then corrected for the reset events, for long sequences. IF neurons
+        with a soft reset (``v_reset=None``) keep the sequential kernel, their block corrections would redo the steps
+    :type time_parallel: bool
+
+    :param state_dtype: dtype in which the membrane potential is stored between steps, e.g. ``torch.bfloat16``
+        or ``torch.float16`` to halve the state memory. The update is computed in float32 and rounded on store.
+        ``None`` stores it in the dtype of the input
+    :type state_dtype: torch.dtype
+
     The base class of differentiable spiking neurons.
     """
     def __init__(self, v_threshold: float = 1., v_reset: float = 0.,
                  surrogate_function: Callable = Sigmoid.Sigmoid(), detach_reset: bool = False, 
-                 parallel_optim: bool = False, T: int = 1, spike_out: bool = False):       
+                 parallel_optim: bool = False, T: int = 1, spike_out: bool = False, packed_out: bool = False,
+                 checkpoint: bool = False, time_parallel: bool = False,
+                 state_dtype: Optional[torch.dtype] = None):
         assert isinstance(v_reset, float) or v_reset is None
         assert isinstance(v_threshold, float)
         assert isinstance(detach_reset, bool)
@@ -58,6 +130,7 @@ class BaseNode(nn.Module):
 
         self._memories = {}
         self._memories_rv = {}
+        self._memory_views = {}
 
         if v_reset is None:
             self.register_memory('v', 0.)
@@ -67,9 +140,14 @@ class BaseNode(nn.Module):
         self.parallel_optim = parallel_optim
         self.T = T
         self.spike_out = spike_out
+        self.packed_out = packed_out
+        self.checkpoint = checkpoint
+        self.time_parallel = time_parallel
+        self.state_dtype = state_dtype
 
         self.v_threshold = v_threshold
         self.v_reset = v_reset
+        self.register_buffer('v_bias', None)
 
         self.detach_reset = detach_reset
         self.surrogate_function = surrogate_function
@@ -90,6 +168,30 @@ class BaseNode(nn.Module):
             v = v - spike * v_threshold   
         return v
 
+    def set_channel_params(self, v_threshold: torch.Tensor, v_bias: Optional[torch.Tensor] = None):
+        """
+        :param v_threshold: threshold per channel, shaped to broadcast against the input, e.g. ``[C, 1, 1]``
+            for ``[N, C, H, W]`` inputs
+        :type v_threshold: torch.Tensor
+        :param v_bias: bias added to the input per channel, with the shape of ``v_threshold``
+        :type v_bias: torch.Tensor
+
+        Give every channel its own threshold and input bias, e.g. to absorb a BatchNorm in front of the neuron
+        (see ``utils.fold_batchnorm``). They are buffers and move with the module.
+        """
+
+        if 'v_threshold' not in self._buffers:
+            del self.v_threshold
+        self.register_buffer('v_threshold', v_threshold.float())
+        self.v_bias = None if v_bias is None else v_bias.float().reshape(v_threshold.shape)
+
+    def channel_params(self):
+        """
+        :return: whether the neuron has per-channel thresholds set by ``set_channel_params``
+        """
+
+        return isinstance(self.v_threshold, torch.Tensor)
+
     @abstractmethod
     def neuronal_dynamics(self, x: torch.Tensor):
         """
@@ -121,14 +223,188 @@ class BaseNode(nn.Module):
             spike_d = spike.detach()
         else:
             spike_d = spike
+        if isinstance(spike_d, SpikeTensor):
+            spike_d = spike_d.elem
 
         if self.v_reset is None:
             # soft reset
-            self.v = self.soft_reset(self.v, spike_d.elem, self.v_threshold, self.spike_out)
+            self.v = self.soft_reset(self.v, spike_d, self.v_threshold, self.spike_out)
 
         else:
             # hard reset
-            self.v = self.hard_reset(self.v, spike_d.elem, self.v_reset, self.spike_out)
+            self.v = self.hard_reset(self.v, spike_d, self.v_reset, self.spike_out)
+
+    def kernel_mode(self):
+        """
+        :return: the ``NEURON_*`` charge equation of this neuron, or ``None`` if the neuron
+            has no fused kernel
+
+        Sub-classes whose ``neuronal_dynamics`` matches one of the kernel equations override this
+        function so that inference on the CPU runs charge, fire and reset in one kernel.
+        """
+
+        return None
+
+    def use_cpu_kernel(self, x: torch.Tensor):
+        """
+        Whether ``simple_forward`` can use the fused CPU kernel for the input ``x``. This is the
+        case in inference on float32 CPU tensors when no gradient has to be tracked, the voltage may
+        be stored in float32, bfloat16 or float16.
+        """
+
+        if snngrow_backend is None or self.training or self.kernel_mode() is None:
+            return False
+        if x.device.type != 'cpu' or x.dtype != torch.float32 or isinstance(x, SpikeTensor):
+            return False
+        if not isinstance(self.v, torch.Tensor) or self.v.shape != x.shape:
+            return False
+        if self.v.dtype not in (torch.float32, torch.bfloat16, torch.float16):
+            return False
+        if self.channel_params() and self.v.dtype != torch.float32:
+            return False
+        if torch.is_grad_enabled() and (x.requires_grad or self.v.requires_grad):
+            return False
+        return True
+
+    def cpu_kernel_forward(self, x: torch.Tensor):
+        """
+        Charge - fire - reset in one call of the CPU neuron kernel, ``self.v`` is updated in place.
+        """
+
+        if not self.v.is_contiguous():
+            self.v = self.v.contiguous()
+        if self.channel_params():
+            spike = self.cpu_kernel_channels(x)
+        else:
+            spike = torch.ops.snngrow.neuron_step(x, self.v, self.kernel_mode(), float(getattr(self, 'tau', 1.)),
+                                                  self.v_threshold, self.v_reset, self.spike_out)
+        if self.spike_out:
+            return SpikeTensor(spike)
+        return spike
+
+    def cpu_kernel_channels(self, x: torch.Tensor):
+        """
+        One step of the CPU neuron kernel with the per-channel thresholds and input biases.
+
+        :return: bool spikes if ``spike_out``, otherwise float spikes
+        """
+
+        return snngrow_backend.neuron_step_channels_cpu(x, self.v, self.kernel_mode(), float(getattr(self, 'tau', 1.)),
+                                                        self.v_threshold, self.v_bias, self.v_reset, self.spike_out)
+
+    def use_cpu_bptt(self, x: torch.Tensor):
+        """
+        Whether ``parallel_optim_forward`` can train through the fused CPU kernels (multi-step forward and
+        BPTT backward) for the input ``x`` of one step. This is the case for float32 CPU tensors when the
+        surrogate function has a kernel derivative and outputs float spikes.
+        """
+
+        if snngrow_backend is None or not self.training or self.kernel_mode() is None or self.channel_params():
+            return False
+        surrogate = self.surrogate_function
+        if not isinstance(surrogate, SurrogateFunctionBase) or surrogate.kernel_surrogate() is None:
+            return False
+        if not surrogate.spiking or surrogate.spike_out:
+            return False
+        if x.device.type != 'cpu' or x.dtype != torch.float32 or isinstance(x, SpikeTensor):
+            return False
+        if not isinstance(self.v, torch.Tensor) or self.v.shape != x.shape or self.v.dtype != torch.float32:
+            return False
+        return True
+
+    def cpu_kernel_bptt(self, x_seq: torch.Tensor):
+        """
+        All ``T`` steps of ``x_seq`` (``shape = [T, N, *]``) through the ``neuron_multistep_train`` custom op,
+        or through ``MultiStepNeuronFunction`` with ``checkpoint`` or without ``torch.library.register_autograd``.
+        ``self.v`` becomes the potential after the last step.
+
+        :return: float spikes with ``shape = [T * N, *]``
+        """
+
+        surrogate = self.surrogate_function
+        if library.neuron_autograd and not self.checkpoint:
+            # the custom op keeps the step traceable by torch.compile in training
+            spike, self.v, _ = torch.ops.snngrow.neuron_multistep_train(x_seq.contiguous(), self.v, self.kernel_mode(),
+                                                                        float(getattr(self, 'tau', 1.)),
+                                                                        self.v_threshold, self.v_reset,
+                                                                        surrogate.kernel_surrogate(),
+                                                                        float(surrogate.alpha), self.detach_reset)
+            return spike.flatten(0, 1)
+        spike, self.v = MultiStepNeuronFunction.apply(x_seq.contiguous(), self.v, self.kernel_mode(),
+                                                      float(getattr(self, 'tau', 1.)), self.v_threshold,
+                                                      self.v_reset, surrogate.kernel_surrogate(),
+                                                      float(surrogate.alpha), self.detach_reset,
+                                                      self.checkpoint)
+        return spike.flatten(0, 1)
+
+    def sequence_forward(self, x_seq: torch.Tensor, v: torch.Tensor):
+        """
+        ``simple_forward`` over the ``T`` steps of ``x_seq`` starting from the voltage ``v``, ``self.v`` is
+        left untouched so that the function can be recomputed by activation checkpointing.
+
+        :return: the stacked spikes and the voltage after the last step
+        """
+
+        v_state = self.v
+        self.v = v
+        try:
+            spike_seq = torch.stack([self.simple_forward(x) for x in x_seq])
+            v = self.v
+        finally:
+            self.v = v_state
+        return spike_seq, v
+
+    def checkpoint_forward(self, x_seq: torch.Tensor):
+        """
+        ``sequence_forward`` under activation checkpointing: autograd keeps only ``x_seq`` and the initial
+        voltage, the voltages of the ``T`` steps are recomputed in backward.
+
+        :return: out spikes with ``shape = [T * N, *]``
+        """
+
+        spike_seq, self.v = torch.utils.checkpoint.checkpoint(self.sequence_forward, x_seq, self.v,
+                                                              use_reentrant=False)
+        return spike_seq.flatten(0, 1)
+
+    def cpu_kernel_multistep(self, x_seq: torch.Tensor):
+        """
+        All ``T`` steps of ``x_seq`` (``shape = [T, N, *]``) in one call of the multi-step CPU kernel, the
+        membrane potential stays in registers between the steps and ``self.v`` is updated in place. A
+        16-bit ``self.v`` is widened for the call and rounded once after the last step.
+
+        :return: out spikes with ``shape = [T * N, *]``
+        """
+
+        v_state = None
+        if self.v.dtype != torch.float32:
+            v_state, self.v = self.v, self.v.float()
+        elif not self.v.is_contiguous():
+            self.v = self.v.contiguous()
+        packed = self.spike_out and self.packed_out and x_seq.dim() > 2
+        tau = float(getattr(self, 'tau', 1.))
+        if self.channel_params():
+            # no multi-step kernel with per-channel parameters, one step kernel call per step
+            x_seq = x_seq.contiguous()
+            spike = torch.stack([self.cpu_kernel_channels(x_seq[t]) for t in range(x_seq.shape[0])])
+            if packed:
+                spike = snngrow_backend.pack_spikes_cpu(spike)
+        elif self.time_parallel:
+            spike = snngrow_backend.neuron_multistep_scan_cpu(x_seq.contiguous(), self.v, self.kernel_mode(), tau,
+                                                              self.v_threshold, self.v_reset, int(self.spike_out))
+            if packed:
+                spike = snngrow_backend.pack_spikes_cpu(spike)
+        else:
+            spike_format = 2 if packed else int(self.spike_out)
+            spike = torch.ops.snngrow.neuron_multistep(x_seq.contiguous(), self.v, self.kernel_mode(), tau,
+                                                       self.v_threshold, self.v_reset, spike_format)
+        if v_state is not None:
+            self.v = v_state.copy_(self.v)
+        spike = spike.flatten(0, 1)
+        if packed:
+            return PackedSpikeTensor(spike, x_seq.shape[-1])
+        if self.spike_out:
+            return SpikeTensor(spike)
+        return spike
 
     def extra_repr(self):
         return f'v_threshold={self.v_threshold}, v_reset={self.v_reset}, detach_reset={self.detach_reset}, parallel_optim={self.parallel_optim}, T={self.T}'
@@ -145,28 +421,46 @@ class BaseNode(nn.Module):
 
         """
         self.v_float_to_tensor(x)
+        if self.use_cpu_kernel(x):
+            return self.cpu_kernel_forward(x)
+        if library.neuron_autograd and not self.checkpoint and self.use_cpu_bptt(x):
+            # one step of the differentiable multi-step op
+            return self.cpu_kernel_bptt(x.unsqueeze(0))
+        if self.v_bias is not None:
+            x = x + self.v_bias
         self.neuronal_dynamics(x)
         spike = self.neuronal_fire(x)
         self.neuronal_reset(spike)
+        if self.state_dtype is not None and self.v.dtype != self.state_dtype:
+            # the dynamics above promote a reduced precision voltage to the dtype of x
+            self.v = self.v.to(self.state_dtype)
 
         return spike
 
     def v_float_to_tensor(self, x: torch.Tensor):
         if isinstance(self.v, float):
             v_init = self.v
-            self.v = torch.full_like(x.data, v_init)
+            self.v = torch.full_like(x.data, v_init, dtype=self.state_dtype)
 
     def parallel_optim_forward(self, x_seq: torch.Tensor):
         """
         :param x: input tensor with ``shape = [T * N, *] ``
         :type x: torch.Tensor  with ``shape = [T * N, *] ``
 
-        The parallel forward function, which is implemented by calling ``simple_forward(x_seq[t])`` over ``T`` times
+        The parallel forward function, which is implemented by calling ``simple_forward(x_seq[t])`` over ``T`` times,
+        or by the multi-step CPU kernels in inference and training
 
         """
         x_shape = x_seq.shape
         batch_size = x_shape[0] // self.T
         x_seq = x_seq.view(self.T, batch_size, *x_shape[1:])
+        self.v_float_to_tensor(x_seq[0])
+        if self.use_cpu_kernel(x_seq[0]):
+            return self.cpu_kernel_multistep(x_seq)
+        if self.use_cpu_bptt(x_seq[0]):
+            return self.cpu_kernel_bptt(x_seq)
+        if self.checkpoint and self.training and torch.is_grad_enabled():
+            return self.checkpoint_forward(x_seq)
         y_seq = []
         for t in range(self.T):
             y = self.simple_forward(x_seq[t])
@@ -197,14 +491,44 @@ class BaseNode(nn.Module):
 
     def reset(self):
         """
-        Reset all stateful variables to their default values.
+        Reset all stateful variables to their default values. Memories bound to a tensor by ``bind_memory``
+        are filled in place instead of being replaced.
         """
         for key in self._memories.keys():
-            self._memories[key] = copy.deepcopy(self._memories_rv[key])
+            view = self._memory_views.get(key)
+            if view is None:
+                self._memories[key] = copy.deepcopy(self._memories_rv[key])
+                continue
+            rv = self._memories_rv[key]
+            if isinstance(rv, torch.Tensor):
+                view.copy_(rv)
+            else:
+                view.fill_(rv)
+            self._memories[key] = view
 
     def set_reset_value(self, name: str, value):
         self._memories_rv[name] = copy.deepcopy(value)
 
+    def reset_value(self, name: str):
+        """
+        :return: the value the variable ``name`` is reset to
+        """
+        return self._memories_rv[name]
+
+    def bind_memory(self, name: str, view: torch.Tensor):
+        """
+        :param name: variable's name
+        :type name: str
+        :param view: storage of the variable, e.g. a slice of a ``StateArena`` buffer
+        :type view: torch.Tensor
+
+        Point the variable at ``view``. ``reset`` then fills ``view`` in place and points the variable back
+        at it, without allocating a new value.
+        """
+        assert name in self._memories, f'{name} is not a memory!'
+        self._memory_views[name] = view
+        self._memories[name] = view
+
     def memories(self):
         """
         :return: an iterator over all stateful variables
@@ -254,6 +578,7 @@ class BaseNode(nn.Module):
         if name in self._memories:
             del self._memories[name]
             del self._memories_rv[name]
+            self._memory_views.pop(name, None)
         else:
             return super().__delattr__(name)
 
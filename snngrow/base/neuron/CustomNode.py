@@ -0,0 +1,210 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from . import BaseNode
+from .neuronmodel import NeuronModel
+from ..spiketensor import SpikeTensor
+from ..surrogate import Sigmoid
+from ..surrogate.BaseFunction import SurrogateFunctionBase
+from typing import Callable
+import logging
+import torch
+
+class CustomNeuronFunction(torch.autograd.Function):
+    """
+    ``T`` steps of a ``NeuronModel`` on its generated CPU kernels, for training. The forward saves the states
+    before every step, the backward re-evaluates the steps with dual numbers in one reverse-time sweep.
+    """
+
+    @staticmethod
+    def forward(ctx, x_seq, params, kernels, surrogate, alpha, detach_reset, *states):
+        states = [state.detach().contiguous().clone() for state in states]
+        spike, saved = kernels.forward(x_seq, states, params, 0, True)
+        ctx.save_for_backward(x_seq, saved, params)
+        ctx.kernels = kernels
+        ctx.grad_params = (surrogate, alpha, detach_reset)
+        ctx.set_materialize_grads(False)
+        return (spike, *states)
+
+    @staticmethod
+    def backward(ctx, grad_spike, *grad_states):
+        x_seq, saved, params = ctx.saved_tensors
+        if grad_spike is None:
+            grad_spike = torch.zeros_like(x_seq)
+        grad_states = [torch.zeros_like(x_seq[0]) if grad is None else grad for grad in grad_states]
+        grad_x, *grad_states = ctx.kernels.backward(x_seq, saved, grad_spike, grad_states, params, *ctx.grad_params)
+        return (grad_x, None, None, None, None, None, *grad_states)
+
+class CustomNode(BaseNode.BaseNode):
+    """
+    :param model: states, parameters and equations of the neuron
+    :type model: NeuronModel
+
+    :param surrogate_function: the function for calculating surrogate gradients of the heaviside step function in backward
+    :type surrogate_function: Callable
+
+    :param detach_reset: detach the computation graph of reset in backward
+    :type detach_reset: bool
+
+    :param parallel_optim: parallel optimization
+    :type parallel_optim: bool
+
+    :param T: time steps
+    :type T: int
+
+    :param spike_out: whether to output SpikeTensor
+    :type spike_out: bool
+
+    :param jit: run float32 CPU inputs on the C++ kernels generated from ``model``, they are compiled by the first
+        forward that needs them. Otherwise, or if the compilation fails, the equations run as torch ops
+    :type jit: bool
+
+    A neuron defined by a ``NeuronModel`` instead of a sub-class. Its states are memories of the module (``v`` and
+    the others of the model), its parameters are in ``neuron_params`` and may be changed between calls. On the CPU
+    all ``T`` steps of ``parallel_optim`` run in one call of the generated kernel, and training uses its fused BPTT
+    backward with the ``Sigmoid`` or ``ATan`` surrogate.
+
+    """
+    def __init__(self, model: NeuronModel, surrogate_function: Callable = Sigmoid.Sigmoid(), detach_reset: bool = False,
+                 parallel_optim: bool = False, T: int = 1, spike_out: bool = False, jit: bool = True):
+
+        super().__init__(model.params.get('v_threshold', 1.), model.states['v'], surrogate_function, detach_reset,
+                         parallel_optim, T, spike_out)
+        self.model = model
+        self.neuron_params = dict(model.params)
+        self.jit = jit
+        for name, value in model.states.items():
+            if name != 'v':
+                self.register_memory(name, value)
+
+    def extra_repr(self):
+        return super().extra_repr() + f', model={self.model}, jit={self.jit}'
+
+    def v_float_to_tensor(self, x: torch.Tensor):
+        for name in self.model.state_names:
+            value = getattr(self, name)
+            if isinstance(value, float):
+                setattr(self, name, torch.full_like(x.data, value))
+
+    def values(self, x):
+        """
+        :return: the states, the parameters and the input ``x`` by name, for the equations of the model
+        """
+
+        values = dict(self.neuron_params)
+        for name in self.model.state_names:
+            values[name] = getattr(self, name)
+        values['x'] = x
+        return values
+
+    def neuronal_dynamics(self, x: torch.Tensor):
+        values = self.values(x)
+        self.model.run_update(values)
+        for name in self.model.state_names:
+            setattr(self, name, values[name])
+
+    def neuronal_fire(self, x: torch.Tensor):
+        h = self.model.run_threshold(self.values(x))
+        if self.training:
+            return self.surrogate_function(h)
+        if self.spike_out:
+            return SpikeTensor(h >= 0)
+        return (h >= 0).to(x)
+
+    def neuronal_reset(self, spike):
+        if self.detach_reset:
+            spike_d = spike.detach()
+        else:
+            spike_d = spike
+        if isinstance(spike_d, SpikeTensor):
+            spike_d = spike_d.elem
+
+        # every reset value sees the states before the reset
+        for name, value in self.model.run_reset(self.values(None)).items():
+            state = getattr(self, name)
+            spike_s = spike_d.to(state.dtype)
+            setattr(self, name, (1. - spike_s) * state + spike_s * value)
+
+    def kernels(self):
+        """
+        :return: the compiled kernels of the model, or ``None`` if they cannot be built, ``jit`` is then turned off
+        """
+
+        try:
+            return self.model.kernels()
+        except Exception as e:
+            logging.warning(f'CustomNode: building the kernels of {self.model} failed, the equations run as '
+                            f'torch ops: {e}')
+            self.jit = False
+            return None
+
+    def use_fused_kernel(self, x: torch.Tensor):
+        """
+        Whether the generated CPU kernels can run the input ``x`` of one step: float32 CPU tensors with float32
+        states, in inference, or in training with a surrogate function that has a kernel derivative.
+        """
+
+        if not self.jit or x.device.type != 'cpu' or x.dtype != torch.float32 or isinstance(x, SpikeTensor):
+            return False
+        states = [getattr(self, name) for name in self.model.state_names]
+        for state in states:
+            if not isinstance(state, torch.Tensor) or state.shape != x.shape or state.dtype != torch.float32:
+                return False
+        if torch.is_grad_enabled() and (x.requires_grad or any(state.requires_grad for state in states)):
+            surrogate = self.surrogate_function
+            if not self.training or not isinstance(surrogate, SurrogateFunctionBase):
+                return False
+            if surrogate.kernel_surrogate() is None or not surrogate.spiking or surrogate.spike_out:
+                return False
+        return self.kernels() is not None
+
+    def fused_forward(self, x_seq: torch.Tensor):
+        """
+        All ``T`` steps of ``x_seq`` (``shape = [T, N, *]``) in one call of the generated kernels, the states are
+        updated in place in inference.
+
+        :return: out spikes with ``shape = [T, N, *]``, bool spikes in inference with ``spike_out``
+        """
+
+        kernels = self.model.kernels()
+        params = torch.tensor([self.neuron_params[name] for name in self.model.param_names], dtype=torch.float32)
+        names = self.model.state_names
+        states = [getattr(self, name) for name in names]
+        x_seq = x_seq.contiguous()
+        if torch.is_grad_enabled() and (x_seq.requires_grad or any(state.requires_grad for state in states)):
+            surrogate = self.surrogate_function
+            spike, *states = CustomNeuronFunction.apply(x_seq, params, kernels, surrogate.kernel_surrogate(),
+                                                        float(surrogate.alpha), self.detach_reset, *states)
+        else:
+            states = [state.contiguous() for state in states]
+            spike, _ = kernels.forward(x_seq, states, params, int(self.spike_out), False)
+        for name, state in zip(names, states):
+            setattr(self, name, state)
+        return spike
+
+    def simple_forward(self, x: torch.Tensor):
+        self.v_float_to_tensor(x)
+        if self.use_fused_kernel(x):
+            spike = self.fused_forward(x.unsqueeze(0))[0]
+            return SpikeTensor(spike) if spike.dtype == torch.bool else spike
+        return super().simple_forward(x)
+
+    def parallel_optim_forward(self, x_seq: torch.Tensor):
+        x_shape = x_seq.shape
+        x_steps = x_seq.view(self.T, x_shape[0] // self.T, *x_shape[1:])
+        self.v_float_to_tensor(x_steps[0])
+        if self.use_fused_kernel(x_steps[0]):
+            spike = self.fused_forward(x_steps).flatten(0, 1)
+            return SpikeTensor(spike) if spike.dtype == torch.bool else spike
+        return super().parallel_optim_forward(x_seq)
@@ -0,0 +1,177 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from . import LIFNode
+from .BaseNode import snngrow_backend
+from typing import Optional
+import torch
+
+class EventLIFNode(LIFNode.LIFNode):
+    """
+    :param num_neurons: number of neurons, they are addressed by their flat index
+    :type num_neurons: int
+
+    :param tau: membrane time constant
+    :type tau: float
+
+    :param decay_input: the input will decay
+    :type decay_input: bool
+
+    :param v_threshold: threshold voltage
+    :type v_threshold: float
+
+    :param v_reset: reset voltage, soft reset if ``None``
+    :type v_reset: float
+
+    Event-driven LIF neurons for sparse simulation and inference. ``step(index, x)`` advances the population by one
+    time step but only computes the neurons of ``index``, which receive input. The other neurons keep in ``v`` the
+    potential of their last update and its time step in ``last_update``: without input the LIF equations only decay
+    the potential towards the rest value, so the ``dt`` silent steps are applied in closed form,
+    ``rest + (v - rest) * (1 - 1 / tau) ** dt``, when the neuron receives its next event or is read by ``potential``.
+    The cost of a step is proportional to the number of events instead of ``num_neurons``, and the spikes are the ones
+    of ``LIFNode`` fed with zero input for the silent neurons, up to float rounding.
+
+    A soft reset may leave a neuron above the threshold, it then fires again in the next step without input. These
+    neurons are kept and stepped with zero input in the next step.
+
+    There is no surrogate gradient, the neuron is for inference and simulation only.
+
+    """
+    def __init__(self, num_neurons: int, tau: float = 2., decay_input: bool = True, v_threshold: float = 1.,
+                 v_reset: Optional[float] = 0.):
+
+        super().__init__(tau, decay_input, v_threshold, v_reset)
+        self.num_neurons = num_neurons
+        self.register_memory('last_update', 0)
+        self.t = 0
+        self.pending = None
+
+    def extra_repr(self):
+        return super().extra_repr() + f', num_neurons={self.num_neurons}'
+
+    def reset(self):
+        super().reset()
+        self.t = 0
+        self.pending = None
+
+    def materialize(self, device: torch.device):
+        """
+        Allocate ``v`` and ``last_update`` on ``device`` after a reset.
+        """
+        if not isinstance(self.v, torch.Tensor):
+            self.v = torch.full((self.num_neurons,), self.v, device=device)
+        if not isinstance(self.last_update, torch.Tensor):
+            self.last_update = torch.full((self.num_neurons,), self.last_update, dtype=torch.int64, device=device)
+
+    def decay(self, v: torch.Tensor, dt: torch.Tensor):
+        """
+        :return: the potential ``v`` after ``dt`` steps without input
+        """
+        rest = self.v_reset if self.v_reset is not None else 0.
+        return rest + (v - rest) * torch.pow(1. - 1. / self.tau, dt.to(v.dtype))
+
+    def use_event_kernel(self, x: torch.Tensor):
+        return snngrow_backend is not None and x.device.type == 'cpu' and x.dtype == torch.float32 \
+            and self.v.dtype == torch.float32 and self.v.is_contiguous() and self.last_update.is_contiguous()
+
+    def event_step_torch(self, index: torch.Tensor, x: torch.Tensor):
+        v_state = self.v
+        self.v = self.decay(v_state.index_select(0, index), self.t - 1 - self.last_update.index_select(0, index))
+        self.neuronal_dynamics(x)
+        spike = self.v >= self.v_threshold
+        if self.v_reset is None:
+            v = self.v - spike.to(x.dtype) * self.v_threshold
+        else:
+            v = torch.where(spike, torch.full_like(self.v, self.v_reset), self.v)
+        self.v = v_state
+        self.v.index_copy_(0, index, v.to(self.v.dtype))
+        self.last_update.index_fill_(0, index, self.t)
+        return spike
+
+    @torch.no_grad()
+    def step(self, index: torch.Tensor, x: torch.Tensor):
+        """
+        :param index: flat indices of the neurons that receive input in this step. An index may repeat, e.g. for
+            synaptic events of the same target neuron, its inputs are summed
+        :type index: torch.Tensor
+        :param x: input of each of these neurons
+        :type x: torch.Tensor
+
+        :return: flat indices of the neurons that fire in this step
+        :rtype: torch.Tensor
+
+        Advance the population by one time step.
+        """
+        self.materialize(x.device)
+        self.t += 1
+        index = index.reshape(-1).to(torch.int64)
+        x = x.reshape(-1).to(self.v.dtype if self.v.is_floating_point() else torch.float32)
+        # one event per neuron, the kernel and index_copy_ need unique indices
+        index, inverse = torch.unique(index, return_inverse=True)
+        x = x.new_zeros(index.numel()).index_add_(0, inverse, x)
+        if self.pending is not None and self.pending.numel() > 0:
+            pending = self.pending[~torch.isin(self.pending, index)]
+            index = torch.cat([index, pending])
+            x = torch.cat([x, x.new_zeros(pending.numel())])
+
+        if self.use_event_kernel(x):
+            spike = snngrow_backend.neuron_event_step_cpu(index, x.contiguous(), self.v, self.last_update, self.t,
+                                                          self.kernel_mode(), float(self.tau), float(self.v_threshold),
+                                                          self.v_reset)
+        else:
+            spike = self.event_step_torch(index, x)
+
+        fired = index[spike]
+        if self.v_reset is None:
+            self.pending = fired[self.v.index_select(0, fired) >= self.v_threshold]
+        return fired
+
+    def advance(self, steps: int):
+        """
+        Advance the population by ``steps`` time steps without input. Only neurons left above the threshold by a
+        soft reset would fire in these steps, they are stepped one by one; otherwise the cost does not depend on
+        ``steps``.
+        """
+        while steps > 0 and self.pending is not None and self.pending.numel() > 0:
+            self.step(self.pending.new_empty(0), torch.empty(0, device=self.pending.device))
+            steps -= 1
+        self.t += steps
+
+    @torch.no_grad()
+    def potential(self, index: Optional[torch.Tensor] = None):
+        """
+        :param index: flat indices of the neurons to read, all of them if ``None``
+        :type index: torch.Tensor
+
+        :return: the membrane potential at the current time step, with the decay of the silent steps applied
+        :rtype: torch.Tensor
+        """
+        self.materialize(index.device if index is not None else torch.device('cpu'))
+        if index is None:
+            return self.decay(self.v, self.t - self.last_update)
+        index = index.reshape(-1).to(torch.int64)
+        return self.decay(self.v.index_select(0, index), self.t - self.last_update.index_select(0, index))
+
+    def forward(self, x: torch.Tensor):
+        """
+        One time step with the dense input ``x`` of ``num_neurons`` elements, its nonzero elements are the events.
+
+        :return: the dense spikes of the step, with the shape and dtype of ``x``
+        """
+        x_flat = x.reshape(-1)
+        index = x_flat.nonzero().squeeze(1)
+        fired = self.step(index, x_flat.index_select(0, index))
+        spike = torch.zeros_like(x_flat)
+        spike[fired] = 1.
+        return spike.view_as(x)
@@ -14,7 +14,7 @@
 
 from . import BaseNode
 from ..surrogate import Sigmoid
-from typing import Callable
+from typing import Callable, Optional
 import torch
 
 class IFNode(BaseNode.BaseNode):
@@ -41,14 +41,38 @@ class IFNode(BaseNode.BaseNode):
     :param spike_out: whether to output SpikeTensor
     :type spike_out: bool
 
+    :param packed_out: with ``spike_out`` and ``parallel_optim``, the fused CPU kernel outputs the spikes
+        bit-packed as a PackedSpikeTensor
+    :type packed_out: bool
+
+    :param checkpoint: with ``parallel_optim``, save only the input and the initial voltage of the sequence
+        in training and recompute the voltages of the ``T`` steps in backward
+    :type checkpoint: bool
+
+    :param time_parallel: with ``parallel_optim``, the CPU kernel in inference splits the ``T`` steps into
+        blocks that run in parallel and are then corrected for the reset events, for long sequences. IF neurons
+        with a soft reset (``v_reset=None``) keep the sequential kernel, their block corrections would redo the steps
+    :type time_parallel: bool
+
+    :param state_dtype: dtype in which the membrane potential is stored between steps, e.g. ``torch.bfloat16``
+        or ``torch.float16`` to halve the state memory. The update is computed in float32 and rounded on store.
+        ``None`` stores it in the dtype of the input
+    :type state_dtype: torch.dtype
+
     The Integrate-and-Fire(IF) neuron, without decay input as LIF neuron.
     
     """
     def __init__(self, v_threshold: float = 1., v_reset: float = 0.,
                  surrogate_function: Callable = Sigmoid.Sigmoid(), detach_reset: bool = False,
-                 parallel_optim: bool = False, T: int = 1, spike_out: bool = False):
+                 parallel_optim: bool = False, T: int = 1, spike_out: bool = False,
+                 packed_out: bool = False, checkpoint: bool = False, time_parallel: bool = False,
+                 state_dtype: Optional[torch.dtype] = None):
+
+        super().__init__(v_threshold, v_reset, surrogate_function, detach_reset, parallel_optim, T, spike_out, packed_out,
+                         checkpoint, time_parallel, state_dtype)
 
-        super().__init__(v_threshold, v_reset, surrogate_function, detach_reset, parallel_optim, T, spike_out)
+    def kernel_mode(self):
+        return BaseNode.NEURON_IF
 
     def neuronal_dynamics(self, x: torch.Tensor):
         self.v = self.v + x
\ No newline at end of file
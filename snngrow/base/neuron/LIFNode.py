@@ -14,7 +14,7 @@
 
 from . import BaseNode
 from ..surrogate import Sigmoid
-from typing import Callable
+from typing import Callable, Optional
 import torch
 
 class LIFNode(BaseNode.BaseNode):
@@ -47,16 +47,36 @@ class LIFNode(BaseNode.BaseNode):
     :param spike_out: whether to output SpikeTensor
     :type spike_out: bool
 
+    :param packed_out: with ``spike_out`` and ``parallel_optim``, the fused CPU kernel outputs the spikes
+        bit-packed as a PackedSpikeTensor
+    :type packed_out: bool
+
+    :param checkpoint: with ``parallel_optim``, save only the input and the initial voltage of the sequence
+        in training and recompute the voltages of the ``T`` steps in backward
+    :type checkpoint: bool
+
+    :param time_parallel: with ``parallel_optim``, the CPU kernel in inference splits the ``T`` steps into
+        blocks that run in parallel and are then corrected for the reset events, for long sequences
+    :type time_parallel: bool
+
+    :param state_dtype: dtype in which the membrane potential is stored between steps, e.g. ``torch.bfloat16``
+        or ``torch.float16`` to halve the state memory. The update is computed in float32 and rounded on store.
+        ``None`` stores it in the dtype of the input
+    :type state_dtype: torch.dtype
+
     The Leaky Integrate-and-Fire(LIF) neuron
 
     """
     def __init__(self, tau: float = 2., decay_input: bool = True, v_threshold: float = 1.,
                  v_reset: float = 0., surrogate_function: Callable = Sigmoid.Sigmoid(),
-                 detach_reset: bool = False, parallel_optim: bool = False, T: int = 1, spike_out: bool = False):
+                 detach_reset: bool = False, parallel_optim: bool = False, T: int = 1, spike_out: bool = False,
+                 packed_out: bool = False, checkpoint: bool = False, time_parallel: bool = False,
+                 state_dtype: Optional[torch.dtype] = None):
         
         assert isinstance(tau, float) and tau > 1.
 
-        super().__init__(v_threshold, v_reset, surrogate_function, detach_reset, parallel_optim, T, spike_out)
+        super().__init__(v_threshold, v_reset, surrogate_function, detach_reset, parallel_optim, T, spike_out, packed_out,
+                         checkpoint, time_parallel, state_dtype)
 
         self.tau = tau
         self.decay_input = decay_input
@@ -64,6 +84,15 @@ class LIFNode(BaseNode.BaseNode):
     def extra_repr(self):
         return super().extra_repr() + f', tau={self.tau}'
 
+    def kernel_mode(self):
+        if self.decay_input:
+            if self.v_reset is None or self.v_reset == 0.:
+                return BaseNode.NEURON_LIF_DECAY_INPUT_RESET0
+            return BaseNode.NEURON_LIF_DECAY_INPUT
+        if self.v_reset is None or self.v_reset == 0.:
+            return BaseNode.NEURON_LIF_NO_DECAY_INPUT_RESET0
+        return BaseNode.NEURON_LIF_NO_DECAY_INPUT
+
     def neuronal_dynamics(self, x: torch.Tensor):
         if self.decay_input:
             if self.v_reset is None or self.v_reset == 0.:
@@ -1,2 +1,5 @@
 from .IFNode import IFNode
-from .LIFNode import LIFNode
\ No newline at end of file
+from .LIFNode import LIFNode
+from .CustomNode import CustomNode
+from .EventNode import EventLIFNode
+from .neuronmodel import NeuronModel
\ No newline at end of file
@@ -0,0 +1,549 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import ast
+import copy
+import hashlib
+import os
+import textwrap
+import torch
+
+__all__ = ["NeuronModel"]
+
+# functions of the equations: arity, torch implementation and name in the generated C++
+_FUNCTIONS = {
+    'exp': (1, torch.exp, 'sn_exp'),
+    'log': (1, torch.log, 'sn_log'),
+    'sqrt': (1, torch.sqrt, 'sn_sqrt'),
+    'tanh': (1, torch.tanh, 'sn_tanh'),
+    'sigmoid': (1, torch.sigmoid, 'sn_sigmoid'),
+    'abs': (1, torch.abs, 'sn_abs'),
+    'min': (2, torch.minimum, 'sn_min'),
+    'max': (2, torch.maximum, 'sn_max'),
+}
+
+_BINARY = {ast.Add: '+', ast.Sub: '-', ast.Mult: '*', ast.Div: '/'}
+_COMPARE = {ast.Lt: '<', ast.LtE: '<=', ast.Gt: '>', ast.GtE: '>=', ast.Eq: '==', ast.NotEq: '!='}
+
+# generated modules by the hash of their source
+_COMPILED = {}
+
+
+def _tensor_args(a, b):
+    if not isinstance(a, torch.Tensor):
+        a = torch.as_tensor(a, dtype=b.dtype if isinstance(b, torch.Tensor) else torch.float32,
+                            device=b.device if isinstance(b, torch.Tensor) else None)
+    if not isinstance(b, torch.Tensor):
+        b = torch.as_tensor(b, dtype=a.dtype, device=a.device)
+    return a, b
+
+
+def _where(condition, a, b):
+    a, b = _tensor_args(a, b)
+    return torch.where(torch.as_tensor(condition, device=a.device), a, b)
+
+
+def _torch_function(fn, arity):
+    if arity == 1:
+        return lambda a: fn(torch.as_tensor(a))
+    return lambda a, b: fn(*_tensor_args(a, b))
+
+
+class _ToTorch(ast.NodeTransformer):
+    # a if c else b -> _where(c, a, b), f(a) -> _fn_f(a)
+    def visit_IfExp(self, node):
+        self.generic_visit(node)
+        return ast.Call(func=ast.Name(id='_where', ctx=ast.Load()), args=[node.test, node.body, node.orelse],
+                        keywords=[])
+
+    def visit_Call(self, node):
+        self.generic_visit(node)
+        node.func = ast.Name(id='_fn_' + node.func.id, ctx=ast.Load())
+        return node
+
+
+class NeuronModel:
+    """
+    :param states: state variables and their initial (and reset) values, ``v`` is the membrane potential
+        and must be one of them
+    :type states: dict
+    :param params: constant parameters of the equations and their values
+    :type params: dict
+    :param update: statements ``name = expression`` run in order every step before the threshold, the
+        targets are states or temporaries of the step
+    :type update: str
+    :param threshold: expression of the states, the parameters and the input ``x``, the neuron fires when
+        it is ``>= 0``
+    :type threshold: str
+    :param reset: statements ``state = expression`` of the states and the parameters, applied to the neurons
+        that fired, all right-hand sides see the states before the reset
+    :type reset: str
+
+    Declarative description of a spiking neuron for ``CustomNode``. The expressions use ``+ - * / **``,
+    comparisons in ``a if condition else b``, numbers, the names above and the functions ``exp``, ``log``,
+    ``sqrt``, ``tanh``, ``sigmoid``, ``abs``, ``min`` and ``max``.
+
+    From the description snngrow generates a C++ multi-step forward, which keeps the states in registers
+    over the ``T`` steps, and a BPTT backward, which differentiates the step with forward-mode dual numbers
+    and the surrogate derivative of the spike. It is compiled once per model with
+    ``torch.utils.cpp_extension.load_inline`` and cached by the hash of the source. The same equations are
+    also evaluated with torch ops for the devices and cases the kernel does not cover.
+
+    An adaptive LIF neuron::
+
+        alif = NeuronModel(
+            states={'v': 0., 'a': 0.},
+            params={'tau': 2., 'tau_a': 20., 'beta': 0.2, 'v_threshold': 1.},
+            update='''
+                v = v + (x - v) / tau
+                a = a - a / tau_a
+            ''',
+            threshold='v - v_threshold - beta * a',
+            reset='''
+                v = 0.
+                a = a + 1.
+            ''')
+    """
+
+    def __init__(self, states: dict, params: dict = None, update: str = '', threshold: str = 'v - 1.',
+                 reset: str = 'v = 0.'):
+        self.states = {name: float(value) for name, value in states.items()}
+        self.params = {name: float(value) for name, value in (params or {}).items()}
+        if 'v' not in self.states:
+            raise ValueError("NeuronModel(): the states must include the membrane potential 'v'")
+        for name in list(self.states) + list(self.params):
+            if not name.isidentifier() or name == 'x' or name in _FUNCTIONS or name.startswith('_'):
+                raise ValueError(f"NeuronModel(): invalid state or parameter name '{name}'")
+        if set(self.states) & set(self.params):
+            raise ValueError('NeuronModel(): a name is both a state and a parameter')
+
+        inputs = set(self.states) | set(self.params) | {'x'}
+        self.sources = (textwrap.dedent(update).strip(), threshold.strip(), textwrap.dedent(reset).strip())
+        self.update = self._parse_statements(self.sources[0], inputs, states_only=False)
+        self.threshold = self._parse_expression(self.sources[1], inputs)
+        self.reset = self._parse_statements(self.sources[2], inputs - {'x'}, states_only=True)
+        self._torch_update = [(name, self._torch_code(expr)) for name, expr in self.update]
+        self._torch_threshold = self._torch_code(self.threshold)
+        self._torch_reset = [(name, self._torch_code(expr)) for name, expr in self.reset]
+        self._namespace = {'_where': _where}
+        for name, (arity, fn, _) in _FUNCTIONS.items():
+            self._namespace['_fn_' + name] = _torch_function(fn, arity)
+
+    @property
+    def state_names(self):
+        return list(self.states)
+
+    @property
+    def param_names(self):
+        return list(self.params)
+
+    def _check(self, expr, names, source):
+        functions = set()
+        for node in ast.walk(expr):
+            if isinstance(node, ast.Call):
+                if not isinstance(node.func, ast.Name) or node.func.id not in _FUNCTIONS or node.keywords \
+                        or len(node.args) != _FUNCTIONS[node.func.id][0]:
+                    raise ValueError(f"NeuronModel(): unsupported call in '{source}'")
+                functions.add(node.func)
+            elif isinstance(node, ast.Name):
+                if node not in functions and node.id not in names:
+                    raise ValueError(f"NeuronModel(): unknown name '{node.id}' in '{source}'")
+            elif _is_number(node):
+                pass
+            elif isinstance(node, ast.BinOp):
+                if type(node.op) not in _BINARY and not isinstance(node.op, ast.Pow):
+                    raise ValueError(f"NeuronModel(): unsupported operator in '{source}'")
+            elif isinstance(node, ast.UnaryOp):
+                if not isinstance(node.op, (ast.USub, ast.UAdd)):
+                    raise ValueError(f"NeuronModel(): unsupported operator in '{source}'")
+            elif isinstance(node, ast.Compare):
+                if len(node.ops) != 1 or type(node.ops[0]) not in _COMPARE:
+                    raise ValueError(f"NeuronModel(): only single comparisons are supported in '{source}'")
+            elif isinstance(node, ast.IfExp):
+                if not isinstance(node.test, ast.Compare):
+                    raise ValueError(f"NeuronModel(): the condition of 'if' must be a comparison in '{source}'")
+            elif not isinstance(node, (ast.Expression, ast.Load, ast.operator, ast.unaryop, ast.cmpop)):
+                raise ValueError(f"NeuronModel(): unsupported syntax in '{source}'")
+
+    def _parse_expression(self, source, names):
+        expr = ast.parse(source, mode='eval')
+        self._check(expr, names, source)
+        return expr.body
+
+    def _parse_statements(self, source, names, states_only):
+        statements = []
+        names = set(names)
+        lines = source.splitlines()
+        for statement in ast.parse(source).body:
+            text = lines[statement.lineno - 1].strip()
+            if not isinstance(statement, ast.Assign) or len(statement.targets) != 1 \
+                    or not isinstance(statement.targets[0], ast.Name):
+                raise ValueError(f"NeuronModel(): expected 'name = expression', got '{text}'")
+            target = statement.targets[0].id
+            if states_only and target not in self.states:
+                raise ValueError(f"NeuronModel(): reset of '{target}', which is not a state")
+            if target in self.params or target == 'x' or target in _FUNCTIONS or target.startswith('_'):
+                raise ValueError(f"NeuronModel(): cannot assign '{target}'")
+            self._check(ast.Expression(statement.value), names, text)
+            statements.append((target, statement.value))
+            if not states_only:
+                # temporaries are visible in the following statements
+                names.add(target)
+        return statements
+
+    @staticmethod
+    def _torch_code(expr):
+        tree = ast.fix_missing_locations(_ToTorch().visit(ast.Expression(body=copy.deepcopy(expr))))
+        return compile(tree, '<NeuronModel>', 'eval')
+
+    # torch evaluation, on a dict of the states, the parameters and x
+
+    def run_update(self, values: dict):
+        for name, code in self._torch_update:
+            values[name] = eval(code, self._namespace, values)
+
+    def run_threshold(self, values: dict):
+        return eval(self._torch_threshold, self._namespace, values)
+
+    def run_reset(self, values: dict) -> dict:
+        """
+        :return: the reset value of every state with a reset statement
+        """
+        return {name: eval(code, self._namespace, values) for name, code in self._torch_reset}
+
+    # C++ generation
+
+    def _cpp(self, node):
+        if _is_number(node):
+            return f'{float(_number(node))!r}f'
+        if isinstance(node, ast.Name):
+            if node.id == 'x':
+                return 'in_x'
+            if node.id in self.params:
+                return 'p_' + node.id
+            return 's_' + node.id
+        if isinstance(node, ast.BinOp):
+            if isinstance(node.op, ast.Pow):
+                return f'sn_pow({self._cpp(node.left)}, {self._cpp(node.right)})'
+            return f'({self._cpp(node.left)} {_BINARY[type(node.op)]} {self._cpp(node.right)})'
+        if isinstance(node, ast.UnaryOp):
+            return f'(-{self._cpp(node.operand)})' if isinstance(node.op, ast.USub) else self._cpp(node.operand)
+        if isinstance(node, ast.Call):
+            return f'{_FUNCTIONS[node.func.id][2]}({", ".join(self._cpp(a) for a in node.args)})'
+        if isinstance(node, ast.Compare):
+            return (f'(value({self._cpp(node.left)}) {_COMPARE[type(node.ops[0])]} '
+                    f'value({self._cpp(node.comparators[0])}))')
+        if isinstance(node, ast.IfExp):
+            return f'({self._cpp(node.test)} ? S({self._cpp(node.body)}) : S({self._cpp(node.orelse)}))'
+        raise ValueError(f'NeuronModel(): cannot generate {ast.dump(node)}')
+
+    def cpp_step(self) -> str:
+        """
+        :return: the C++ ``neuron_update`` function of one step, templated on the scalar type
+        """
+        lines = [f'  const float p_{name} = params[{i}];' for i, name in enumerate(self.params)]
+        lines += [f'  S s_{name} = state[{i}];' for i, name in enumerate(self.states)]
+        declared = set(self.states)
+        for name, expr in self.update:
+            prefix = '' if name in declared else 'S '
+            declared.add(name)
+            lines.append(f'  {prefix}s_{name} = {self._cpp(expr)};')
+        lines.append(f'  const S spike = heaviside(S({self._cpp(self.threshold)}), surrogate, alpha);')
+        lines.append('  const S spike_r = detach_reset ? S(value(spike)) : spike;')
+        lines += [f'  const S r_{name} = {self._cpp(expr)};' for name, expr in self.reset]
+        lines += [f'  s_{name} = reset_blend(spike_r, r_{name}, s_{name});' for name, _ in self.reset]
+        lines += [f'  state[{i}] = s_{name};' for i, name in enumerate(self.states)]
+        body = '\n'.join(lines)
+        return (f'constexpr int kStates = {len(self.states)};\n'
+                f'constexpr int kParams = {len(self.params)};\n'
+                f'constexpr int kN = kStates + 1;\n\n'
+                + _DUAL_SOURCE +
+                'template <class S>\n'
+                'inline S neuron_update(S *state, S in_x, const float *params, int surrogate, float alpha,\n'
+                '                       bool detach_reset) {\n'
+                f'{body}\n'
+                '  return spike;\n'
+                '}\n')
+
+    def cpp_source(self) -> str:
+        """
+        :return: the C++ source of the fused kernels of this model
+        """
+        return _PRELUDE + 'namespace {\n\n' + self.cpp_step() + _LOOPS + '}  // namespace\n\n' + _BINDINGS
+
+    def kernels(self):
+        """
+        :return: the compiled extension with ``forward`` and ``backward``, built on the first call and cached
+        """
+        source = self.cpp_source()
+        digest = hashlib.sha1(source.encode()).hexdigest()[:16]
+        module = _COMPILED.get(digest)
+        if module is None:
+            from torch.utils.cpp_extension import load_inline
+            cflags = ['-O3']
+            ldflags = []
+            if os.name != 'nt':
+                # compiled on the host that runs it
+                cflags += ['-march=native', '-Wno-sign-compare']
+                info = torch.__config__.parallel_info()
+                if 'backend: OpenMP' in info and 'OpenMP not found' not in info:
+                    cflags += ['-fopenmp', '-DAT_PARALLEL_OPENMP']
+                    ldflags += ['-fopenmp']
+            module = load_inline(name=f'snngrow_neuron_{digest}', cpp_sources=[source],
+                                 functions=['forward', 'backward'], extra_cflags=cflags,
+                                 extra_ldflags=ldflags, with_cuda=False)
+            _COMPILED[digest] = module
+        return module
+
+    def __repr__(self):
+        update, threshold, reset = self.sources
+        return (f'NeuronModel(states={self.states}, params={self.params}, update={update!r}, '
+                f'threshold={threshold!r}, reset={reset!r})')
+
+
+def _number(node):
+    return node.value if isinstance(node, ast.Constant) else node.n
+
+
+def _is_number(node):
+    # ast.Num before python 3.8
+    if isinstance(node, ast.Constant):
+        return isinstance(node.value, (int, float)) and not isinstance(node.value, bool)
+    return type(node).__name__ == 'Num'
+
+
+_PRELUDE = r'''#include <torch/extension.h>
+#include <ATen/Parallel.h>
+
+#include <cmath>
+#include <vector>
+
+'''
+
+_DUAL_SOURCE = r'''// forward-mode dual number over the states and the input of one step
+struct Dual {
+  float v;
+  float d[kN];
+  Dual(float a = 0.f) : v(a), d{} {}
+};
+
+inline float value(float a) { return a; }
+inline float value(const Dual &a) { return a.v; }
+
+inline Dual operator+(const Dual &a, const Dual &b) {
+  Dual r(a.v + b.v);
+  for (int i = 0; i < kN; ++i) r.d[i] = a.d[i] + b.d[i];
+  return r;
+}
+inline Dual operator-(const Dual &a, const Dual &b) {
+  Dual r(a.v - b.v);
+  for (int i = 0; i < kN; ++i) r.d[i] = a.d[i] - b.d[i];
+  return r;
+}
+inline Dual operator-(const Dual &a) {
+  Dual r(-a.v);
+  for (int i = 0; i < kN; ++i) r.d[i] = -a.d[i];
+  return r;
+}
+inline Dual operator*(const Dual &a, const Dual &b) {
+  Dual r(a.v * b.v);
+  for (int i = 0; i < kN; ++i) r.d[i] = a.d[i] * b.v + a.v * b.d[i];
+  return r;
+}
+inline Dual operator/(const Dual &a, const Dual &b) {
+  Dual r(a.v / b.v);
+  for (int i = 0; i < kN; ++i) r.d[i] = (a.d[i] - r.v * b.d[i]) / b.v;
+  return r;
+}
+
+// r = f(a) with f'(a) = df
+inline Dual chain(const Dual &a, float f, float df) {
+  Dual r(f);
+  for (int i = 0; i < kN; ++i) r.d[i] = df * a.d[i];
+  return r;
+}
+
+inline float sn_exp(float a) { return std::exp(a); }
+inline float sn_log(float a) { return std::log(a); }
+inline float sn_sqrt(float a) { return std::sqrt(a); }
+inline float sn_tanh(float a) { return std::tanh(a); }
+inline float sn_sigmoid(float a) { return 1.f / (1.f + std::exp(-a)); }
+inline float sn_abs(float a) { return std::fabs(a); }
+inline float sn_min(float a, float b) { return a < b ? a : b; }
+inline float sn_max(float a, float b) { return a > b ? a : b; }
+inline float sn_pow(float a, float b) { return std::pow(a, b); }
+
+inline Dual sn_exp(const Dual &a) { const float e = std::exp(a.v); return chain(a, e, e); }
+inline Dual sn_log(const Dual &a) { return chain(a, std::log(a.v), 1.f / a.v); }
+inline Dual sn_sqrt(const Dual &a) { const float s = std::sqrt(a.v); return chain(a, s, 0.5f / s); }
+inline Dual sn_tanh(const Dual &a) { const float t = std::tanh(a.v); return chain(a, t, 1.f - t * t); }
+inline Dual sn_sigmoid(const Dual &a) { const float s = sn_sigmoid(a.v); return chain(a, s, s * (1.f - s)); }
+inline Dual sn_abs(const Dual &a) { return chain(a, std::fabs(a.v), a.v < 0.f ? -1.f : 1.f); }
+inline Dual sn_min(const Dual &a, const Dual &b) { return a.v < b.v ? a : b; }
+inline Dual sn_max(const Dual &a, const Dual &b) { return a.v > b.v ? a : b; }
+inline Dual sn_pow(const Dual &a, const Dual &b) {
+  Dual r(std::pow(a.v, b.v));
+  const float da = b.v * std::pow(a.v, b.v - 1.f);
+  for (int i = 0; i < kN; ++i) {
+    r.d[i] = da * a.d[i];
+    // the log term only for a variable exponent, it is NaN for a <= 0
+    if (b.d[i] != 0.f) r.d[i] += r.v * std::log(a.v) * b.d[i];
+  }
+  return r;
+}
+
+// spike of the threshold expression h, the dual carries the surrogate derivative (0: sigmoid, 1: atan)
+inline float heaviside(float h, int, float) { return h >= 0.f ? 1.f : 0.f; }
+inline Dual heaviside(const Dual &h, int surrogate, float alpha) {
+  float dh;
+  if (surrogate == 0) {
+    const float s = 1.f / (1.f + std::exp(-alpha * h.v));
+    dh = alpha * s * (1.f - s);
+  } else {
+    const float u = 1.5707963267948966f * alpha * h.v;
+    dh = alpha * 0.5f / (1.f + u * u);
+  }
+  return chain(h, h.v >= 0.f ? 1.f : 0.f, dh);
+}
+
+// state after the reset: the reset value where the neuron fired
+inline float reset_blend(float spike, float reset, float state) { return spike != 0.f ? reset : state; }
+inline Dual reset_blend(const Dual &spike, const Dual &reset, const Dual &state) {
+  return spike * reset + (Dual(1.f) - spike) * state;
+}
+
+'''
+
+_LOOPS = r'''
+/*
+ * T steps of neurons [begin, end), each keeps its states in registers. x and spike are [T, n], state
+ * holds kStates pointers to [n] that are updated in place, saved ([T, kStates, n]) receives the states
+ * before every step for the backward.
+ */
+void fused_forward(const float *x, float *const *state, const float *params, float *spike_f, bool *spike_b,
+                   float *saved, int64_t T, int64_t n, int64_t begin, int64_t end) {
+  for (int64_t i = begin; i < end; ++i) {
+    float s[kStates];
+    for (int j = 0; j < kStates; ++j) s[j] = state[j][i];
+    for (int64_t t = 0; t < T; ++t) {
+      if (saved) {
+        for (int j = 0; j < kStates; ++j) saved[(t * kStates + j) * n + i] = s[j];
+      }
+      const float spike = neuron_update<float>(s, x[t * n + i], params, 0, 0.f, false);
+      if (spike_f) spike_f[t * n + i] = spike;
+      if (spike_b) spike_b[t * n + i] = spike != 0.f;
+    }
+    for (int j = 0; j < kStates; ++j) state[j][i] = s[j];
+  }
+}
+
+/*
+ * Reverse-time sweep of neurons [begin, end). Every step is re-evaluated from the saved states with
+ * dual numbers, which give the derivatives of the new states and of the spike with respect to the old
+ * states and the input. grad_state holds the gradients of the final states on entry and receives those
+ * of the initial states.
+ */
+void fused_backward(const float *x, const float *saved, const float *grad_spike, float *const *grad_state,
+                    float *grad_x, const float *params, int surrogate, float alpha, bool detach_reset,
+                    int64_t T, int64_t n, int64_t begin, int64_t end) {
+  for (int64_t i = begin; i < end; ++i) {
+    float g[kStates];
+    for (int j = 0; j < kStates; ++j) g[j] = grad_state[j][i];
+    for (int64_t t = T - 1; t >= 0; --t) {
+      Dual s[kStates];
+      for (int j = 0; j < kStates; ++j) {
+        s[j] = Dual(saved[(t * kStates + j) * n + i]);
+        s[j].d[j] = 1.f;
+      }
+      Dual in_x(x[t * n + i]);
+      in_x.d[kStates] = 1.f;
+      const Dual spike = neuron_update<Dual>(s, in_x, params, surrogate, alpha, detach_reset);
+      const float gs = grad_spike[t * n + i];
+      float grad_in[kN];
+      for (int q = 0; q < kN; ++q) {
+        float acc = gs * spike.d[q];
+        for (int j = 0; j < kStates; ++j) acc += g[j] * s[j].d[q];
+        grad_in[q] = acc;
+      }
+      grad_x[t * n + i] = grad_in[kStates];
+      for (int j = 0; j < kStates; ++j) g[j] = grad_in[j];
+    }
+    for (int j = 0; j < kStates; ++j) grad_state[j][i] = g[j];
+  }
+}
+
+'''
+
+_BINDINGS = r'''std::vector<at::Tensor> forward(at::Tensor x_seq, std::vector<at::Tensor> state, at::Tensor params,
+                                int64_t spike_format, bool save) {
+  TORCH_CHECK(x_seq.device().is_cpu() && x_seq.scalar_type() == at::kFloat && x_seq.dim() >= 1,
+      "forward(): expected a float32 CPU input [T, ...]");
+  TORCH_CHECK(static_cast<int64_t>(state.size()) == kStates, "forward(): expected ", kStates, " states");
+  auto input = x_seq.contiguous();
+  const int64_t T = input.size(0);
+  const int64_t n = T == 0 ? 0 : input.numel() / T;
+  float *state_ptr[kStates];
+  for (int j = 0; j < kStates; ++j) {
+    TORCH_CHECK(state[j].scalar_type() == at::kFloat && state[j].is_contiguous() && state[j].numel() == n,
+        "forward(): states must be contiguous float32 tensors of the shape of one step");
+    state_ptr[j] = state[j].data_ptr<float>();
+  }
+  auto p = params.to(at::kFloat).contiguous();
+  TORCH_CHECK(p.numel() == kParams, "forward(): expected ", kParams, " parameters, got ", p.numel());
+  auto spike = at::empty(input.sizes(), spike_format == 1 ? input.options().dtype(at::kBool) : input.options());
+  at::Tensor saved = save ? at::empty({T, kStates, n}, input.options()) : at::Tensor();
+  const float *x_ptr = input.data_ptr<float>();
+  const float *p_ptr = kParams ? p.data_ptr<float>() : nullptr;
+  float *spike_f = spike_format == 1 ? nullptr : spike.data_ptr<float>();
+  bool *spike_b = spike_format == 1 ? spike.data_ptr<bool>() : nullptr;
+  float *saved_ptr = save ? saved.data_ptr<float>() : nullptr;
+  const int64_t grain = std::max<int64_t>(1, at::internal::GRAIN_SIZE / std::max<int64_t>(1, T * 8));
+  at::parallel_for(0, n, grain, [&](int64_t begin, int64_t end) {
+    fused_forward(x_ptr, state_ptr, p_ptr, spike_f, spike_b, saved_ptr, T, n, begin, end);
+  });
+  return {spike, saved};
+}
+
+std::vector<at::Tensor> backward(at::Tensor x_seq, at::Tensor saved, at::Tensor grad_spike,
+                                 std::vector<at::Tensor> grad_state, at::Tensor params, int64_t surrogate,
+                                 double alpha, bool detach_reset) {
+  auto input = x_seq.contiguous();
+  auto saved_c = saved.contiguous();
+  auto grad = grad_spike.to(at::kFloat).contiguous();
+  const int64_t T = input.size(0);
+  const int64_t n = T == 0 ? 0 : input.numel() / T;
+  TORCH_CHECK(grad.numel() == input.numel() && saved_c.numel() == T * kStates * n &&
+              static_cast<int64_t>(grad_state.size()) == kStates, "backward(): inconsistent shapes");
+  std::vector<at::Tensor> out;
+  out.push_back(at::empty(input.sizes(), input.options()));
+  float *grad_ptr[kStates];
+  for (int j = 0; j < kStates; ++j) {
+    out.push_back(grad_state[j].to(at::kFloat).reshape(input.sizes().slice(1)).clone(at::MemoryFormat::Contiguous));
+    grad_ptr[j] = out.back().data_ptr<float>();
+  }
+  auto p = params.to(at::kFloat).contiguous();
+  TORCH_CHECK(p.numel() == kParams, "backward(): expected ", kParams, " parameters, got ", p.numel());
+  const float *x_ptr = input.data_ptr<float>();
+  const float *saved_ptr = saved_c.data_ptr<float>();
+  const float *gs_ptr = grad.data_ptr<float>();
+  const float *p_ptr = kParams ? p.data_ptr<float>() : nullptr;
+  float *grad_x = out[0].data_ptr<float>();
+  const int64_t grain = std::max<int64_t>(1, at::internal::GRAIN_SIZE / std::max<int64_t>(1, T * 8 * kN));
+  at::parallel_for(0, n, grain, [&](int64_t begin, int64_t end) {
+    fused_backward(x_ptr, saved_ptr, gs_ptr, grad_ptr, grad_x, p_ptr, static_cast<int>(surrogate),
+                   static_cast<float>(alpha), detach_reset, T, n, begin, end);
+  });
+  return out;
+}
+'''
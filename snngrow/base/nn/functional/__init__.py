@@ -12,4 +12,6 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
-from .linear import linear
\ No newline at end of file
+from .conv import conv2d
+from .linear import linear, linear_heads, ttfs_linear
+from .pooling import max_pool2d
\ No newline at end of file
@@ -0,0 +1,97 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from typing import List, Optional, Union
+import torch
+import torch.nn.functional as F
+from torch.autograd import Function
+from torch.cuda.amp import custom_bwd, custom_fwd
+
+from snngrow.base import SpikeTensor
+from snngrow.base.sparsespiketensor import SparseSpikeTensor
+import snngrow_backend
+
+
+class Conv2dFunction(Function):
+    """
+    2D convolution of spikes. Sparse (event) inputs on the CPU run the event-driven kernel: every
+    spike adds the weights of its channel to the outputs its receptive field reaches, so the cost
+    follows the number of spikes instead of the input size. Other inputs use the dense convolution.
+    """
+
+    @staticmethod
+    @custom_fwd
+    def forward(
+        ctx,
+        inputs: Union[SpikeTensor, SparseSpikeTensor],
+        weight: torch.Tensor,
+        bias: Optional[torch.Tensor],
+        stride: List[int],
+        padding: List[int],
+    ) -> torch.Tensor:
+
+        ctx.for_backwards = (inputs, weight, bias, stride, padding)
+        if (isinstance(inputs, SparseSpikeTensor) and inputs.device.type == "cpu"
+                and weight.dtype is torch.float32):
+            batch, _, height, width = inputs.shape
+            output = snngrow_backend.spike_conv2d_csr_cpu(
+                inputs.crow, inputs.col, weight, batch, height, width, stride, padding)
+            if bias is not None:
+                output += bias.view(1, -1, 1, 1)
+            return output
+        return F.conv2d(inputs.elem.to(weight.dtype), weight, bias, stride, padding)
+
+
+    @staticmethod
+    @custom_bwd
+    def backward(ctx, grad_output: torch.Tensor):
+
+        inputs, weight, bias, stride, padding = ctx.for_backwards
+        grad_input = grad_weight = grad_bias = None
+        if ctx.needs_input_grad[0]:
+            grad_input = torch.nn.grad.conv2d_input(inputs.shape, weight, grad_output, stride, padding)
+        if ctx.needs_input_grad[1]:
+            dense = inputs.elem.to(grad_output.dtype)
+            grad_weight = torch.nn.grad.conv2d_weight(dense, weight.shape, grad_output, stride, padding)
+        if bias is not None and ctx.needs_input_grad[2]:
+            grad_bias = grad_output.sum((0, 2, 3))
+
+        return grad_input, grad_weight, grad_bias, None, None
+
+
+def conv2d(
+    inputs: Union[SpikeTensor, SparseSpikeTensor],
+    weight: torch.Tensor,
+    bias: Optional[torch.Tensor] = None,
+    stride: Union[int, List[int]] = 1,
+    padding: Union[int, List[int]] = 0,
+) -> torch.Tensor:
+    """
+    2D convolution of spikes (no dilation or groups).
+
+    Args:
+        inputs (SpikeTensor or SparseSpikeTensor): Input spikes of shape [N, C, H, W]. Pass a
+            SparseSpikeTensor to compute event by event, which pays off at low firing rates.
+        weight (torch.Tensor): Convolution weights [out_channels, C, kh, kw].
+        bias (Optional[torch.Tensor], optional): Bias tensor. Defaults to None.
+        stride (int or list, optional): Stride of the convolution. Defaults to 1.
+        padding (int or list, optional): Implicit zero padding. Defaults to 0.
+
+    Returns:
+        torch.Tensor: Dense output of shape [N, out_channels, OH, OW]. The event-driven path returns
+        it in the channels-last memory format.
+    """
+    as_list = lambda x: [x, x] if isinstance(x, int) else list(x)
+    assert len(inputs.shape) == 4, "conv2d expects [N, C, H, W] spikes"
+    return Conv2dFunction.apply(inputs, weight, bias, as_list(stride), as_list(padding))
@@ -18,9 +18,90 @@ from torch.autograd import Function
 from torch.cuda.amp import custom_bwd, custom_fwd
 
 from snngrow.base import SpikeTensor
+from snngrow.base.spiketensor import PackedSpikeTensor, pack_bits, transpose_bits
+from snngrow.base.sparsespiketensor import SparseSpikeTensor
+from snngrow.base.spiketimetensor import SpikeTimeTensor
 import snngrow_backend
 
 
+def spike_gemm(tensor1: torch.Tensor, tensor2: torch.Tensor) -> torch.Tensor:
+    """
+    Spike GEMM on the device of the operands, one of them is a bool spike tensor. It is the
+    torch.ops.snngrow.spike_gemm custom op, which torch.compile captures without a graph break.
+    """
+    return torch.ops.snngrow.spike_gemm(tensor1, tensor2)
+
+
+def spike_gemm_rows(tensor1: torch.Tensor, tensor2: torch.Tensor, rows: torch.Tensor) -> torch.Tensor:
+    """
+    Spike GEMM on the rows of the 2D tensor1 selected by rows (unique int64 indices). The result has
+    as many rows as tensor1, rows that are not selected are zero and cost nothing on the CPU.
+    """
+    if tensor1.is_cuda:
+        selected = snngrow_backend.spike_gemm_cuda(tensor1.index_select(0, rows), tensor2)
+        output = selected.new_zeros(tensor1.size(0), selected.size(1))
+        return output.index_copy_(0, rows, selected)
+    return snngrow_backend.spike_gemm_gather_cpu(tensor1, tensor2, rows, None, rows)
+
+
+def spike_weight_grad(
+    grad_output: torch.Tensor,
+    inputs: SpikeTensor,
+    rows: Optional[torch.Tensor] = None,
+) -> torch.Tensor:
+    """
+    grad_output^T @ spikes, the weight gradient of a linear layer. grad_output is [M, out_features]
+    and the spikes of inputs (a SpikeTensor or PackedSpikeTensor) are flattened to [M, in_features],
+    or to the selected rows. On the CPU the spikes are packed and bit-transposed to K-major order, so
+    the GEMM visits their set bits instead of transposing the dense side.
+    """
+    in_features = inputs.shape[-1]
+    if grad_output.is_cuda:
+        spikes = inputs.elem.reshape(-1, in_features)
+        if rows is not None:
+            spikes = spikes.index_select(0, rows)
+        return spike_gemm(grad_output.t().contiguous(), spikes)
+
+    if isinstance(inputs, PackedSpikeTensor):
+        words = inputs.words.reshape(-1, inputs.words.size(-1))
+        if rows is not None:
+            words = words.index_select(0, rows)
+    else:
+        spikes = inputs.elem.reshape(-1, in_features)
+        words = pack_bits(spikes if rows is None else spikes.index_select(0, rows))
+    spikes_t = transpose_bits(words, in_features)
+    return snngrow_backend.spike_gemm_packed_cpu(spikes_t, grad_output.contiguous()).t()
+
+
+def spike_gemm_grouped(problems) -> list:
+    """
+    Runs a list of independent (tensor1, tensor2, out) spike GEMMs, e.g. per-head or per-timestep
+    projections, in one call. out may be None, then it is allocated. Returns the outputs.
+    """
+    if any(tensor1.is_cuda for tensor1, _, _ in problems):
+        outputs = []
+        for tensor1, tensor2, out in problems:
+            output = spike_gemm(tensor1, tensor2)
+            outputs.append(output if out is None else out.copy_(output))
+        return outputs
+    return snngrow_backend.spike_gemm_grouped_cpu(
+        [tensor1 for tensor1, _, _ in problems],
+        [tensor2 for _, tensor2, _ in problems],
+        [out for _, _, out in problems],
+    )
+
+
+def spike_gemm_heads(tensor1: torch.Tensor, tensor2: torch.Tensor, num_heads: int) -> torch.Tensor:
+    """
+    Spike GEMM [*, L, K] @ [K, H * D] with the output in the head split layout [*, H, L, D]. The CPU
+    kernel writes that layout directly, CUDA falls back to a permuted copy.
+    """
+    if tensor1.is_cuda:
+        output = snngrow_backend.spike_gemm_cuda(tensor1, tensor2)
+        return output.view(*output.shape[:-1], num_heads, -1).transpose(-2, -3).contiguous()
+    return snngrow_backend.spike_gemm_heads_cpu(tensor1, tensor2, num_heads)
+
+
 class LinearFunction(Function):
     """
     Custom Linear function.
@@ -29,8 +110,10 @@ class LinearFunction(Function):
     It supports both forward and backward computations.
 
     Args:
-        inputs (SpikeTensor): The input tensor.
+        inputs (SpikeTensor): The input tensor, a SparseSpikeTensor is multiplied event by event.
         weight (torch.Tensor): The weight tensor.
+        rows (torch.Tensor, optional): Indices of the input rows (leading dimensions flattened) to
+            compute, the output rows of pruned tokens or samples are zero and get no gradient.
 
     Returns:
         torch.Tensor: The output tensor.
@@ -47,15 +130,26 @@ class LinearFunction(Function):
         inputs: SpikeTensor,
         weight: torch.Tensor,
         bias: Optional[torch.Tensor] = None,
+        rows: Optional[torch.Tensor] = None,
     ) -> torch.Tensor:
 
         # Convert the Tensor to a Variable and save it to ctx
-        ctx.for_backwards = (inputs, weight, bias)
-        output = snngrow_backend.spike_gemm_cuda(inputs.elem, weight.t().contiguous())
+        ctx.for_backwards = (inputs, weight, bias, rows)
+        if rows is None:
+            if isinstance(inputs, SparseSpikeTensor):
+                output = inputs.matmul(weight.t().contiguous())
+            else:
+                output = spike_gemm(inputs.elem, weight.t().contiguous())
+            if bias is not None:
+                output += bias
+            return output
+
+        elem = inputs.elem
+        output = spike_gemm_rows(elem.reshape(-1, elem.size(-1)), weight.t().contiguous(), rows)
         if bias is not None:
-            output += bias
+            output[rows] += bias
 
-        return output
+        return output.view(*elem.shape[:-1], -1)
 
 
     @staticmethod
@@ -63,34 +157,45 @@ class LinearFunction(Function):
     def backward(ctx, grad_output: torch.Tensor):
 
         # grad output is the gradient value calculated from the previous level of backpropagation
-        inputs, weight, bias = ctx.for_backwards
+        inputs, weight, bias, rows = ctx.for_backwards
         grad_input = grad_weight = grad_bias = None
+        if rows is not None:
+            # only the selected rows took part in the forward pass
+            input_shape = inputs.shape
+            grad_output = grad_output.reshape(-1, grad_output.size(-1)).index_select(0, rows)
         # represents the gradient of the input, weights, and bias
         # Determine whether the corresponding variables need to reverse derivative to calculate the gradient
         if ctx.needs_input_grad[0]:
             # Derivative of composition, chain rule
             grad_input = grad_output @ weight 
+            if rows is not None:
+                grad_input = grad_input.new_zeros(input_shape).view(-1, grad_input.size(-1)) \
+                    .index_copy_(0, rows, grad_input).view(input_shape)
         if ctx.needs_input_grad[1]:
-            # dense * spike, derivative of composition, chain rule
-            grad_weight = snngrow_backend.spike_gemm_cuda(grad_output.t().contiguous(), inputs.elem)
+            # spike^T * dense, derivative of composition, chain rule
+            grad_weight = spike_weight_grad(grad_output.reshape(-1, grad_output.size(-1)), inputs, rows)
         if bias is not None and ctx.needs_input_grad[2]:
             grad_bias = grad_output.sum(0).squeeze(0)
  
-        return grad_input, grad_weight, grad_bias
+        return grad_input, grad_weight, grad_bias, None
 
 
 def linear(
     inputs: SpikeTensor,
     weight: torch.Tensor,
     bias: Optional[torch.Tensor] = None,
+    rows: Optional[torch.Tensor] = None,
 ) -> torch.Tensor:
     """
     linear operation.
 
     Args:
-        inputs (SpikeTensor): Input tensor.
+        inputs (SpikeTensor): Input tensor, or a SparseSpikeTensor for event-driven computation.
         weight (torch.Tensor): Linear weights.
         bias (Optional[torch.Tensor], optional): Bias tensor. Defaults to None.
+        rows (Optional[torch.Tensor], optional): Indices of the rows (tokens or samples, with the
+            leading dimensions flattened) to compute, e.g. after token pruning or early exit. The
+            other output rows are zero. Defaults to None, all rows.
 
     Returns:
         torch.Tensor: Output tensor after linear operation, it is the dense tensor.
@@ -99,5 +204,95 @@ def linear(
             inputs,
             weight,
             bias,
+            rows,
         )
     return output
+
+
+class LinearHeadsFunction(Function):
+    """
+    Linear function on a [*, L, in_features] SpikeTensor whose output is split into attention heads,
+    [*, num_heads, L, out_features // num_heads], without a permute + contiguous copy.
+    """
+
+    @staticmethod
+    @custom_fwd
+    def forward(
+        ctx,
+        inputs: SpikeTensor,
+        weight: torch.Tensor,
+        bias: Optional[torch.Tensor],
+        num_heads: int,
+    ) -> torch.Tensor:
+
+        ctx.for_backwards = (inputs, weight, bias)
+        output = spike_gemm_heads(inputs.elem, weight.t().contiguous(), num_heads)
+        if bias is not None:
+            output += bias.view(num_heads, 1, -1)
+
+        return output
+
+
+    @staticmethod
+    @custom_bwd
+    def backward(ctx, grad_output: torch.Tensor):
+
+        inputs, weight, bias = ctx.for_backwards
+        grad_input = grad_weight = grad_bias = None
+        # back to [*, L, out_features], the layout of the plain linear
+        grad_output = grad_output.transpose(-2, -3).reshape(*inputs.shape[:-1], -1)
+        if ctx.needs_input_grad[0]:
+            grad_input = grad_output @ weight
+        grad_output = grad_output.reshape(-1, grad_output.size(-1))
+        if ctx.needs_input_grad[1]:
+            grad_weight = spike_weight_grad(grad_output, inputs)
+        if bias is not None and ctx.needs_input_grad[2]:
+            grad_bias = grad_output.sum(0)
+
+        return grad_input, grad_weight, grad_bias, None
+
+
+def linear_heads(
+    inputs: SpikeTensor,
+    weight: torch.Tensor,
+    bias: Optional[torch.Tensor] = None,
+    num_heads: int = 1,
+) -> torch.Tensor:
+    """
+    linear operation producing multi-head attention operands.
+
+    Args:
+        inputs (SpikeTensor): Input tensor of shape [*, L, in_features].
+        weight (torch.Tensor): Linear weights.
+        bias (Optional[torch.Tensor], optional): Bias tensor. Defaults to None.
+        num_heads (int, optional): Number of heads, it must divide out_features. Defaults to 1.
+
+    Returns:
+        torch.Tensor: Dense output of shape [*, num_heads, L, out_features // num_heads], the same
+        as ``linear(...).reshape(*, L, num_heads, -1).transpose(-2, -3).contiguous()``.
+    """
+    return LinearHeadsFunction.apply(inputs, weight, bias, num_heads)
+
+
+def ttfs_linear(
+    inputs: SpikeTimeTensor,
+    weight: torch.Tensor,
+    bias: Optional[torch.Tensor] = None,
+    v_threshold: float = 1.,
+) -> SpikeTimeTensor:
+    """
+    Latency-coded (time-to-first-spike) linear layer for inference. The non-leaky membrane of an
+    output integrates the weights of the inputs that have fired, plus the bias, and the output fires
+    once when it reaches v_threshold. On the CPU the inputs are visited in spike-time order and the
+    computation stops as soon as every output has fired.
+
+    Args:
+        inputs (SpikeTimeTensor): Input spike times of shape [*, in_features].
+        weight (torch.Tensor): Linear weights.
+        bias (Optional[torch.Tensor], optional): Bias tensor. Defaults to None.
+        v_threshold (float, optional): Firing threshold. Defaults to 1.
+
+    Returns:
+        SpikeTimeTensor: Output spike times of shape [*, out_features] with the T of the inputs.
+    """
+    return inputs.linear(weight, bias, v_threshold)
@@ -0,0 +1,47 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from typing import List, Optional, Union
+import torch
+import torch.nn.functional as F
+
+from snngrow.base import SpikeTensor
+import snngrow_backend
+
+
+def max_pool2d(
+    inputs: SpikeTensor,
+    kernel_size: Union[int, List[int]],
+    stride: Optional[Union[int, List[int]]] = None,
+    padding: Union[int, List[int]] = 0,
+) -> SpikeTensor:
+    """
+    2D max pooling of spikes, which is a logical OR over every window.
+
+    Args:
+        inputs (SpikeTensor): Input spikes of shape [N, C, H, W] or [C, H, W].
+        kernel_size (int or list): Size of the pooling window.
+        stride (int or list, optional): Stride of the window. Defaults to ``kernel_size``.
+        padding (int or list, optional): Implicit zero (no spike) padding. Defaults to 0.
+
+    Returns:
+        SpikeTensor: Pooled spikes.
+    """
+    as_list = lambda x: [x] if isinstance(x, int) else list(x)
+    if inputs.elem.is_cuda:
+        out = F.max_pool2d(inputs.elem.to(torch.float16), kernel_size, stride, padding)
+        return SpikeTensor(out > 0)
+    out = snngrow_backend.spike_max_pool2d_cpu(inputs.elem, as_list(kernel_size),
+                                               [] if stride is None else as_list(stride), as_list(padding))
+    return SpikeTensor(out)
@@ -13,5 +13,5 @@
 # limitations under the License.
 
 from .norm import BatchNorm2d, LayerNorm
-from .linear import Linear
+from .linear import Linear, TTFSLinear
 from .sparse_synapse import SparseSynapse
\ No newline at end of file
@@ -17,10 +17,10 @@ import torch
 from torch import nn
 import torch.nn.functional as F
 
-from snngrow.base import SpikeTensor
+from snngrow.base import SpikeTensor, SpikeTimeTensor
 from snngrow.base.nn import functional as snngrow_F
 
-__all__ = ["Linear"]
+__all__ = ["Linear", "TTFSLinear"]
 
 class Linear(nn.Module):
     r"""Applies a linear transformation to the incoming data that maybe is SpikeTensor: :math:`y = xA^T + b`
@@ -88,11 +88,15 @@ class Linear(nn.Module):
             bound = 1 / math.sqrt(fan_in) if fan_in > 0 else 0
             nn.init.uniform_(self.bias, -bound, bound)
 
-    def forward(self, input) -> torch.Tensor:
+    def forward(self, input, rows=None) -> torch.Tensor:
+        """
+        ``rows`` optionally selects the rows (tokens or samples, leading dimensions flattened) to
+        compute for a SpikeTensor input, the other output rows are zero.
+        """
         if not self.spike_in:
             return F.linear(input, self.weight, self.bias)
         else:
-            return snngrow_F.linear(input, self.weight, self.bias)
+            return snngrow_F.linear(input, self.weight, self.bias, rows)
    
     def update(self, dw):
         """
@@ -110,4 +114,36 @@ class Linear(nn.Module):
     def extra_repr(self) -> str:
         return 'in_features={}, out_features={}, bias={}, spike_in={}'.format(
             self.in_features, self.out_features, self.bias is not None, self.spike_in
-        )
\ No newline at end of file
+        )
+
+
+class TTFSLinear(Linear):
+    r"""Linear layer of a time-to-first-spike network: it maps the input spike times (a
+    SpikeTimeTensor) to the times at which the outputs first reach ``v_threshold``, see
+    :func:`snngrow.base.nn.functional.ttfs_linear`. Inference only.
+
+    Args:
+        in_features: size of each input sample
+        out_features: size of each output sample
+        bias: If set to ``False``, the layer will not learn an additive bias.
+            Default: ``True``
+        v_threshold: firing threshold of the outputs. Default: ``1.``
+
+    Examples::
+
+        >>> m = TTFSLinear(784, 100)
+        >>> output = m(SpikeTimeTensor.from_values(images.flatten(1), T=32))
+    """
+
+    def __init__(self, in_features: int, out_features: int, bias: bool = True,
+                 device=None, dtype=None, v_threshold: float = 1.) -> None:
+        super(TTFSLinear, self).__init__(in_features, out_features, bias, device, dtype)
+        self.v_threshold = v_threshold
+
+    def forward(self, input: SpikeTimeTensor) -> SpikeTimeTensor:
+        return snngrow_F.ttfs_linear(input, self.weight, self.bias, self.v_threshold)
+
+    def extra_repr(self) -> str:
+        return 'in_features={}, out_features={}, bias={}, v_threshold={}'.format(
+            self.in_features, self.out_features, self.bias is not None, self.v_threshold
+        )
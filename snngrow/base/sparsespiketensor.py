@@ -0,0 +1,180 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from typing import Sequence
+import torch
+
+from .spiketensor import SpikeTensor, PackedSpikeTensor, pack_bits
+
+try:
+    import snngrow_backend
+except ImportError:
+    snngrow_backend = None
+
+__all__ = ["SparseSpikeTensor"]
+
+
+class SparseSpikeTensor:
+    """
+    Spikes stored as their events, CSR along the last dimension: the leading dimensions are folded
+    into rows, ``crow`` [rows + 1] holds the row offsets into ``col`` [nnz], the sorted positions of
+    the spikes of every row. For a [N, C, H, W] feature map a row is one (n, c, y) line, so the
+    events of a sample are a contiguous range. At a few percent firing rate this is much smaller
+    than bool or packed spikes, and the event-driven GEMM / convolution kernels read it directly.
+
+    N-d coordinate (COO) lists are converted with ``from_coo`` / ``coo_indices``.
+
+    Example::
+
+        >>> events = SparseSpikeTensor.from_spikes(spikes)    # SpikeTensor [B, in_features]
+        >>> out = events @ weight.t()                          # cost ~ nnz * out_features
+    """
+
+    def __init__(self, crow: torch.Tensor, col: torch.Tensor, shape: Sequence[int]):
+        shape = torch.Size(shape)
+        assert len(shape) >= 1, "SparseSpikeTensor needs at least one dimension"
+        assert crow.dtype is torch.int64 and col.dtype is torch.int64, "SparseSpikeTensor only supports int64 indices"
+        assert crow.dim() == 1 and crow.numel() == shape[:-1].numel() + 1, "crow does not match the number of rows"
+        self.crow = crow
+        self.col = col
+        self.shape = shape
+
+    @property
+    def device(self) -> torch.device:
+        return self.col.device
+
+    @property
+    def nnz(self) -> int:
+        """
+        Number of spikes.
+        """
+        return self.col.numel()
+
+    def numel(self) -> int:
+        return self.shape.numel()
+
+    def dim(self) -> int:
+        return len(self.shape)
+
+    def density(self) -> float:
+        """
+        Fraction of the neurons that fired.
+        """
+        return self.nnz / max(1, self.numel())
+
+    def __repr__(self):
+        return f"SparseSpikeTensor(shape={tuple(self.shape)}, nnz={self.nnz}, device={self.device})"
+
+    @classmethod
+    def from_spikes(cls, spikes):
+        """
+        :param spikes: a SpikeTensor, a PackedSpikeTensor, a bool tensor or float 0 / 1 spikes
+        :return: the events of the spikes
+        """
+        if isinstance(spikes, SparseSpikeTensor):
+            return spikes
+        if isinstance(spikes, PackedSpikeTensor):
+            shape, words = spikes.shape, spikes.words
+        else:
+            if isinstance(spikes, SpikeTensor):
+                spikes = spikes.elem
+            elif spikes.dtype is not torch.bool:
+                spikes = spikes != 0
+            shape, words = spikes.shape, None
+        if snngrow_backend is not None and spikes.device.type == "cpu":
+            # popcount per row for the offsets, then every row writes its set bits in parallel
+            words = pack_bits(spikes) if words is None else words
+            crow, col = snngrow_backend.spike_csr_from_packed_cpu(words)
+            return cls(crow, col, shape)
+        elem = spikes.elem if words is not None else spikes
+        rows, col = elem.reshape(-1, shape[-1]).nonzero(as_tuple=True)
+        return cls(_row_offsets(rows, shape[:-1].numel()), col, shape)
+
+    @classmethod
+    def from_coo(cls, indices: torch.Tensor, shape: Sequence[int]):
+        """
+        :param indices: int64 [ndim, nnz] coordinates of the spikes, in any order, duplicates are
+            merged
+        :param shape: shape of the spike tensor
+        """
+        shape = torch.Size(shape)
+        assert indices.dim() == 2 and indices.shape[0] == len(shape), "indices do not match the shape"
+        flat = torch.zeros(indices.shape[1], dtype=torch.int64, device=indices.device)
+        for d, size in enumerate(shape):
+            flat = flat * size + indices[d]
+        flat = torch.unique(flat)  # sorted, i.e. row-major event order
+        n = shape[-1]
+        return cls(_row_offsets(flat // n, shape[:-1].numel()), flat % n, shape)
+
+    def row_indices(self) -> torch.Tensor:
+        """
+        Row (flattened leading index) of every event.
+        """
+        rows = torch.arange(self.crow.numel() - 1, device=self.device)
+        return torch.repeat_interleave(rows, self.crow.diff())
+
+    def coo_indices(self) -> torch.Tensor:
+        """
+        int64 [ndim, nnz] coordinates of the spikes in row-major order.
+        """
+        flat = self.row_indices() * self.shape[-1] + self.col
+        coords = []
+        for size in reversed(self.shape):
+            coords.append(flat % size)
+            flat = flat // size
+        return torch.stack(coords[::-1])
+
+    @property
+    def elem(self) -> torch.Tensor:
+        """
+        The spikes as a bool tensor, scattered on every access.
+        """
+        out = torch.zeros(self.numel(), dtype=torch.bool, device=self.device)
+        out[self.row_indices() * self.shape[-1] + self.col] = True
+        return out.view(self.shape)
+
+    def to_spike_tensor(self) -> SpikeTensor:
+        return SpikeTensor(self.elem)
+
+    def pack(self) -> PackedSpikeTensor:
+        return PackedSpikeTensor(pack_bits(self.elem), self.shape[-1])
+
+    def to_dense(self, dtype=torch.float32) -> torch.Tensor:
+        return self.elem.to(dtype)
+
+    def matmul(self, other: torch.Tensor) -> torch.Tensor:
+        """
+        Event-driven [*, K] @ [K, N]: every spike adds one row of other, silent neurons cost nothing.
+        """
+        assert other.dim() == 2 and other.shape[0] == self.shape[-1], \
+            f"shapes {tuple(self.shape)} and {tuple(other.shape)} cannot be multiplied"
+        if snngrow_backend is not None and self.device.type == "cpu" and other.dtype is torch.float32:
+            out = snngrow_backend.spike_gemm_csr_cpu(self.crow, self.col, other)
+        else:
+            rows = self.crow.numel() - 1
+            values = torch.ones(self.nnz, dtype=other.dtype, device=self.device)
+            events = torch.sparse_csr_tensor(self.crow, self.col, values, (rows, self.shape[-1]))
+            out = events @ other
+        return out.view(*self.shape[:-1], other.shape[1])
+
+    __matmul__ = matmul
+
+
+def _row_offsets(rows: torch.Tensor, num_rows: int) -> torch.Tensor:
+    """
+    CSR row offsets of sorted per-event row indices.
+    """
+    crow = torch.zeros(num_rows + 1, dtype=torch.int64, device=rows.device)
+    crow[1:] = torch.bincount(rows, minlength=num_rows).cumsum(0)
+    return crow
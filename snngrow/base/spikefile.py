@@ -0,0 +1,200 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import struct
+from typing import Union
+import numpy as np
+import torch
+
+from .spiketensor import SpikeTensor, PackedSpikeTensor, pack_bits, unpack_bits
+
+__all__ = ["SpikeFile", "save_spikes", "load_spikes"]
+
+
+# File layout, all little endian:
+#   header   magic, version, ndim, frames per chunk, number of chunks, index offset, shape[ndim]
+#   chunks   the encoded chunks, each starting at a multiple of 8 bytes
+#   index    int64 [chunks, 3]: byte offset, byte length and encoding of every chunk
+# A frame is one [t, sample] slice of a [T, B, ...] spike tensor, packed into (F + 63) // 64 words
+# for F = prod(shape[2:]) spikes. Frames are stored sample major (frame = sample * T + t), so the
+# time steps of a sample are consecutive, and a chunk holds frames_per_chunk consecutive frames.
+_MAGIC = b"SNNSPIKE"
+_VERSION = 2
+_HEADER = struct.Struct("<8sIIQQQ")
+
+# Chunk encodings. RLE stores the runs of equal words of the chunk as values (uint64) followed by
+# counts (uint32), which collapses silent stretches. DELTA xors every frame with the previous frame
+# of the chunk first, the same sample one step earlier except at the first step of a sample, so that
+# slowly changing activity also turns into runs of zero words.
+ENC_RAW = 0
+ENC_RLE = 1
+ENC_DELTA = 2
+_ENCODINGS = {"raw": (ENC_RAW,), "rle": (ENC_RLE,), "delta": (ENC_DELTA,), "auto": (ENC_RAW, ENC_RLE, ENC_DELTA)}
+
+
+def _rle_encode(words: np.ndarray) -> bytes:
+    words = words.ravel()
+    starts = np.flatnonzero(np.concatenate(([True], words[1:] != words[:-1])))
+    counts = np.diff(np.append(starts, words.size)).astype(np.uint32)
+    return words[starts].tobytes() + counts.tobytes()
+
+
+def _rle_decode(payload: np.ndarray) -> np.ndarray:
+    runs = payload.size // 12
+    values = payload[:8 * runs].view(np.uint64)
+    counts = payload[8 * runs:12 * runs].view(np.uint32)
+    return np.repeat(values, counts)
+
+
+def _encode_chunk(frames: np.ndarray, encoding: str):
+    """
+    The smallest of the allowed encodings of a [frames, words] uint64 chunk, (code, payload).
+    """
+    best = None
+    for code in _ENCODINGS[encoding]:
+        if code == ENC_RAW:
+            payload = frames.tobytes()
+        elif code == ENC_RLE:
+            payload = _rle_encode(frames)
+        else:
+            delta = frames.copy()
+            delta[1:] ^= frames[:-1]
+            payload = _rle_encode(delta)
+        if best is None or len(payload) < len(best[1]):
+            best = (code, payload)
+    return best
+
+
+def save_spikes(spikes, path: str, frames_per_chunk: int = 64, encoding: str = "auto"):
+    """
+    Writes spikes of shape [T, B, ...] to a spike file.
+
+    :param spikes: a SpikeTensor, a PackedSpikeTensor, a bool tensor or float 0 / 1 spikes
+    :param path: file to write
+    :param frames_per_chunk: [t, sample] frames per chunk, the unit of random access. Chunks follow
+        the time steps of one sample before moving on to the next sample
+    :param encoding: "raw", "rle", "delta", or "auto" for the smallest one per chunk
+    """
+    assert encoding in _ENCODINGS, f"unknown spike file encoding {encoding}"
+    if isinstance(spikes, (SpikeTensor, PackedSpikeTensor)):
+        spikes = spikes.elem
+    elif spikes.dtype is not torch.bool:
+        spikes = spikes != 0
+    assert spikes.dim() >= 2, "spike files store [T, B, ...] spikes"
+    shape = tuple(spikes.shape)
+    assert spikes.shape[2:].numel() > 0, "spike frames must not be empty"
+    frames = shape[0] * shape[1]
+    words = pack_bits(spikes.detach().cpu().transpose(0, 1).reshape(frames, -1)).numpy().view(np.uint64)
+    assert frames_per_chunk * words.shape[1] < 2 ** 32, "chunks are limited to 2^32 words"
+
+    num_chunks = (frames + frames_per_chunk - 1) // frames_per_chunk
+    index = np.zeros((num_chunks, 3), dtype=np.int64)
+    with open(path, "wb") as f:
+        f.write(b"\0" * (_HEADER.size + 8 * len(shape)))
+        for c in range(num_chunks):
+            code, payload = _encode_chunk(words[c * frames_per_chunk:(c + 1) * frames_per_chunk], encoding)
+            index[c] = (f.tell(), len(payload), code)
+            f.write(payload)
+            f.write(b"\0" * (-len(payload) % 8))
+        index_offset = f.tell()
+        f.write(index.tobytes())
+        f.seek(0)
+        f.write(_HEADER.pack(_MAGIC, _VERSION, len(shape), frames_per_chunk, num_chunks, index_offset))
+        f.write(np.asarray(shape, dtype=np.int64).tobytes())
+
+
+class SpikeFile:
+    """
+    Memory-mapped reader of a spike file written by ``save_spikes`` / ``SpikeTensor.save``. Only the
+    chunks that hold the requested [t, sample] frames are read and decoded, raw chunks only for the
+    requested frames. The time steps of a sample are stored together, so reading whole samples
+    touches the fewest chunks.
+
+    Example::
+
+        >>> with SpikeFile("dvs_train.spk") as f:
+        ...     batch = f[:, 128:256]       # SpikeTensor [T, 128, ...]
+        ...     frame = f[3, 17]            # SpikeTensor [...]
+    """
+
+    def __init__(self, path: str):
+        self._data = np.memmap(path, dtype=np.uint8, mode="r")
+        magic, version, ndim, self.frames_per_chunk, num_chunks, index_offset = \
+            _HEADER.unpack_from(self._data[:_HEADER.size].tobytes())
+        assert magic == _MAGIC and version == _VERSION, f"{path} is not a version {_VERSION} spike file"
+        self.shape = torch.Size(self._data[_HEADER.size:_HEADER.size + 8 * ndim].view(np.int64).tolist())
+        self._index = self._data[index_offset:index_offset + 24 * num_chunks].view(np.int64).reshape(num_chunks, 3)
+        self._frame_size = self.shape[2:].numel()
+        self._words = (self._frame_size + 63) // 64
+
+    def __repr__(self):
+        return f"SpikeFile(shape={tuple(self.shape)}, chunks={len(self._index)})"
+
+    def __len__(self):
+        return self.shape[0]
+
+    def close(self):
+        self._data = self._index = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def _chunk_frames(self, chunk: int, rows: np.ndarray) -> np.ndarray:
+        """
+        Frames rows (relative to the chunk) of a chunk as uint64 [len(rows), words].
+        """
+        offset, nbytes, code = (int(x) for x in self._index[chunk])
+        payload = self._data[offset:offset + nbytes]
+        if code == ENC_RAW:
+            return payload.view(np.uint64).reshape(-1, self._words)[rows]
+        frames = _rle_decode(payload).reshape(-1, self._words)
+        if code == ENC_DELTA:
+            frames = np.bitwise_xor.accumulate(frames, axis=0)
+        return frames[rows]
+
+    def read(self, t=slice(None), sample=slice(None)) -> SpikeTensor:
+        """
+        Decodes spikes[t, sample]. t and sample are ints, slices or index lists, an int drops its
+        dimension like tensor indexing does.
+        """
+        ts = np.arange(self.shape[0])[t]
+        samples = np.arange(self.shape[1])[sample]
+        frames = (np.atleast_1d(ts)[:, None] + np.atleast_1d(samples)[None, :] * self.shape[0]).ravel()
+
+        words = np.zeros((frames.size, self._words), dtype=np.uint64)
+        chunks = frames // self.frames_per_chunk
+        order = np.argsort(chunks, kind="stable")
+        ids, starts = np.unique(chunks[order], return_index=True)
+        for chunk, sel in zip(ids.tolist(), np.split(order, starts[1:])):
+            words[sel] = self._chunk_frames(chunk, frames[sel] - chunk * self.frames_per_chunk)
+
+        spikes = unpack_bits(torch.from_numpy(words.view(np.int64)), self._frame_size)
+        return SpikeTensor(spikes.view(*np.shape(ts), *np.shape(samples), *self.shape[2:]))
+
+    def __getitem__(self, key) -> SpikeTensor:
+        if isinstance(key, tuple):
+            assert len(key) <= 2, "spike files are indexed by [t, sample]"
+            return self.read(*key)
+        return self.read(key)
+
+
+def load_spikes(path: str, t=slice(None), sample=slice(None)) -> SpikeTensor:
+    """
+    Reads spikes[t, sample] from a spike file, see ``SpikeFile.read``.
+    """
+    with SpikeFile(path) as f:
+        return f.read(t, sample)
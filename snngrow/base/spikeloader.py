@@ -0,0 +1,162 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import ctypes
+import time
+import uuid
+import weakref
+import torch
+from torch.utils.data import get_worker_info
+from torch.utils.data.dataloader import default_collate
+
+from .spiketensor import SpikeTensor, PackedSpikeTensor, pack_bits
+
+__all__ = ["spike_collate", "SpikeRing"]
+
+
+def _sample_words(sample) -> torch.Tensor:
+    if isinstance(sample, PackedSpikeTensor):
+        return sample.words
+    return pack_bits(sample.elem)
+
+
+def _collate(batch, collate_spikes):
+    """
+    default_collate with the spike samples of every field handed to collate_spikes.
+    """
+    elem = batch[0]
+    if isinstance(elem, (SpikeTensor, PackedSpikeTensor)):
+        return collate_spikes(batch)
+    if isinstance(elem, (tuple, list)):
+        return type(elem)(_collate(list(field), collate_spikes) for field in zip(*batch))
+    if isinstance(elem, dict):
+        return {key: _collate([sample[key] for sample in batch], collate_spikes) for key in elem}
+    return default_collate(batch)
+
+
+def _stack_packed(samples) -> PackedSpikeTensor:
+    return PackedSpikeTensor(torch.stack([_sample_words(s) for s in samples]), samples[0].shape[-1])
+
+
+def spike_collate(batch):
+    """
+    DataLoader collate_fn that stacks SpikeTensor / PackedSpikeTensor samples into a packed batch in
+    the worker, so the batch crosses the worker queue at 1 bit per spike. The other fields are
+    collated by default_collate.
+    """
+    return _collate(batch, _stack_packed)
+
+
+# rings of this process by id, the batches sent by the workers are rebuilt against them
+_RINGS = weakref.WeakValueDictionary()
+
+
+def _release_slot(busy: torch.Tensor, slot: int):
+    busy[slot] = 0
+
+
+def _ring_view(ring_id: str, slot: int, shape):
+    return _RINGS[ring_id]._view(slot, torch.Size(shape))
+
+
+class _RingBatch:
+    """
+    What a worker sends for a batch it wrote to the ring: the slot and the shape, a few bytes.
+    """
+
+    def __init__(self, ring_id, slot, shape):
+        self.ring_id, self.slot, self.shape = ring_id, slot, tuple(shape)
+
+    def __reduce__(self):
+        return (_ring_view, (self.ring_id, self.slot, self.shape))
+
+
+class SpikeRing:
+    """
+    Preallocated shared-memory ring of packed spike batches for DataLoader workers. Use it as the
+    collate_fn: a worker packs the spike fields of its batch straight into one of its slots and only
+    sends the slot number, the main process receives a PackedSpikeTensor that is a view of the slot.
+    Nothing is pickled or copied on the way.
+
+    Every worker owns slots_per_worker slots and reuses them round robin. The words of a batch have
+    a storage of their own over the slot, shared by every tensor derived from the batch: its words,
+    indexing results like batch[0], and permuted or selected views. The slot is free again only once
+    all of them are garbage collected, then the worker overwrites it. A batch, or any view of it,
+    that is kept beyond a few iterations holds its slot and stalls the worker, so clone it, and
+    slots_per_worker must exceed the prefetch_factor of the loader. Memory reached through raw
+    pointers (data_ptr) is not tracked.
+    Batches that do not fit into a slot fall back to spike_collate. pin_memory is not supported.
+
+    Example::
+
+        >>> ring = SpikeRing(slot_words=1 << 20, num_workers=16)   # 8 MiB per batch
+        >>> loader = DataLoader(dataset, batch_size, num_workers=16, collate_fn=ring)
+    """
+
+    def __init__(self, slot_words: int, num_workers: int = 0, slots_per_worker: int = 4, timeout: float = 60.):
+        self.slots_per_worker = slots_per_worker
+        self.num_groups = max(1, num_workers)
+        self.timeout = timeout
+        self.buffer = torch.zeros(self.num_groups * slots_per_worker, slot_words, dtype=torch.int64).share_memory_()
+        self.busy = torch.zeros(self.num_groups * slots_per_worker, dtype=torch.int32).share_memory_()
+        self.id = uuid.uuid4().hex
+        self._cursor = 0
+        _RINGS[self.id] = self
+
+    def _acquire(self) -> int:
+        info = get_worker_info()
+        group = 0 if info is None else info.id
+        assert group < self.num_groups, f"SpikeRing was created for {self.num_groups} workers"
+        slot = group * self.slots_per_worker + self._cursor
+        self._cursor = (self._cursor + 1) % self.slots_per_worker
+        # only this worker hands the slot out and only the consumer frees it
+        deadline = time.monotonic() + self.timeout
+        while self.busy[slot].item() != 0:
+            if time.monotonic() > deadline:
+                raise RuntimeError("SpikeRing: no free slot, the consumer keeps too many batches alive")
+            time.sleep(1e-4)
+        self.busy[slot] = 1
+        return slot
+
+    def _view(self, slot: int, shape: torch.Size) -> PackedSpikeTensor:
+        n = shape[-1]
+        words_shape = (*shape[:-1], (n + 63) // 64)
+        count = torch.Size(words_shape).numel()
+        if count == 0:
+            _release_slot(self.busy, slot)
+            return PackedSpikeTensor(self.buffer.new_empty(words_shape), n)
+        # the storage of the words owns a ctypes array over the slot, the slot is released when the
+        # storage is freed, i.e. with the last view, not with the PackedSpikeTensor wrapper
+        memory = (ctypes.c_int64 * count).from_address(self.buffer[slot].data_ptr())
+        memory.buffer = self.buffer
+        weakref.finalize(memory, _release_slot, self.busy, slot)
+        words = torch.frombuffer(memory, dtype=torch.int64, count=count).view(words_shape)
+        return PackedSpikeTensor(words, n)
+
+    def _collate_spikes(self, samples):
+        n = samples[0].shape[-1]
+        shape = torch.Size((len(samples), *samples[0].shape))
+        words_shape = (*shape[:-1], (n + 63) // 64)
+        if torch.Size(words_shape).numel() > self.buffer.shape[1]:
+            return _stack_packed(samples)
+        slot = self._acquire()
+        words = self.buffer[slot, :torch.Size(words_shape).numel()].view(words_shape)
+        for i, sample in enumerate(samples):
+            words[i].copy_(_sample_words(sample))
+        if get_worker_info() is None:
+            return self._view(slot, shape)
+        return _RingBatch(self.id, slot, shape)
+
+    def __call__(self, batch):
+        return _collate(batch, self._collate_spikes)
@@ -12,11 +12,140 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+import math
+from typing import Optional
 import torch
 from torch.autograd import Function
 from torch.utils import _pytree as pytree
 
-__all__ = ["SpikeTensor"]
+try:
+    import snngrow_backend
+except ImportError:
+    snngrow_backend = None
+
+__all__ = ["SpikeTensor", "PackedSpikeTensor"]
+
+
+def _aten_ops(*names):
+    """
+    Looks up aten overloads by "packet.overload" name, the ones this torch version lacks are skipped.
+    """
+    ops = set()
+    for name in names:
+        packet, overload = name.split(".")
+        try:
+            ops.add(getattr(getattr(torch.ops.aten, packet), overload))
+        except (AttributeError, RuntimeError):
+            pass
+    return frozenset(ops)
+
+
+# Structural ops that a PackedSpikeTensor runs on its words as long as the packed last dimension
+# is left alone.
+_PACKED_LEADING_OPS = _aten_ops(
+    "view.default", "_unsafe_view.default", "reshape.default", "permute.default", "select.int",
+    "slice.Tensor", "unsqueeze.default", "alias.default", "detach.default", "clone.default",
+    "cat.default", "stack.default",
+)
+
+
+# Word-parallel logic of the CPU kernels, they must match ``BitOp`` in
+# snngrow_backend/spike_cpu/kernels.h
+BIT_AND = 0
+BIT_OR = 1
+BIT_XOR = 2
+BIT_AND_NOT = 3
+BIT_NOT = 4
+
+
+def _aten_op_map(table):
+    return {op: value for name, value in table.items() for op in _aten_ops(name)}
+
+
+# Elementwise logic that PackedSpikeTensor runs on whole words, 64 neurons per operation.
+_PACKED_BINARY_OPS = _aten_op_map({
+    "logical_and.default": BIT_AND, "bitwise_and.Tensor": BIT_AND, "mul.Tensor": BIT_AND,
+    "logical_or.default": BIT_OR, "bitwise_or.Tensor": BIT_OR,
+    "logical_xor.default": BIT_XOR, "bitwise_xor.Tensor": BIT_XOR,
+})
+_PACKED_NOT_OPS = _aten_ops("logical_not.default", "bitwise_not.default")
+
+# Reductions that PackedSpikeTensor computes from the words: counts by popcount, any / all by
+# or / and of whole words.
+_PACKED_REDUCTIONS = _aten_ops(
+    "sum.default", "sum.dim_IntList", "count_nonzero.default", "count_nonzero.dim_IntList",
+    "any.default", "any.dim", "any.dims", "all.default", "all.dim", "all.dims",
+)
+
+
+def _use_cpu_kernels(tensor: torch.Tensor) -> bool:
+    return snngrow_backend is not None and tensor.device.type == "cpu"
+
+
+def pack_bits(spikes: torch.Tensor) -> torch.Tensor:
+    """
+    Packs the last dimension of a bool tensor into int64 words, bit j of word w is element
+    w * 64 + j. Rows are padded with zero bits.
+    """
+    if _use_cpu_kernels(spikes):
+        return torch.ops.snngrow.pack_spikes(spikes)
+    n = spikes.shape[-1]
+    words = (n + 63) // 64
+    bits = torch.nn.functional.pad(spikes.to(torch.int64), (0, words * 64 - n))
+    shifts = torch.arange(64, dtype=torch.int64, device=spikes.device)
+    return (bits.view(*spikes.shape[:-1], words, 64) << shifts).sum(-1)
+
+
+def unpack_bits(words: torch.Tensor, n: int) -> torch.Tensor:
+    """
+    Inverse of pack_bits, n is the length of the unpacked last dimension.
+    """
+    if _use_cpu_kernels(words):
+        return torch.ops.snngrow.unpack_spikes(words, n)
+    shifts = torch.arange(64, dtype=torch.int64, device=words.device)
+    bits = (words.unsqueeze(-1) >> shifts) & 1
+    return bits.flatten(-2)[..., :n].to(torch.bool)
+
+
+def bitwise_bits(a: torch.Tensor, b: Optional[torch.Tensor], op: int, n: int) -> torch.Tensor:
+    """
+    Word-parallel logic on packed spikes with n spikes per row, b is None for BIT_NOT. The padding
+    bits of the result stay zero.
+    """
+    if _use_cpu_kernels(a):
+        return snngrow_backend.spike_bitwise_cpu(a, b, op, n)
+    if op == BIT_AND:
+        return a & b
+    if op == BIT_OR:
+        return a | b
+    if op == BIT_XOR:
+        return a ^ b
+    if op == BIT_AND_NOT:
+        return a & ~b
+    out = ~a
+    if n % 64:
+        out[..., -1] &= (1 << (n % 64)) - 1
+    return out
+
+
+def count_bits(words: torch.Tensor) -> torch.Tensor:
+    """
+    Number of spikes in every row of packed words, as int64.
+    """
+    if _use_cpu_kernels(words):
+        return snngrow_backend.spike_count_cpu(words)
+    return unpack_bits(words, words.shape[-1] * 64).sum(-1)
+
+
+def transpose_bits(words: torch.Tensor, n: int) -> torch.Tensor:
+    """
+    Transposes the last two dimensions of packed matrices with n columns, the result is packed
+    along the former rows. 64 x 64 bit blocks at a time on the CPU.
+    """
+    if _use_cpu_kernels(words):
+        return snngrow_backend.transpose_packed_cpu(words, n)
+    return pack_bits(unpack_bits(words, n).transpose(-1, -2))
+
 
 class from_dense(Function):
     @staticmethod
@@ -40,13 +169,28 @@ class to_dense(Function):
         return grad_output
 
 class SpikeTensor(torch.Tensor):
+    """
+    Bool spikes that act as a float32 tensor. The tensor is a SpikeTensorImpl of the extension
+    (snngrow_backend/spike_cpu/spike_tensor.h) on the PrivateUse3 dispatch key, its ops run on the bool
+    ``elem`` in the boxed fallback of snngrow_backend/spike_cpu/library.cpp without coming back to python:
+    bool results are spikes, dense ones are thresholded as in ``from_dense``, and matrix products with a
+    float32 operand run on the spike GEMM. This class gives the results their python type and the spike
+    methods below.
+    """
     @staticmethod
     def __new__(cls, elem):
         assert elem.dtype is torch.bool, "SpikeTensor only supports boolean dtype"
-        return torch.Tensor._make_wrapper_subclass(cls, elem.shape, dtype=torch.float32, device=elem.device, requires_grad=elem.requires_grad)
-    
-    def __init__(self, elem):
-        self.elem = elem
+        assert snngrow_backend is not None, "SpikeTensor needs the snngrow_backend extension"
+        spikes = snngrow_backend.spike_tensor(elem)
+        spikes.__class__ = cls
+        return spikes
+
+    @property
+    def elem(self):
+        """
+        The spikes as a bool tensor of the same shape, a view shared with the spike tensor.
+        """
+        return snngrow_backend.spike_tensor_elem(self)
 
     def __repr__(self):
         autograd_info = f", grad_fn={self.grad_fn}" if self.grad_fn else f", requires_grad=True" if self.requires_grad else ""
@@ -58,25 +202,279 @@ class SpikeTensor(torch.Tensor):
     
     def to_dense(self, dtype=torch.float32):
         return to_dense.apply(self.elem, dtype)
-    
+
+    def pack(self):
+        """
+        Returns the spikes as a PackedSpikeTensor, 64 spikes per int64 word along the last dimension.
+        """
+        return PackedSpikeTensor(pack_bits(self.elem), self.shape[-1])
+
+    def save(self, path, frames_per_chunk=64, encoding="auto"):
+        """
+        Writes the [T, B, ...] spikes to a bit-packed spike file, see ``snngrow.base.spikefile``.
+        """
+        from .spikefile import save_spikes
+        save_spikes(self, path, frames_per_chunk, encoding)
+
+    @staticmethod
+    def load(path, t=slice(None), sample=slice(None)):
+        """
+        Reads spikes[t, sample] from a spike file through a memory map, only the chunks that hold
+        those frames are decoded.
+        """
+        from .spikefile import load_spikes
+        return load_spikes(path, t, sample)
+
+    def share_memory_(self):
+        """
+        Moves the bool spikes to shared memory, processes that receive the tensor then map them
+        instead of copying.
+        """
+        self.elem.share_memory_()
+        return self
+
+    def is_shared(self):
+        return self.elem.is_shared()
+
+    def __reduce_ex__(self, protocol):
+        # shared spikes are passed by handle, the others are packed so that pickles and
+        # DataLoader queues carry 1 bit per spike
+        if self.elem.is_shared() or self.elem.is_cuda:
+            return (SpikeTensor, (self.elem,))
+        return (_rebuild_packed_spikes, (pack_bits(self.elem), self.shape[-1], True))
+
+    def __deepcopy__(self, memo):
+        # torch.Tensor.__deepcopy__ copies the storage, a spike tensor has none
+        if id(self) not in memo:
+            memo[id(self)] = SpikeTensor(self.elem.clone())
+        return memo[id(self)]
+
+    @classmethod
+    def __torch_function__(cls, func, types, args=(), kwargs=None):
+        # the op runs in the C++ fallback, here only its spike results get the SpikeTensor type
+        with torch._C.DisableTorchFunctionSubclass():
+            out = func(*args, **(kwargs or {}))
+        return _as_spike_tensors(out)
+
+
+def _as_spike_tensors(out):
+    # results come back from the dispatcher as plain tensors, the spike tensors among them are typed in
+    # place
+    if type(out) is torch.Tensor:
+        if snngrow_backend.is_spike_tensor(out):
+            out.__class__ = SpikeTensor
+    elif isinstance(out, (tuple, list)):
+        for x in out:
+            _as_spike_tensors(x)
+    return out
+
+
+class PackedSpikeTensor(torch.Tensor):
+    """
+    SpikeTensor stored as bits, 8 times smaller than the bool ``elem`` of SpikeTensor. ``words`` is
+    an int64 tensor [..., (n + 63) // 64] for spikes of shape [..., n]: bit j of word w is element
+    w * 64 + j of the last dimension and every row is padded with zero bits.
+
+    Transposing the last two dimensions runs the bit-matrix transpose kernel and stays packed, the
+    other ops work on the unpacked SpikeTensor.
+    """
+    @staticmethod
+    def __new__(cls, words, n):
+        assert words.dtype is torch.int64, "PackedSpikeTensor only supports int64 words"
+        assert words.dim() >= 1 and words.shape[-1] == (n + 63) // 64, "words do not match the number of spikes"
+        return torch.Tensor._make_wrapper_subclass(cls, (*words.shape[:-1], n), dtype=torch.float32, device=words.device)
+
+    def __init__(self, words, n):
+        self.words = words
+
+    def __repr__(self):
+        return f"PackedSpikeTensor({self.unpack().elem}, public_dtype={self.dtype})"
+
+    @classmethod
+    def from_spikes(cls, spikes):
+        """
+        Packs a SpikeTensor or a bool tensor.
+        """
+        if isinstance(spikes, SpikeTensor):
+            spikes = spikes.elem
+        return cls(pack_bits(spikes), spikes.shape[-1])
+
+    @property
+    def elem(self):
+        """
+        The spikes as a bool tensor, unpacked on every access.
+        """
+        return unpack_bits(self.words, self.shape[-1])
+
+    def unpack(self):
+        return SpikeTensor(self.elem)
+
+    def to_dense(self, dtype=torch.float32):
+        return self.elem.to(dtype)
+
+    def share_memory_(self):
+        self.words.share_memory_()
+        return self
+
+    def is_shared(self):
+        return self.words.is_shared()
+
+    def __reduce_ex__(self, protocol):
+        return (_rebuild_packed_spikes, (self.words, self.shape[-1], False))
+
     __torch_function__ = torch._C._disabled_torch_function_impl
 
     @classmethod
     def __torch_dispatch__(cls, func, types, args, kwargs=None):
-        if func is torch.ops.aten.mm.default:
-            print("mm is called")
-            args, kwargs = pytree.tree_map_only(SpikeTensor, lambda x: x.to_dense(), (args, kwargs))
-            return func(*args, **kwargs)
-        elif func is torch.ops.aten.mul.Tensor:
-            print("mul is called")
-            args, kwargs = pytree.tree_map_only(SpikeTensor, lambda x: x.to_dense(), (args, kwargs))
-            return func(*args, **kwargs)
+        kwargs = kwargs or {}
+        if func is torch.ops.aten.transpose.int or func is torch.ops.aten.t.default:
+            self = args[0]
+            ndim = self.dim()
+            if func is torch.ops.aten.t.default:
+                dim0, dim1 = 0, ndim - 1
+            else:
+                dim0, dim1 = (d % ndim for d in args[1:3])
+            if ndim < 2 or dim0 == dim1:
+                return self
+            if {dim0, dim1} == {ndim - 2, ndim - 1}:
+                return PackedSpikeTensor(transpose_bits(self.words, self.shape[-1]), self.shape[-2])
+            if ndim - 1 not in (dim0, dim1):
+                # the packed dimension stays in place, this is a view of the words
+                return PackedSpikeTensor(self.words.transpose(dim0, dim1), self.shape[-1])
+        elif func in _PACKED_LEADING_OPS:
+            out = _packed_leading_op(func, args, kwargs)
+            if out is not None:
+                return out
+        elif func in _PACKED_BINARY_OPS:
+            a, b = args[0], args[1]
+            if isinstance(a, PackedSpikeTensor) and isinstance(b, PackedSpikeTensor) and a.shape == b.shape:
+                return PackedSpikeTensor(bitwise_bits(a.words, b.words, _PACKED_BINARY_OPS[func], a.shape[-1]), a.shape[-1])
+        elif func in _PACKED_NOT_OPS:
+            self = args[0]
+            return PackedSpikeTensor(bitwise_bits(self.words, None, BIT_NOT, self.shape[-1]), self.shape[-1])
+        elif func in _PACKED_REDUCTIONS:
+            out = _packed_reduction(func, args, kwargs)
+            if out is not None:
+                return out
+        elif func is torch.ops.aten.mm.default:
+            a, b = args[0], args[1]
+            if (isinstance(a, PackedSpikeTensor) and type(b) is torch.Tensor and b.dtype is torch.float32
+                    and _use_cpu_kernels(a) and b.device == a.device):
+                # the GEMM walks the set bits of the words, no bool operand is built
+                return snngrow_backend.spike_gemm_packed_cpu(a.words, b)
+        args, kwargs = pytree.tree_map_only(PackedSpikeTensor, lambda x: x.unpack(), (args, kwargs))
+        return func(*args, **kwargs)
+
+
+def _rebuild_packed_spikes(words, n, unpack):
+    packed = PackedSpikeTensor(words, n)
+    return packed.unpack() if unpack else packed
+
+
+def _packed_leading_op(func, args, kwargs):
+    """
+    Runs a structural op of a PackedSpikeTensor on its words. Returns None when the op moves, cuts
+    or resizes the packed last dimension, then the caller unpacks.
+    """
+    aten = torch.ops.aten
+    if func is aten.cat.default or func is aten.stack.default:
+        tensors = args[0]
+        dim = args[1] if len(args) > 1 else kwargs.get("dim", 0)
+        if not tensors or not all(isinstance(t, PackedSpikeTensor) for t in tensors):
+            return None
+        n, ndim = tensors[0].shape[-1], tensors[0].dim()
+        if any(t.shape[-1] != n for t in tensors):
+            return None
+        # stack inserts a dimension, the packed one must stay last
+        if dim % (ndim + (func is aten.stack.default)) >= ndim - (func is aten.cat.default):
+            return None
+        return PackedSpikeTensor(func([t.words for t in tensors], dim), n)
+
+    self = args[0]
+    n, ndim = self.shape[-1], self.dim()
+    if func in (aten.alias.default, aten.detach.default, aten.clone.default):
+        return PackedSpikeTensor(func(self.words), n)
+    if func is aten.select.int or func is aten.slice.Tensor:
+        dim = args[1] if len(args) > 1 else kwargs.get("dim", 0)
+        if ndim == 0 or dim % ndim == ndim - 1:
+            return None
+        return PackedSpikeTensor(func(self.words, *args[1:], **kwargs), n)
+    if func is aten.unsqueeze.default:
+        if args[1] % (ndim + 1) == ndim:
+            return None
+        return PackedSpikeTensor(func(self.words, args[1]), n)
+    if func is aten.permute.default:
+        dims = [d % ndim for d in args[1]]
+        if not dims or dims[-1] != ndim - 1:
+            return None
+        return PackedSpikeTensor(func(self.words, dims), n)
+    # view / reshape: the leading dimensions may be regrouped freely
+    shape = list(args[1])
+    if not shape or shape[-1] != n:
+        return None
+    return PackedSpikeTensor(func(self.words, shape[:-1] + [self.words.shape[-1]]), n)
+
+
+def _packed_reduction(func, args, kwargs):
+    """
+    sum / count_nonzero / any / all of a PackedSpikeTensor over some dimensions. Reducing the packed
+    dimension works on row popcounts or whole words, reducing leading dimensions counts, ors or ands
+    the rows of words. Returns None when the CPU kernels are not available.
+    """
+    aten = torch.ops.aten
+    self = args[0]
+    ndim, n = self.dim(), self.shape[-1]
+    if ndim == 0 or n == 0 or self.numel() == 0 or not _use_cpu_kernels(self.words):
+        return None
+    dims = args[1] if len(args) > 1 else kwargs.get("dim")
+    keepdim = args[2] if len(args) > 2 else kwargs.get("keepdim", False)
+    if isinstance(dims, int):
+        dims = [dims]
+    last = ndim - 1
+    dims = sorted({d % ndim for d in dims}) if dims else list(range(ndim))
+    lead = [d for d in dims if d != last]
+    keep = [d for d in range(last) if d not in dims]
+    packet = func.overloadpacket
+
+    if last in dims:
+        words = self.words
+        if packet is aten.sum or packet is aten.count_nonzero:
+            out = count_bits(words)
+            if lead:
+                out = out.sum(lead, keepdim=keepdim)
+        else:
+            if packet is aten.any:
+                out = words.ne(0).any(-1)
+            else:
+                full = torch.full((words.shape[-1],), -1, dtype=torch.int64, device=words.device)
+                if n % 64:
+                    full[-1] = (1 << (n % 64)) - 1
+                out = (words == full).all(-1)
+            for d in reversed(lead):
+                out = out.any(d, keepdim=keepdim) if packet is aten.any else out.all(d, keepdim=keepdim)
+        if keepdim:
+            out = out.unsqueeze(-1)
+    else:
+        # reduced dimensions become the rows, the kept ones the groups of words
+        words = self.words.permute(lead + keep + [last])
+        rows = math.prod(self.shape[d] for d in lead)
+        groups = math.prod(self.shape[d] for d in keep)
+        kept_shape = [self.shape[d] for d in keep] + [n]
+        if packet is aten.sum or packet is aten.count_nonzero:
+            words = words.reshape(rows, groups, words.shape[-1])
+            out = snngrow_backend.spike_count_columns_cpu(words, n).reshape(kept_shape)
         else:
-            args, kwargs = pytree.tree_map_only(SpikeTensor, lambda x: x.elem, (args, kwargs))
-            out = func(*args, **kwargs)
-            out = pytree.tree_map_only(torch.Tensor, lambda x: SpikeTensor.from_dense(x), out)
-            return out
-        
+            op = BIT_OR if packet is aten.any else BIT_AND
+            reduced = snngrow_backend.spike_reduce_cpu(words.reshape(rows, -1), op)
+            out = unpack_bits(reduced.view(groups, -1), n).reshape(kept_shape)
+        if keepdim:
+            for d in lead:
+                out = out.unsqueeze(d)
+
+    if packet is aten.sum:
+        return out.to(kwargs.get("dtype") or torch.float32)
+    return out
+
 
 def test():
     dense_tensor = torch.Tensor([[1,0,1], [1, 1, 1], [0, 0, 0]]).to(torch.float32)
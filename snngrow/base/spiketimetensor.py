@@ -0,0 +1,116 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from typing import Optional
+import torch
+
+from .spiketensor import SpikeTensor, PackedSpikeTensor
+
+try:
+    import snngrow_backend
+except ImportError:
+    snngrow_backend = None
+
+__all__ = ["SpikeTimeTensor"]
+
+# Spike time of a neuron that never fires, it must match ``kNeverFires`` in
+# snngrow_backend/spike_cpu/kernels.h
+NEVER_FIRES = 255
+
+
+class SpikeTimeTensor:
+    """
+    Time-to-first-spike (TTFS) coding: every neuron fires at most once, so one uint8 spike time per
+    neuron replaces its T bits / bytes. ``times`` has the shape of the population, a time >= T
+    (``NEVER_FIRES``) means the neuron stays silent. T is at most 255.
+
+    Example::
+
+        >>> x = SpikeTimeTensor.from_values(images.flatten(1), T=32)   # bright pixels fire early
+        >>> y = snngrow_F.ttfs_linear(x, weight, bias, v_threshold=1.)
+    """
+
+    def __init__(self, times: torch.Tensor, T: int):
+        assert times.dtype is torch.uint8, "SpikeTimeTensor only supports uint8 spike times"
+        assert 0 <= T < NEVER_FIRES + 1, "spike times are uint8, T must be at most 255"
+        self.times = times
+        self.T = T
+
+    @property
+    def shape(self) -> torch.Size:
+        return self.times.shape
+
+    @property
+    def device(self) -> torch.device:
+        return self.times.device
+
+    def __repr__(self):
+        return f"SpikeTimeTensor(T={self.T}, shape={tuple(self.shape)}, device={self.device})"
+
+    @classmethod
+    def from_sequence(cls, spikes, T: Optional[int] = None):
+        """
+        :param spikes: spikes of shape [T, B, ...], or [T * B, ...] if ``T`` is given. A
+            SpikeTensor, a PackedSpikeTensor, a bool tensor or float 0 / 1 spikes. Only the first
+            spike of every neuron is kept.
+        :param T: number of time steps folded into the first dimension
+        """
+        if isinstance(spikes, (SpikeTensor, PackedSpikeTensor)):
+            spikes = spikes.elem
+        elif spikes.dtype is not torch.bool:
+            spikes = spikes != 0
+        if T is not None:
+            spikes = spikes.reshape(T, spikes.shape[0] // T, *spikes.shape[1:])
+        T = spikes.shape[0]
+        first = spikes.to(torch.uint8).argmax(0).to(torch.uint8)
+        never = torch.full_like(first, NEVER_FIRES)
+        return cls(torch.where(spikes.any(0), first, never), T)
+
+    @classmethod
+    def from_values(cls, x: torch.Tensor, T: int):
+        """
+        Latency encoding of values in [0, 1]: 1 fires at step 0, smaller values later, values <= 0
+        never.
+        """
+        times = torch.round((1. - x.clamp(0., 1.)) * (T - 1)).to(torch.uint8)
+        return cls(torch.where(x > 0, times, torch.full_like(times, NEVER_FIRES)), T)
+
+    def fired(self) -> torch.Tensor:
+        """
+        Whether every neuron fires within the T steps.
+        """
+        return self.times < self.T
+
+    def to_sequence(self) -> SpikeTensor:
+        """
+        The spikes in the [T, B, ...] layout, one spike per firing neuron.
+        """
+        steps = torch.arange(self.T, device=self.device).view(-1, *([1] * self.times.dim()))
+        return SpikeTensor(self.times.unsqueeze(0) == steps)
+
+    def linear(self, weight: torch.Tensor, bias: Optional[torch.Tensor] = None, v_threshold: float = 1.):
+        """
+        Latency-coded linear layer, see ``snngrow.base.nn.functional.ttfs_linear``.
+        """
+        weight_t = weight.t().contiguous()
+        if snngrow_backend is not None and self.device.type == "cpu" and weight.dtype is torch.float32:
+            return SpikeTimeTensor(snngrow_backend.ttfs_linear_cpu(self.times, weight_t, bias, v_threshold, self.T), self.T)
+        # the membrane of every step from the inputs fired so far, T times the memory of the kernel
+        fired = (self.times.unsqueeze(0) <= torch.arange(self.T, device=self.device).view(-1, *([1] * self.times.dim())))
+        v = fired.to(weight.dtype) @ weight_t
+        if bias is not None:
+            v = v + bias
+        crossed = v >= v_threshold
+        first = crossed.to(torch.uint8).argmax(0).to(torch.uint8)
+        return SpikeTimeTensor(torch.where(crossed.any(0), first, torch.full_like(first, NEVER_FIRES)), self.T)
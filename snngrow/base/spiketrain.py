@@ -0,0 +1,144 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from typing import Optional
+import torch
+
+from .spiketensor import (SpikeTensor, PackedSpikeTensor, BIT_AND, BIT_OR, BIT_XOR, BIT_NOT,
+                          pack_bits, unpack_bits, transpose_bits, count_bits, bitwise_bits)
+
+try:
+    import snngrow_backend
+except ImportError:
+    snngrow_backend = None
+
+__all__ = ["SpikeTrain"]
+
+
+class SpikeTrain:
+    """
+    Spike trains packed along time: bit t % 64 of word t // 64 of a neuron is its spike at step t.
+    ``words`` has shape [*shape, (T + 63) // 64] for a population of shape ``shape``, so for
+    T <= 64 the whole train of a neuron is one int64 word and spike counts, first spike times and
+    temporal or / and are a single instruction per neuron.
+
+    Example::
+
+        >>> out = lif(x_seq)                       # [T * B, ...] with parallel_optim=True
+        >>> train = SpikeTrain.from_sequence(out, T=lif.T)
+        >>> rate = train.rate()                    # [B, ...]
+    """
+
+    def __init__(self, words: torch.Tensor, T: int):
+        assert words.dtype is torch.int64, "SpikeTrain only supports int64 words"
+        assert words.dim() >= 1 and words.shape[-1] == (T + 63) // 64, "words do not match the number of time steps"
+        self.words = words
+        self.T = T
+
+    @property
+    def shape(self) -> torch.Size:
+        """
+        Shape of the neuron population.
+        """
+        return self.words.shape[:-1]
+
+    @property
+    def device(self) -> torch.device:
+        return self.words.device
+
+    def __repr__(self):
+        return f"SpikeTrain(T={self.T}, shape={tuple(self.shape)}, device={self.device})"
+
+    @classmethod
+    def from_sequence(cls, spikes: torch.Tensor, T: Optional[int] = None):
+        """
+        :param spikes: spikes of shape [T, B, ...], or [T * B, ...] as returned by
+            ``BaseNode.parallel_optim_forward`` if ``T`` is given. A SpikeTensor, a
+            PackedSpikeTensor, a bool tensor or float 0 / 1 spikes.
+        :param T: number of time steps folded into the first dimension
+        :return: the trains of the [B, ...] neurons
+        """
+        if isinstance(spikes, (SpikeTensor, PackedSpikeTensor)):
+            spikes = spikes.elem
+        elif spikes.dtype is not torch.bool:
+            spikes = spikes != 0
+        if T is not None:
+            spikes = spikes.reshape(T, spikes.shape[0] // T, *spikes.shape[1:])
+        T, neurons = spikes.shape[0], spikes.shape[1:]
+        # pack every time step, then a bit-matrix transpose turns the [T, N] bits into N trains
+        steps = pack_bits(spikes.reshape(T, -1))
+        words = transpose_bits(steps, spikes[0].numel())
+        return cls(words.view(*neurons, words.shape[-1]), T)
+
+    def to_sequence(self) -> SpikeTensor:
+        """
+        The spikes in the [T, B, ...] layout.
+        """
+        n = self.shape.numel()
+        steps = transpose_bits(self.words.reshape(n, -1), self.T)
+        return SpikeTensor(unpack_bits(steps, n).view(self.T, *self.shape))
+
+    def count(self) -> torch.Tensor:
+        """
+        Number of spikes of every neuron, int64.
+        """
+        return count_bits(self.words)
+
+    def rate(self) -> torch.Tensor:
+        """
+        Rate decoding: the firing rate of every neuron over the T steps.
+        """
+        return self.count().to(torch.float32) / self.T
+
+    def first_spike_time(self) -> torch.Tensor:
+        """
+        Step of the first spike of every neuron (int64), T for neurons that never fire.
+        """
+        if snngrow_backend is not None and self.device.type == "cpu":
+            return snngrow_backend.spike_first_time_cpu(self.words, self.T)
+        bits = unpack_bits(self.words, self.T)
+        first = bits.to(torch.uint8).argmax(-1)
+        return torch.where(bits.any(-1), first, torch.full_like(first, self.T))
+
+    def any(self) -> torch.Tensor:
+        """
+        Temporal or: whether every neuron fired at least once.
+        """
+        return self.words.ne(0).any(-1)
+
+    def all(self) -> torch.Tensor:
+        """
+        Temporal and: whether every neuron fired at every step.
+        """
+        full = torch.full((self.words.shape[-1],), -1, dtype=torch.int64, device=self.device)
+        if self.T % 64:
+            full[-1] = (1 << (self.T % 64)) - 1
+        return (self.words == full).all(-1)
+
+    def _combine(self, other, op):
+        assert isinstance(other, SpikeTrain) and other.T == self.T and other.shape == self.shape, \
+            "spike trains must have the same number of steps and neurons"
+        return SpikeTrain(bitwise_bits(self.words, other.words, op, self.T), self.T)
+
+    def __and__(self, other):
+        return self._combine(other, BIT_AND)
+
+    def __or__(self, other):
+        return self._combine(other, BIT_OR)
+
+    def __xor__(self, other):
+        return self._combine(other, BIT_XOR)
+
+    def __invert__(self):
+        return SpikeTrain(bitwise_bits(self.words, None, BIT_NOT, self.T), self.T)
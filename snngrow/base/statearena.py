@@ -0,0 +1,140 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import weakref
+import torch
+import torch.nn as nn
+
+from .neuron.BaseNode import BaseNode
+
+__all__ = ["StateArena"]
+
+# arena of every network, utils.reset looks it up
+_ARENAS = weakref.WeakKeyDictionary()
+
+
+class StateArena:
+    """
+    Contiguous storage of the stateful variables (``v`` and any other registered memory) of every
+    BaseNode of a network, one flat buffer per dtype and device. The memories become views of the
+    buffers, so resetting the network is one ``fill_`` (or ``copy_``) per buffer instead of a
+    ``deepcopy`` per memory and a fresh ``full_like`` on the next step, and the whole state can be
+    saved and restored as one blob.
+
+    The memories must be tensors when the arena is built: run the network once or pass
+    ``example_input``. The views keep the shapes of that run, build a new arena for other input
+    shapes, and build it after the network has been moved to its device and dtype. The fused CPU
+    kernels update the views in place; the python neuron equations assign new tensors, those are
+    pointed back at the views by ``reset``.
+
+    Args:
+        net (nn.Module): Network whose neurons are bound to the arena.
+        example_input (torch.Tensor, optional): Input of a forward pass under ``torch.no_grad`` that
+            materializes the memories. Defaults to None.
+    """
+
+    def __init__(self, net: nn.Module, example_input=None):
+        if example_input is not None:
+            with torch.no_grad():
+                net(example_input)
+
+        groups = {}
+        for node in net.modules():
+            if not isinstance(node, BaseNode):
+                continue
+            for name, value in node.named_memories():
+                if not isinstance(value, torch.Tensor):
+                    raise ValueError(f"memory '{name}' of {node} is not a tensor yet, run the network once "
+                                     "or pass example_input")
+                groups.setdefault((value.dtype, value.device), []).append((node, name, value))
+
+        self.buffers = []
+        self.bindings = []
+        self._reset_values = []
+        for (dtype, device), memories in groups.items():
+            buffer = torch.empty(sum(value.numel() for _, _, value in memories), dtype=dtype, device=device)
+            views = []
+            offset = 0
+            for node, name, value in memories:
+                view = buffer[offset:offset + value.numel()].view(value.shape)
+                view.copy_(value.detach())
+                offset += value.numel()
+                node.bind_memory(name, view)
+                self.bindings.append((node, name, view))
+                views.append((view, node.reset_value(name)))
+            self.buffers.append(buffer)
+            self._reset_values.append(self._reset_blob(buffer, views))
+        self.nodes = {node for node, _, _ in self.bindings}
+        _ARENAS[net] = self
+
+    @staticmethod
+    def _reset_blob(buffer: torch.Tensor, views):
+        """
+        The reset state of a buffer: a scalar when every memory resets to the same number, otherwise
+        a tensor that is copied over the buffer.
+        """
+        values = [value for _, value in views]
+        if all(not isinstance(value, torch.Tensor) for value in values) and len(set(values)) <= 1:
+            return values[0] if values else 0.
+        blob = torch.empty_like(buffer)
+        offset = 0
+        for view, value in views:
+            blob[offset:offset + view.numel()].view(view.shape).copy_(torch.as_tensor(value).expand(view.shape))
+            offset += view.numel()
+        return blob
+
+    @staticmethod
+    def of(net: nn.Module):
+        """
+        The arena of net, None if it has none.
+        """
+        return _ARENAS.get(net)
+
+    def reset(self):
+        """
+        Resets every memory of the network, one fill per buffer.
+        """
+        for buffer, value in zip(self.buffers, self._reset_values):
+            if isinstance(value, torch.Tensor):
+                buffer.copy_(value)
+            else:
+                buffer.fill_(value)
+        for node, name, view in self.bindings:
+            node.bind_memory(name, view)
+
+    def state(self):
+        """
+        A copy of the buffers, the state of the whole network as one blob per dtype and device.
+        """
+        for node, name, view in self.bindings:
+            self._sync(node, name, view)
+        return [buffer.clone() for buffer in self.buffers]
+
+    def load_state(self, state):
+        """
+        Restores a state returned by ``state``.
+        """
+        assert len(state) == len(self.buffers), "state does not match the arena"
+        for buffer, saved in zip(self.buffers, state):
+            buffer.copy_(saved)
+        for node, name, view in self.bindings:
+            node.bind_memory(name, view)
+
+    @staticmethod
+    def _sync(node, name, view):
+        # a python neuron step assigned a new tensor, copy it into the arena
+        value = getattr(node, name)
+        if value is not view:
+            view.copy_(value.detach())
+            node.bind_memory(name, view)
@@ -0,0 +1,143 @@
+# Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved. 
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+from typing import List, Sequence, Union
+import torch
+import torch.nn as nn
+
+from .neuron.BaseNode import BaseNode
+
+__all__ = ["StreamPool"]
+
+
+class StreamPool:
+    """
+    Per-stream neuron state for continuous batching of independent spike streams. Every memory of
+    every BaseNode of the network (``v`` of shape [batch, *]) gets a pool of shape [max_streams, *],
+    one slot per stream. A step gathers the slots of the active streams into the batch state of the
+    neurons, runs the network and scatters the new state back, so streams can join (``allocate``)
+    and leave (``release``) between any two steps without resetting the network.
+
+    When the active slots are a consecutive range, the neurons run on a view of the pool instead of
+    a gathered copy, and the fused CPU kernels update it in place.
+
+    Args:
+        net (nn.Module): Network whose neurons keep per-stream state, in single step mode.
+        max_streams (int): Number of slots.
+        example_input (torch.Tensor, optional): One sample with a batch dimension of 1, run under
+            ``torch.no_grad`` to materialize the memories. Without it the network must have run once.
+            Defaults to None.
+    """
+
+    def __init__(self, net: nn.Module, max_streams: int, example_input=None):
+        assert max_streams > 0, "max_streams must be positive"
+        if example_input is not None:
+            with torch.no_grad():
+                net(example_input)
+
+        self.net = net
+        self.max_streams = max_streams
+        self.pools = []
+        for node in net.modules():
+            if not isinstance(node, BaseNode):
+                continue
+            for name, value in node.named_memories():
+                if not isinstance(value, torch.Tensor) or value.dim() == 0:
+                    raise ValueError(f"memory '{name}' of {node} is not a batched tensor yet, run the network "
+                                     "once or pass example_input")
+                self.pools.append((node, name, value.new_empty((max_streams, *value.shape[1:]))))
+            node.reset()
+        for slot in range(max_streams):
+            self.reset_slot(slot)
+        self._free = list(range(max_streams - 1, -1, -1))
+        self._indices = {}
+
+    @property
+    def num_free(self) -> int:
+        return len(self._free)
+
+    def allocate(self) -> int:
+        """
+        Takes a free slot for a new stream, its state is reset.
+        """
+        if not self._free:
+            raise RuntimeError(f"all {self.max_streams} stream slots are in use")
+        slot = self._free.pop()
+        self.reset_slot(slot)
+        return slot
+
+    def release(self, slot: int):
+        """
+        Returns the slot of a finished stream to the pool.
+        """
+        assert 0 <= slot < self.max_streams and slot not in self._free, f"slot {slot} is not allocated"
+        self._free.append(slot)
+
+    def reset_slot(self, slot: int):
+        """
+        Resets the state of one stream.
+        """
+        for node, name, pool in self.pools:
+            value = node.reset_value(name)
+            if isinstance(value, torch.Tensor):
+                pool[slot].copy_(value)
+            else:
+                pool[slot].fill_(value)
+
+    def _slot_index(self, slots: List[int], device) -> torch.Tensor:
+        index = self._indices.get(device)
+        if index is None or index.numel() != len(slots) or index.tolist() != slots:
+            index = torch.tensor(slots, dtype=torch.int64, device=device)
+            self._indices[device] = index
+        return index
+
+    def gather(self, slots: Union[Sequence[int], torch.Tensor]):
+        """
+        Loads the state of the streams in slots into the neurons, row i of the batch is stream slots[i].
+        """
+        slots = slots.tolist() if isinstance(slots, torch.Tensor) else list(slots)
+        use_view = len(slots) > 0 and all(b == a + 1 for a, b in zip(slots, slots[1:]))
+        self._views = []
+        for node, name, pool in self.pools:
+            if use_view:
+                value = pool[slots[0]:slots[0] + len(slots)]
+            else:
+                value = pool.index_select(0, self._slot_index(slots, pool.device))
+            setattr(node, name, value)
+            self._views.append(value if use_view else None)
+        self._slots = slots
+
+    def scatter(self):
+        """
+        Stores the state of the neurons back into the slots of the last ``gather``.
+        """
+        for (node, name, pool), view in zip(self.pools, self._views):
+            value = getattr(node, name)
+            if view is not None:
+                if value is not view:
+                    view.copy_(value.detach())
+            else:
+                pool.index_copy_(0, self._slot_index(self._slots, pool.device), value.detach())
+
+    def step(self, slots: Union[Sequence[int], torch.Tensor], x: torch.Tensor):
+        """
+        One step of the streams in slots: x is their batched input, row i belongs to stream slots[i].
+
+        Returns:
+            The output of the network.
+        """
+        self.gather(slots)
+        output = self.net(x)
+        self.scatter()
+        return output
@@ -16,6 +16,7 @@ import torch
 import math
 from .BaseFunction import SurrogateFunctionBase
 from .BaseFunction import heaviside
+from .BaseFunction import SURROGATE_ATAN
 
 def atan_backward(grad_output: torch.Tensor, x: torch.Tensor, alpha: float):
     return alpha / 2 / (1 + (math.pi / 2 * alpha * x).pow_(2)) * grad_output, None
@@ -47,6 +48,9 @@ class ATan(SurrogateFunctionBase):
     def __init__(self, alpha=2.0, spike_out = False, spiking=True):
         super().__init__(alpha, spike_out, spiking)
 
+    def kernel_surrogate(self):
+        return SURROGATE_ATAN
+
     @staticmethod
 
     def spiking_function(x, alpha, spike_out):
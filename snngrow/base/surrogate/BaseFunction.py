@@ -15,6 +15,12 @@
 import torch
 import torch.nn as nn
 from ..spiketensor import SpikeTensor
+
+# Surrogate derivatives of the CPU neuron backward kernel, they must match ``Surrogate`` in
+# snngrow_backend/spike_cpu/kernels.h
+SURROGATE_SIGMOID = 0
+SURROGATE_ATAN = 1
+
 def heaviside(x: torch.Tensor, spike_out: bool = False):
     '''
     :param x: the input tensor
@@ -48,6 +54,13 @@ class SurrogateFunctionBase(nn.Module):
     def set_spiking_mode(self, spiking: bool):
         self.spiking = spiking
 
+    def kernel_surrogate(self):
+        """
+        :return: the ``SURROGATE_*`` derivative of this function, or ``None`` if the fused neuron
+            backward kernel does not implement it
+        """
+        return None
+
     def extra_repr(self):
         return f'alpha={self.alpha}, spiking={self.spiking}'
 
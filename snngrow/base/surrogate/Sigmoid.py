@@ -15,6 +15,7 @@
 import torch
 from .BaseFunction import SurrogateFunctionBase
 from .BaseFunction import heaviside
+from .BaseFunction import SURROGATE_SIGMOID
 
 
 
@@ -49,6 +50,9 @@ class Sigmoid(SurrogateFunctionBase):
     def __init__(self, alpha=4.0, spike_out = False, spiking=True):
         super().__init__(alpha, spike_out, spiking)
 
+    def kernel_surrogate(self):
+        return SURROGATE_SIGMOID
+
     @staticmethod
     def spiking_function(x, alpha, spike_out):
         return sigmoid.apply(x, alpha, spike_out)
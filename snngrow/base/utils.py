@@ -13,11 +13,16 @@
 # limitations under the License.
 
 from itertools import repeat
-from typing import List, Tuple, Union
+from typing import Dict, List, Tuple, Union
 import logging
+import time
 import torch
 import torch.nn as nn
-from .neuron import BaseNode
+from .neuron import BaseNode, IFNode, LIFNode
+from .statearena import StateArena
+from .spiketensor import SpikeTensor, PackedSpikeTensor
+from .nn.modules.linear import Linear
+from .nn.modules.norm import BatchNorm2d
 
 def reset(net: nn.Module):
     """
@@ -25,10 +30,16 @@ def reset(net: nn.Module):
 
     :return: None
 
-    Reset neurons in the network.
+    Reset neurons in the network. The neurons of a network with a ``StateArena`` are reset by one fill
+    per arena buffer.
     """
     
+    arena = StateArena.of(net)
+    if arena is not None:
+        arena.reset()
     for m in net.modules():
+        if arena is not None and m in arena.nodes:
+            continue
         if hasattr(m, 'reset'):
             if not isinstance(m, BaseNode.BaseNode):
                 logging.warning(f'Trying to call `reset()` of {m}, which is not snngrow.base.neuron'
@@ -36,6 +47,214 @@ def reset(net: nn.Module):
             m.reset()
 
 
+def _dense(x):
+    if isinstance(x, (SpikeTensor, PackedSpikeTensor)):
+        return x.to_dense()
+    return x.float()
+
+
+def _run_steps(net: nn.Module, inputs, state_dtype) -> Tuple[List[torch.Tensor], Dict[str, dict]]:
+    nodes = {name: m for name, m in net.named_modules() if isinstance(m, BaseNode.BaseNode)}
+    records = {name: {'spikes': [], 'v': []} for name in nodes}
+    def hook(name):
+        def record(m, _, output):
+            records[name]['spikes'].append(_dense(output))
+            records[name]['v'].append(m.v.float().clone() if isinstance(m.v, torch.Tensor) else None)
+        return record
+    handles = [m.register_forward_hook(hook(name)) for name, m in nodes.items()]
+    for m in nodes.values():
+        m.state_dtype = state_dtype
+    try:
+        reset(net)
+        outputs = [_dense(net(x)) for x in inputs]
+    finally:
+        for handle in handles:
+            handle.remove()
+    return outputs, records
+
+
+@torch.no_grad()
+def state_precision_report(net: nn.Module, inputs, state_dtype: torch.dtype = torch.bfloat16) -> dict:
+    """
+    :param net: Any network inherits from ``nn.Module``
+    :param inputs: inputs of consecutive forward calls, e.g. the time steps of a step-by-step network or
+        ``[x_seq]`` for ``parallel_optim`` neurons
+    :param state_dtype: reduced precision dtype of the membrane potential, ``torch.bfloat16`` or ``torch.float16``
+
+    :return: ``{'neurons': {name: {...}}, 'output_max_error': float}``, per neuron the fraction of spikes that
+        differ (``spike_mismatch``) and the largest voltage error (``v_max_error``), and the largest error of
+        the network outputs
+
+    Runs ``net`` on ``inputs`` twice, once with float32 and once with ``state_dtype`` membrane potentials, to
+    check whether storing the state in 16 bits keeps the spikes of a trained network. The neurons are reset
+    before each run and afterwards, and their ``state_dtype`` is restored.
+    """
+
+    if isinstance(inputs, torch.Tensor):
+        inputs = [inputs]
+    saved = {m: m.state_dtype for m in net.modules() if isinstance(m, BaseNode.BaseNode)}
+    try:
+        ref_outputs, ref = _run_steps(net, inputs, None)
+        outputs, low = _run_steps(net, inputs, state_dtype)
+    finally:
+        for m, dtype in saved.items():
+            m.state_dtype = dtype
+        reset(net)
+
+    neurons = {}
+    for name, record in ref.items():
+        mismatch = total = 0
+        for a, b in zip(record['spikes'], low[name]['spikes']):
+            mismatch += (a != b).sum().item()
+            total += a.numel()
+        v_error = 0.
+        for a, b in zip(record['v'], low[name]['v']):
+            if a is not None and b is not None:
+                v_error = max(v_error, (a - b).abs().max().item())
+        neurons[name] = {'spike_mismatch': mismatch / max(total, 1), 'v_max_error': v_error}
+    output_error = max(((a - b).abs().max().item() for a, b in zip(ref_outputs, outputs)), default=0.)
+    return {'neurons': neurons, 'output_max_error': output_error}
+
+
+def _time_op(fn, x, repeat: int) -> float:
+    for _ in range(max(repeat // 10, 1)):
+        fn(x)
+    start = time.perf_counter()
+    for _ in range(repeat):
+        fn(x)
+    return (time.perf_counter() - start) / repeat * 1e6
+
+
+@torch.no_grad()
+def spike_dispatch_report(shape: Tuple[int, ...] = (1, 256), out_features: int = 128, repeat: int = 1000) -> dict:
+    """
+    :param shape: shape of the spikes, small per-timestep tensors are the ones dominated by dispatch
+    :param out_features: output features of the ``matmul`` op
+    :param repeat: calls per op
+
+    :return: ``{op: {'plain_us': float, 'spike_us': float, 'overhead_us': float}}``, the time per call of the
+        op on a plain bool tensor and on a ``SpikeTensor`` of the same spikes, in microseconds
+
+    Measures the per-op cost of ``SpikeTensor`` for structural ops, logic and a spike GEMM: the boxed C++
+    fallback of the spike tensors (unwrapping, routing and rewrapping) and ``SpikeTensor.__torch_function__``,
+    which gives the results their python type. The plain baseline of ``matmul`` is the spike GEMM custom op on
+    the bool tensor, the same kernel without the wrapper.
+    """
+
+    spikes = torch.rand(shape) > 0.5
+    weight = torch.rand(shape[-1], out_features)
+    spike_tensor = SpikeTensor(spikes)
+    if hasattr(torch.ops, 'snngrow') and hasattr(torch.ops.snngrow, 'spike_gemm'):
+        plain_matmul = lambda x: torch.ops.snngrow.spike_gemm(x, weight)
+    else:
+        plain_matmul = lambda x: x.float() @ weight
+    ops = {
+        'view': (lambda x: x.view(-1), lambda x: x.view(-1)),
+        'transpose': (lambda x: x.transpose(-1, -2), lambda x: x.transpose(-1, -2)),
+        'cat': (lambda x: torch.cat([x, x]), lambda x: torch.cat([x, x])),
+        'mul': (lambda x: x & x, lambda x: x * x),
+        'matmul': (plain_matmul, lambda x: x @ weight),
+    }
+    report = {}
+    for name, (plain_fn, spike_fn) in ops.items():
+        plain_us = _time_op(plain_fn, spikes, repeat)
+        spike_us = _time_op(spike_fn, spike_tensor, repeat)
+        report[name] = {'plain_us': plain_us, 'spike_us': spike_us, 'overhead_us': spike_us - plain_us}
+    return report
+
+
+def _batchnorm_affine(bn: nn.Module) -> Tuple[torch.Tensor, torch.Tensor]:
+    # the inference transform of a BatchNorm as x * scale + shift
+    if isinstance(bn, BatchNorm2d):
+        scale = bn.gamma / torch.sqrt(bn.moving_var + 1e-8)
+        return scale, bn.beta - bn.moving_mean * scale
+    scale = 1. / torch.sqrt(bn.running_var + bn.eps)
+    if bn.affine:
+        scale = bn.weight * scale
+        return scale, bn.bias - bn.running_mean * scale
+    return scale, -bn.running_mean * scale
+
+
+def _foldable_layer(layer: nn.Module, bn: nn.Module) -> bool:
+    # snngrow's BatchNorm2d normalizes the last dimension, the features of a linear layer
+    if isinstance(bn, BatchNorm2d):
+        return isinstance(layer, (nn.Linear, Linear)) and layer.out_features == bn.gamma.numel()
+    if isinstance(bn, nn.BatchNorm2d):
+        return isinstance(layer, nn.Conv2d) and layer.out_channels == bn.num_features
+    if isinstance(layer, nn.Conv1d):
+        return layer.out_channels == bn.num_features
+    return isinstance(layer, (nn.Linear, Linear)) and layer.out_features == bn.num_features
+
+
+def _channel_shape(bn: nn.Module, prev: nn.Module) -> Tuple[int, ...]:
+    # broadcast shape of the channels of the BatchNorm output: [C, 1, 1] for [N, C, H, W], [C, 1] for
+    # BatchNorm1d after a Conv1d ([N, C, L], as in the Spikformer blocks) and [C] for the last dimension
+    if isinstance(bn, BatchNorm2d):
+        return (-1,)
+    if isinstance(bn, nn.BatchNorm2d):
+        return (-1, 1, 1)
+    return (-1,) if isinstance(prev, (nn.Linear, Linear)) else (-1, 1)
+
+
+@torch.no_grad()
+def fold_batchnorm(net: nn.Module, into: str = 'auto') -> List[Tuple[str, str]]:
+    """
+    :param net: Any network inherits from ``nn.Module``
+    :param into: ``'weight'`` folds a BatchNorm into the convolution or linear layer in front of it, ``'neuron'``
+        into the IF / LIF neuron after it and ``'auto'`` tries the layer first and then the neuron
+    :type into: str
+
+    :return: ``(batchnorm, target)`` pairs of the qualified names of the folded BatchNorms and the modules they
+        were folded into
+
+    Inference pass that removes the BatchNorms (``nn.BatchNorm1d``, ``nn.BatchNorm2d`` and
+    ``snngrow.base.nn.BatchNorm2d``) of the Conv -> BatchNorm -> neuron blocks, they are replaced by
+    ``nn.Identity``. A BatchNorm is adjacent to the children registered right before and after it in the same
+    parent module, which is the execution order of ``nn.Sequential`` and of the usual block definitions.
+
+    Folded into a layer, the running statistics scale its output channels and shift its bias. Folded into a
+    neuron, the voltage is kept in units of the BatchNorm scale: the neuron gets per-channel thresholds
+    ``v_threshold / scale`` and input biases ``shift / scale`` (see ``BaseNode.set_channel_params``), which
+    requires a positive scale, a reset to 0 or a soft reset, and a neuron without per-channel parameters.
+    The folded network fires the same spikes as the original in ``eval`` mode up to float rounding, it is not
+    meant for training.
+    """
+
+    assert into in ('auto', 'weight', 'neuron')
+    names = {m: name for name, m in net.named_modules()}
+    folded = []
+    for parent in list(net.modules()):
+        children = list(parent.named_children())
+        for i, (name, bn) in enumerate(children):
+            if not isinstance(bn, (nn.BatchNorm1d, nn.BatchNorm2d, BatchNorm2d)):
+                continue
+            if not isinstance(bn, BatchNorm2d) and bn.running_mean is None:
+                continue
+            prev = children[i - 1][1] if i > 0 else None
+            after = children[i + 1][1] if i + 1 < len(children) else None
+            scale, shift = _batchnorm_affine(bn)
+
+            if into != 'neuron' and _foldable_layer(prev, bn):
+                shape = (-1,) + (1,) * (prev.weight.dim() - 1)
+                prev.weight.mul_(scale.view(shape))
+                if prev.bias is None:
+                    prev.bias = nn.Parameter(shift.clone())
+                else:
+                    prev.bias.mul_(scale).add_(shift)
+                target = prev
+            elif into != 'weight' and isinstance(after, (IFNode, LIFNode)) and not after.channel_params() \
+                    and after.v_reset in (None, 0.) and bool((scale > 0).all()):
+                shape = _channel_shape(bn, prev)
+                after.set_channel_params((after.v_threshold / scale).view(shape), (shift / scale).view(shape))
+                after.reset()
+                target = after
+            else:
+                continue
+            setattr(parent, name, nn.Identity())
+            folded.append((names[bn], names[target]))
+    return folded
+
+
 def make_tuple(
     x: Union[int, List[int], Tuple[int, ...], torch.Tensor], ndim: int, name: str
 ) -> Tuple[int, ...]:
@@ -17,8 +17,10 @@
 #include <pybind11/pybind11.h>
 #include <torch/extension.h>
 #include <torch/serialize/tensor.h>
+#include <torch/library.h>
 
 #include "torch_gemm/spike_gemm_cuda.h"
+#include "spike_cpu/spike_ops.h"
 
 /**
  * @brief Pybind11 module for the CUDA backend.
@@ -27,5 +29,10 @@
 */
 PYBIND11_MODULE(snngrow_backend, m) {
   m.def("spike_gemm_cuda", &spike_gemm_cuda, "Bool Spike Matrix Multiplication GEMM CUDA");
-  
+  init_spike_cpu(m);
+}
+
+// CUDA kernel of torch.ops.snngrow.spike_gemm, the schema is defined in spike_cpu/library.cpp
+TORCH_LIBRARY_IMPL(snngrow, CUDA, m) {
+  m.impl("spike_gemm", &spike_gemm_cuda);
 }
@@ -0,0 +1,192 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+/*! \file snngrow/snngrow_backend/spike_cpu/isa.cpp
+    \brief cpuid based selection of the CPU kernel variant.
+*/
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+#include <c10/util/Exception.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "isa.h"
+
+namespace snngrow {
+namespace cpu {
+
+namespace {
+
+const KernelTable *table_for(CpuIsa isa) {
+  switch (isa) {
+    case CpuIsa::kScalar: return scalar::kernel_table();
+    case CpuIsa::kAVX2: return avx2::kernel_table();
+    case CpuIsa::kAVX512: return avx512::kernel_table();
+    case CpuIsa::kAVX512VPOPCNT: return avx512_vpopcnt::kernel_table();
+  }
+  return nullptr;
+}
+
+const char *isa_name(CpuIsa isa) {
+  switch (isa) {
+    case CpuIsa::kScalar: return "scalar";
+    case CpuIsa::kAVX2: return "avx2";
+    case CpuIsa::kAVX512: return "avx512";
+    case CpuIsa::kAVX512VPOPCNT: return "avx512_vpopcnt";
+  }
+  return "unknown";
+}
+
+#if defined(_MSC_VER) || defined(__x86_64__)
+
+void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+  int r[4];
+  __cpuidex(r, static_cast<int>(leaf), static_cast<int>(subleaf));
+  for (int i = 0; i < 4; ++i) regs[i] = static_cast<uint32_t>(r[i]);
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+uint64_t xgetbv0() {
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+/// Widest variant the CPU and the OS support. The feature sets match the target strings of
+/// kernels_<isa>.cpp.
+CpuIsa detect_isa() {
+  uint32_t regs[4];
+  cpuid(0, 0, regs);
+  const uint32_t max_leaf = regs[0];
+  if (max_leaf < 7) return CpuIsa::kScalar;
+
+  cpuid(1, 0, regs);
+  const uint32_t ecx1 = regs[2];
+  const bool osxsave = ecx1 & (1u << 27);
+  const bool avx = ecx1 & (1u << 28);
+  const bool fma = ecx1 & (1u << 12);
+  const bool popcnt = ecx1 & (1u << 23);
+  const bool f16c = ecx1 & (1u << 29);
+  if (!(osxsave && avx && fma && popcnt && f16c)) return CpuIsa::kScalar;
+
+  const uint64_t xcr0 = xgetbv0();
+  // XMM | YMM state
+  if ((xcr0 & 0x6) != 0x6) return CpuIsa::kScalar;
+
+  cpuid(7, 0, regs);
+  const uint32_t ebx7 = regs[1];
+  const uint32_t ecx7 = regs[2];
+  cpuid(0x80000001, 0, regs);
+  const bool lzcnt = regs[2] & (1u << 5);
+  const bool avx2 = ebx7 & (1u << 5);
+  const bool bmi = ebx7 & (1u << 3);
+  const bool bmi2 = ebx7 & (1u << 8);
+  if (!(avx2 && bmi && bmi2 && lzcnt)) return CpuIsa::kScalar;
+
+  // opmask | ZMM_Hi256 | Hi16_ZMM state
+  const bool avx512_state = (xcr0 & 0xe0) == 0xe0;
+  const bool avx512 = avx512_state && (ebx7 & (1u << 16)) && (ebx7 & (1u << 17)) &&
+                      (ebx7 & (1u << 30)) && (ebx7 & (1u << 31));
+  if (!avx512) return CpuIsa::kAVX2;
+
+  const bool vpopcntdq = ecx7 & (1u << 14);
+  return vpopcntdq ? CpuIsa::kAVX512VPOPCNT : CpuIsa::kAVX512;
+}
+
+#else
+
+CpuIsa detect_isa() { return CpuIsa::kScalar; }
+
+#endif
+
+CpuIsa host_isa() {
+  static const CpuIsa isa = detect_isa();
+  return isa;
+}
+
+bool parse_isa(const std::string &name, CpuIsa *isa) {
+  for (CpuIsa candidate : {CpuIsa::kScalar, CpuIsa::kAVX2, CpuIsa::kAVX512, CpuIsa::kAVX512VPOPCNT}) {
+    if (name == isa_name(candidate)) {
+      *isa = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+const KernelTable *select_table() {
+  CpuIsa isa = host_isa();
+  if (const char *forced = std::getenv("SNNGROW_CPU_ISA")) {
+    CpuIsa requested;
+    if (!parse_isa(forced, &requested)) {
+      TORCH_WARN("SNNGROW_CPU_ISA=", forced, " is not a known CPU variant, using ", isa_name(isa));
+    } else if (static_cast<int>(requested) > static_cast<int>(isa)) {
+      TORCH_WARN("SNNGROW_CPU_ISA=", forced, " is not supported by this CPU, using ", isa_name(isa));
+    } else {
+      isa = requested;
+    }
+  }
+  return table_for(isa);
+}
+
+std::atomic<const KernelTable *> &active_table() {
+  static std::atomic<const KernelTable *> table(select_table());
+  return table;
+}
+
+} // namespace
+
+const KernelTable &kernels() {
+  return *active_table().load(std::memory_order_relaxed);
+}
+
+std::string cpu_isa() {
+  return kernels().name;
+}
+
+std::vector<std::string> available_cpu_isas() {
+  std::vector<std::string> names;
+  for (int i = 0; i <= static_cast<int>(host_isa()); ++i) {
+    names.emplace_back(isa_name(static_cast<CpuIsa>(i)));
+  }
+  return names;
+}
+
+void set_cpu_isa(const std::string &name) {
+  CpuIsa isa;
+  TORCH_CHECK(parse_isa(name, &isa), "unknown CPU variant ", name,
+              ", expected one of scalar, avx2, avx512, avx512_vpopcnt");
+  TORCH_CHECK(static_cast<int>(isa) <= static_cast<int>(host_isa()),
+              "CPU variant ", name, " is not supported by this CPU");
+  active_table().store(table_for(isa), std::memory_order_relaxed);
+}
+
+} // namespace cpu
+} // namespace snngrow
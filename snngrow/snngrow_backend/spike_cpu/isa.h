@@ -0,0 +1,49 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+/*! \file snngrow/snngrow_backend/spike_cpu/isa.h
+    \brief Runtime selection of the CPU kernel variant.
+
+    The variant is chosen once, when the extension is imported, from cpuid: the widest of
+    avx512_vpopcnt, avx512, avx2 and scalar that the host (and the OS, for the AVX register state)
+    supports. Setting the environment variable SNNGROW_CPU_ISA to one of these names forces a
+    narrower variant, which is meant for benchmarking.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "kernels.h"
+
+namespace snngrow {
+namespace cpu {
+
+/// Kernel table of the active variant.
+const KernelTable &kernels();
+
+/// Name of the active variant.
+std::string cpu_isa();
+
+/// Names of the variants the host can run, from the narrowest to the widest.
+std::vector<std::string> available_cpu_isas();
+
+/// Switch the active variant, fails if the host cannot run it.
+void set_cpu_isa(const std::string &name);
+
+} // namespace cpu
+} // namespace snngrow
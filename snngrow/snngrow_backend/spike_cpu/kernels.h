@@ -0,0 +1,262 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+/*! \file snngrow/snngrow_backend/spike_cpu/kernels.h
+    \brief Raw-pointer CPU spike kernels shared by every ISA variant.
+
+    Every kernel in this file is compiled once per ISA (see kernels_<isa>.cpp) and collected in a
+    KernelTable. The table that matches the host CPU is selected once in isa.cpp. Nothing in here
+    may depend on ATen: the variant translation units are compiled with target pragmas and must not
+    instantiate any inline code that is shared with the rest of the extension.
+
+    Spikes are either bool bytes (one neuron per byte) or packed words, where bit j of word w holds
+    element w * 64 + j of a row and each row is padded with zero bits to a multiple of 64.
+*/
+#pragma once
+
+#include <cstdint>
+
+namespace snngrow {
+namespace cpu {
+
+enum class CpuIsa : int {
+  kScalar = 0,
+  kAVX2 = 1,
+  kAVX512 = 2,
+  kAVX512VPOPCNT = 3,
+};
+
+/// Membrane charge equations, they follow LIFNode / IFNode term by term so that the
+/// kernels produce the same spikes as the python implementation.
+enum class NeuronMode : int64_t {
+  kIF = 0,                        // v = v + x
+  kLIFDecayInputReset0 = 1,       // v = v + (x - v) / tau
+  kLIFDecayInput = 2,             // v = v + (x - (v - v_reset)) / tau
+  kLIFNoDecayInputReset0 = 3,     // v = v * (1 - 1 / tau) + x
+  kLIFNoDecayInput = 4,           // v = v - (v - v_reset) / tau + x
+};
+
+struct NeuronParams {
+  NeuronMode mode;
+  float tau;
+  float decay;                    // 1 - 1 / tau, computed in double precision like the python code
+  float v_threshold;
+  float v_reset;
+  bool hard_reset;                // v = v_reset after a spike, otherwise v = v - v_threshold
+};
+
+/// 16-bit storage formats of the membrane potential, the kernels compute in float.
+enum class HalfFormat : int64_t {
+  kBF16 = 0,                      // bfloat16, rounded to nearest even
+  kFP16 = 1,                      // IEEE half
+};
+
+/// Surrogate derivatives of the spike function, they follow surrogate/Sigmoid.py and ATan.py.
+enum class Surrogate : int64_t {
+  kSigmoid = 0,                   // alpha * sg * (1 - sg), sg = sigmoid(alpha * x)
+  kATan = 1,                      // alpha / 2 / (1 + (pi / 2 * alpha * x)^2)
+};
+
+struct NeuronGradParams {
+  Surrogate surrogate;
+  float alpha;
+  bool detach_reset;              // the reset does not pass a gradient to the spike
+};
+
+/// Row indirection and output layout of a spike GEMM (the GatherA / ScatterD / PermuteDLayout of
+/// the CUDA kernel template). Row m of the problem reads row a_rows[m] of A and writes row
+/// r = c_rows[m] of C, a null array is the identity. Scattered rows must be unique, rows of C that
+/// are not hit are left untouched.
+///
+/// Element (r, n) of the result is stored at
+///   (r / row_group) * group_stride + (r % row_group) * ldc + (n / col_block) * block_stride + n % col_block
+/// where row_group == 0 and col_block == 0 mean a single group / block, i.e. plain r * ldc + n.
+/// A [G * L, H * D] result written as [G, H, L, D] (head split) uses row_group = L,
+/// group_stride = H * L * D, ldc = D, col_block = D and block_stride = L * D.
+struct GemmAddressing {
+  const int64_t *a_rows;
+  const int64_t *c_rows;
+  int64_t row_group;
+  int64_t group_stride;
+  int64_t col_block;
+  int64_t block_stride;
+};
+
+/// Word-parallel logic on packed spikes, 64 neurons per operation.
+enum class BitOp : int64_t {
+  kAnd = 0,                       // a & b
+  kOr = 1,                        // a | b
+  kXor = 2,                       // a ^ b
+  kAndNot = 3,                    // a & ~b
+  kNot = 4,                       // ~a
+};
+
+struct Pool2dParams {
+  int64_t height, width;
+  int64_t out_height, out_width;
+  int64_t kernel_h, kernel_w;
+  int64_t stride_h, stride_w;
+  int64_t pad_h, pad_w;
+};
+
+/// Event-driven conv2d of one sample (dilation 1).
+struct Conv2dParams {
+  int64_t channels, out_channels;
+  int64_t height, width;
+  int64_t out_height, out_width;
+  int64_t kernel_h, kernel_w;
+  int64_t stride_h, stride_w;
+  int64_t pad_h, pad_w;
+};
+
+/// Spike time of a time-to-first-spike neuron that never fires.
+constexpr uint8_t kNeverFires = 255;
+
+struct KernelTable {
+  CpuIsa isa;
+  const char *name;
+
+  /// C[m, :] = sum_k A[m, k] * B[k, :] for m in [m_begin, m_end), A holds bool spikes.
+  void (*spike_gemm_sd)(const bool *A, int64_t lda, const float *B, int64_t ldb,
+                        float *C, int64_t ldc, int64_t m_begin, int64_t m_end,
+                        int64_t N, int64_t K, const GemmAddressing &addr);
+
+  /// C[m, :] = sum_k A[m, k] * B[k, :] for m in [m_begin, m_end), B holds bool spikes.
+  void (*spike_gemm_ds)(const float *A, int64_t lda, const bool *B, int64_t ldb,
+                        float *C, int64_t ldc, int64_t m_begin, int64_t m_end,
+                        int64_t N, int64_t K, const GemmAddressing &addr);
+
+  /// C[m, :] = sum_k A[m, k] * B[k, :] for m in [m_begin, m_end), A holds packed spikes with lda
+  /// words per row.
+  void (*spike_gemm_pd)(const uint64_t *A, int64_t lda, const float *B, int64_t ldb,
+                        float *C, int64_t ldc, int64_t m_begin, int64_t m_end,
+                        int64_t N, int64_t K);
+
+  /// C[m, :] = sum of B[col[e], :] over the events e in [crow[m], crow[m + 1]), i.e. CSR spikes
+  /// times a dense matrix.
+  void (*spike_gemm_csr)(const int64_t *crow, const int64_t *col, const float *B, int64_t ldb,
+                         float *C, int64_t ldc, int64_t m_begin, int64_t m_end, int64_t N);
+
+  /// Scatters the events of one sample into its [out_height, out_width, out_channels] output.
+  /// crow / col are the CSR rows (channel * height + y) / columns (x) of the sample, weight is
+  /// laid out as [channels, kernel_h, kernel_w, out_channels].
+  void (*spike_conv2d_csr)(const int64_t *crow, const int64_t *col, const float *weight,
+                           float *out, const Conv2dParams &params);
+
+  /// Time-to-first-spike linear layer of one sample: input k fires once at times[k] (>= T: never),
+  /// the non-leaky membrane v[n] = bias[n] + sum of W[k, n] over the inputs that fired so far, and
+  /// output n fires at the first step v[n] >= threshold. Inputs are visited in spike-time order and
+  /// the loop stops once every output fired or no input is left. out gets the output spike times,
+  /// kNeverFires for silent outputs; v ([N]) and order ([K]) are scratch. bias may be null.
+  void (*ttfs_linear)(const uint8_t *times, int64_t K, const float *W, int64_t ldw, const float *bias,
+                      float threshold, int64_t T, int64_t N, float *v, int32_t *order, uint8_t *out);
+
+  /// Writes the positions of the set bits of nwords words to dst.
+  void (*bit_indices)(const uint64_t *src, int64_t nwords, int64_t *dst);
+
+  /// Packs one row of n bool spikes into (n + 63) / 64 words.
+  void (*pack_spikes)(const bool *src, int64_t n, uint64_t *dst);
+
+  /// Unpacks one row of n spikes from (n + 63) / 64 words.
+  void (*unpack_spikes)(const uint64_t *src, int64_t n, bool *dst);
+
+  /// Number of set bits in nwords words.
+  int64_t (*popcount)(const uint64_t *src, int64_t nwords);
+
+  /// Transposes a packed [rows, cols] bit matrix into a packed [cols, rows] one. Only the 64-column
+  /// blocks [block_begin, block_end) of src are done, i.e. rows block_begin * 64 ... of dst.
+  void (*transpose_bits)(const uint64_t *src, int64_t rows, int64_t cols, uint64_t *dst,
+                         int64_t block_begin, int64_t block_end);
+
+  /// Position of the lowest set bit in each of n rows of nwords words, none for an empty row. On a
+  /// time-major spike train this is the first spike time of every neuron.
+  void (*first_spike)(const uint64_t *src, int64_t nwords, int64_t n, int64_t none, int64_t *dst);
+
+  /// dst = a op b on nwords words, b is not read for kNot. kNot also sets the padding bits of a
+  /// row, the caller clears them.
+  void (*bitwise_words)(const uint64_t *a, const uint64_t *b, uint64_t *dst, int64_t nwords,
+                        BitOp op);
+
+  /// dst = row 0 op row 1 op ... for rows rows of nwords words that are ld words apart, op is kAnd
+  /// or kOr (all / any over the rows).
+  void (*reduce_words)(const uint64_t *src, int64_t rows, int64_t ld, int64_t nwords,
+                       uint64_t *dst, BitOp op);
+
+  /// counts[w * 64 + j] += bit j of word w, summed over rows rows of nwords words ld words apart.
+  void (*count_columns)(const uint64_t *src, int64_t rows, int64_t ld, int64_t nwords,
+                        int64_t *counts);
+
+  /// One charge - fire - reset step on n neurons, v is updated in place. Either spike output may
+  /// be null.
+  void (*neuron_step)(const float *x, float *v, bool *spike_b, float *spike_f, int64_t n,
+                      const NeuronParams &params);
+
+  /// Event-driven neuron_step of step t on the count neurons index[0, count) (unique) with the inputs x,
+  /// the others receive no input. A neuron first decays in closed form over the silent steps since
+  /// last[index], which is then set to t. spike[0, count) receives whether each of them fired.
+  void (*neuron_event_step)(const int64_t *index, const float *x, int64_t count, float *v, int64_t *last,
+                            int64_t t, bool *spike, const NeuronParams &params);
+
+  /// neuron_step with v stored in 16 bits: it is widened to float, updated and rounded back.
+  void (*neuron_step_half)(const float *x, uint16_t *v, bool *spike_b, float *spike_f, int64_t n,
+                           const NeuronParams &params, HalfFormat format);
+
+  /// neuron_step on channels * inner neurons, neurons [c * inner, (c + 1) * inner) belong to channel c
+  /// and use v_threshold[c] and the input bias bias[c] (bias may be null) instead of params.v_threshold.
+  void (*neuron_step_channels)(const float *x, float *v, bool *spike_b, float *spike_f, int64_t channels,
+                               int64_t inner, const float *v_threshold, const float *bias,
+                               const NeuronParams &params);
+
+  /// T charge - fire - reset steps on n neurons whose inputs are x[t * ld + i], v ([n]) is updated
+  /// in place and carried across the steps. Spikes go to the non-null outputs: bool / float at
+  /// t * ld + i, or packed words at spike_w[t * ldw + i / 64], i.e. the n neurons start at bit 0 of
+  /// their first word and the caller hands out whole words. v_seq, if not null, gets the charged
+  /// potential before the reset at t * ld + i, which is all neuron_multistep_backward needs,
+  /// v_max ([n]), if not null, its maximum over the steps and v_margin ([n]), if not null, the
+  /// minimum of |charged potential - v_threshold| over the steps.
+  void (*neuron_multistep)(const float *x, float *v, bool *spike_b, float *spike_f, uint64_t *spike_w,
+                           float *v_seq, float *v_max, float *v_margin, int64_t T, int64_t ld, int64_t ldw,
+                           int64_t n, const NeuronParams &params);
+
+  /// Corrects a block of L steps of the parallel-in-time update that neuron_multistep ran from the
+  /// guessed start v_reset (0 for a soft reset), with its bool or float spikes, end state v, v_max
+  /// and, for a soft reset, v_margin (may be null with a hard reset). v_in ([n]) is the true start;
+  /// the spikes are rewritten where they change and v becomes the true end state. Neurons whose
+  /// spikes cannot change only get the closed-form linear update of v.
+  void (*neuron_multistep_fixup)(const float *x, const float *v_in, const float *v_max, const float *v_margin,
+                                 float *v, bool *spike_b, float *spike_f, int64_t L, int64_t ld, int64_t n,
+                                 const NeuronParams &params);
+
+  /// BPTT through neuron_multistep in one reverse-time sweep. v_seq is the saved charged potential
+  /// (the spikes are v_seq >= v_threshold), grad_spike the gradient of the float spikes, both at
+  /// t * ld + i, and grad_v ([n], may be null) the gradient of the final potential. Writes the input
+  /// gradient to grad_x at t * ld + i and the gradient of the initial potential to grad_v0 ([n]).
+  void (*neuron_multistep_backward)(const float *grad_spike, const float *grad_v, const float *v_seq,
+                                    float *grad_x, float *grad_v0, int64_t T, int64_t ld, int64_t n,
+                                    const NeuronParams &params, const NeuronGradParams &grad);
+
+  /// Spike max pooling (logical OR over the window) of one [height, width] plane.
+  void (*spike_max_pool2d)(const bool *src, bool *dst, const Pool2dParams &params);
+};
+
+namespace scalar { const KernelTable *kernel_table(); }
+namespace avx2 { const KernelTable *kernel_table(); }
+namespace avx512 { const KernelTable *kernel_table(); }
+namespace avx512_vpopcnt { const KernelTable *kernel_table(); }
+
+} // namespace cpu
+} // namespace snngrow
@@ -0,0 +1,79 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+
+/*! \file snngrow/snngrow_backend/spike_cpu/kernels_avx512.cpp
+    \brief AVX-512 (F, BW, VL, DQ) variant of the CPU spike kernels.
+
+    Only this translation unit is compiled for AVX-512 (F, BW, VL, DQ); the table is handed out by isa.cpp when
+    cpuid reports the required features. On other architectures the variant is an empty stub.
+*/
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "kernels.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,avx512bw,avx512vl,avx512dq,avx2,fma,bmi,bmi2,lzcnt,popcnt"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vl,avx512dq,avx2,fma,bmi,bmi2,lzcnt,popcnt")
+#endif
+
+#define SNNGROW_CPU_NS avx512
+#define SNNGROW_CPU_AVX512
+#define SNNGROW_CPU_ISA CpuIsa::kAVX512
+#define SNNGROW_CPU_ISA_NAME "avx512"
+#include "kernels_impl.h"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+namespace snngrow {
+namespace cpu {
+namespace avx512 {
+
+const KernelTable *kernel_table() { return &kKernelTable; }
+
+} // namespace avx512
+} // namespace cpu
+} // namespace snngrow
+
+#else
+
+namespace snngrow {
+namespace cpu {
+namespace avx512 {
+
+const KernelTable *kernel_table() { return nullptr; }
+
+} // namespace avx512
+} // namespace cpu
+} // namespace snngrow
+
+#endif
@@ -0,0 +1,1584 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+/*! \file snngrow/snngrow_backend/spike_cpu/kernels_impl.h
+    \brief Kernel bodies, compiled once per ISA.
+
+    This file is not a regular header. It is included by kernels_<isa>.cpp after the target pragma
+    with SNNGROW_CPU_NS set to the variant namespace and one of SNNGROW_CPU_AVX2 / SNNGROW_CPU_AVX512
+    (optionally together with SNNGROW_CPU_VPOPCNT) defined. Without any of them the portable scalar
+    code is used. All system headers must be included by the variant file before the pragma, and
+    kernel_table() is defined by the variant file after the pragma has been popped, so that nothing
+    reachable from the dispatcher is compiled for a wider ISA than the host supports.
+*/
+
+namespace snngrow {
+namespace cpu {
+namespace SNNGROW_CPU_NS {
+namespace {
+
+/*
+ * Bit helpers
+ */
+
+inline int ctz64(uint64_t x) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+inline int64_t popcount64(uint64_t x) {
+#if defined(SNNGROW_CPU_AVX2) || defined(SNNGROW_CPU_AVX512)
+  return static_cast<int64_t>(_mm_popcnt_u64(x));
+#elif defined(_MSC_VER)
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return static_cast<int64_t>((x * 0x0101010101010101ULL) >> 56);
+#else
+  return __builtin_popcountll(x);
+#endif
+}
+
+/*
+ * Vector abstraction: VecF holds kWidth floats, MaskF selects lanes of a VecF. Spike bytes are
+ * turned into masks directly so that the GEMM kernels never multiply by a spike.
+ */
+
+#if defined(SNNGROW_CPU_AVX512)
+
+struct MaskF {
+  __mmask16 m;
+  static inline MaskF from_spikes(const bool *s) {
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+    return {_mm_test_epi8_mask(b, b)};
+  }
+  static inline MaskF from_spikes(const bool *s, int n) {
+    __m128i b = _mm_maskz_loadu_epi8(static_cast<__mmask16>((1u << n) - 1), s);
+    return {_mm_test_epi8_mask(b, b)};
+  }
+  inline void store_spikes(bool *s) const {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(s), _mm_maskz_set1_epi8(m, 1));
+  }
+  inline void store_spikes(bool *s, int n) const {
+    _mm_mask_storeu_epi8(s, static_cast<__mmask16>((1u << n) - 1), _mm_maskz_set1_epi8(m, 1));
+  }
+  /// Lane i in bit i.
+  inline uint64_t bits() const { return m; }
+  static inline MaskF from_bits(uint64_t b) { return {static_cast<__mmask16>(b)}; }
+};
+
+struct VecF {
+  static constexpr int kWidth = 16;
+  __m512 v;
+  static inline __mmask16 tail(int n) { return static_cast<__mmask16>((1u << n) - 1); }
+  static inline VecF zero() { return {_mm512_setzero_ps()}; }
+  static inline VecF set1(float a) { return {_mm512_set1_ps(a)}; }
+  static inline VecF load(const float *p) { return {_mm512_loadu_ps(p)}; }
+  static inline VecF load(const float *p, int n) { return {_mm512_maskz_loadu_ps(tail(n), p)}; }
+  inline void store(float *p) const { _mm512_storeu_ps(p, v); }
+  inline void store(float *p, int n) const { _mm512_mask_storeu_ps(p, tail(n), v); }
+  inline VecF operator+(VecF b) const { return {_mm512_add_ps(v, b.v)}; }
+  inline VecF operator-(VecF b) const { return {_mm512_sub_ps(v, b.v)}; }
+  inline VecF operator*(VecF b) const { return {_mm512_mul_ps(v, b.v)}; }
+  inline VecF operator/(VecF b) const { return {_mm512_div_ps(v, b.v)}; }
+  static inline VecF min(VecF a, VecF b) { return {_mm512_min_ps(a.v, b.v)}; }
+  static inline VecF max(VecF a, VecF b) { return {_mm512_max_ps(a.v, b.v)}; }
+  static inline VecF round(VecF a) { return {_mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)}; }
+  /// a * 2^e for integral e.
+  static inline VecF ldexp(VecF a, VecF e) { return {_mm512_scalef_ps(a.v, e.v)}; }
+  static inline MaskF ge(VecF a, VecF b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ)}; }
+  /// acc + a on the lanes selected by m.
+  static inline VecF add_masked(VecF acc, MaskF m, VecF a) { return {_mm512_mask_add_ps(acc.v, m.m, acc.v, a.v)}; }
+  /// b on the lanes selected by m, a elsewhere.
+  static inline VecF blend(MaskF m, VecF a, VecF b) { return {_mm512_mask_blend_ps(m.m, a.v, b.v)}; }
+};
+
+#elif defined(SNNGROW_CPU_AVX2)
+
+struct MaskF {
+  __m256 m;
+  static inline MaskF from_spikes(const bool *s) {
+    __m256i w = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(s)));
+    return {_mm256_castsi256_ps(_mm256_cmpgt_epi32(w, _mm256_setzero_si256()))};
+  }
+  static inline MaskF from_spikes(const bool *s, int n) {
+    bool buf[8] = {};
+    for (int i = 0; i < n; ++i) buf[i] = s[i];
+    return from_spikes(buf);
+  }
+  inline void store_spikes(bool *s) const {
+    uint64_t bytes = _pdep_u64(static_cast<uint64_t>(_mm256_movemask_ps(m)), 0x0101010101010101ULL);
+    std::memcpy(s, &bytes, 8);
+  }
+  inline void store_spikes(bool *s, int n) const {
+    uint64_t bytes = _pdep_u64(static_cast<uint64_t>(_mm256_movemask_ps(m)), 0x0101010101010101ULL);
+    std::memcpy(s, &bytes, n);
+  }
+  inline uint64_t bits() const { return static_cast<uint64_t>(_mm256_movemask_ps(m)); }
+  static inline MaskF from_bits(uint64_t b) {
+    const __m256i lane = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i set = _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(b)), lane);
+    return {_mm256_castsi256_ps(_mm256_cmpeq_epi32(set, lane))};
+  }
+};
+
+struct VecF {
+  static constexpr int kWidth = 8;
+  __m256 v;
+  static inline __m256i tail(int n) {
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  }
+  static inline VecF zero() { return {_mm256_setzero_ps()}; }
+  static inline VecF set1(float a) { return {_mm256_set1_ps(a)}; }
+  static inline VecF load(const float *p) { return {_mm256_loadu_ps(p)}; }
+  static inline VecF load(const float *p, int n) { return {_mm256_maskload_ps(p, tail(n))}; }
+  inline void store(float *p) const { _mm256_storeu_ps(p, v); }
+  inline void store(float *p, int n) const { _mm256_maskstore_ps(p, tail(n), v); }
+  inline VecF operator+(VecF b) const { return {_mm256_add_ps(v, b.v)}; }
+  inline VecF operator-(VecF b) const { return {_mm256_sub_ps(v, b.v)}; }
+  inline VecF operator*(VecF b) const { return {_mm256_mul_ps(v, b.v)}; }
+  inline VecF operator/(VecF b) const { return {_mm256_div_ps(v, b.v)}; }
+  static inline VecF min(VecF a, VecF b) { return {_mm256_min_ps(a.v, b.v)}; }
+  static inline VecF max(VecF a, VecF b) { return {_mm256_max_ps(a.v, b.v)}; }
+  static inline VecF round(VecF a) { return {_mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)}; }
+  /// a * 2^e for integral e, added to the exponent field: the result must be a normal float.
+  static inline VecF ldexp(VecF a, VecF e) {
+    __m256i bits = _mm256_add_epi32(_mm256_castps_si256(a.v), _mm256_slli_epi32(_mm256_cvtps_epi32(e.v), 23));
+    return {_mm256_castsi256_ps(bits)};
+  }
+  static inline MaskF ge(VecF a, VecF b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+  static inline VecF add_masked(VecF acc, MaskF m, VecF a) { return {_mm256_add_ps(acc.v, _mm256_and_ps(m.m, a.v))}; }
+  static inline VecF blend(MaskF m, VecF a, VecF b) { return {_mm256_blendv_ps(a.v, b.v, m.m)}; }
+};
+
+#else
+
+struct MaskF {
+  bool m;
+  static inline MaskF from_spikes(const bool *s) { return {*s}; }
+  static inline MaskF from_spikes(const bool *s, int) { return {*s}; }
+  inline void store_spikes(bool *s) const { *s = m; }
+  inline void store_spikes(bool *s, int) const { *s = m; }
+  inline uint64_t bits() const { return m ? 1 : 0; }
+  static inline MaskF from_bits(uint64_t b) { return {(b & 1) != 0}; }
+};
+
+struct VecF {
+  static constexpr int kWidth = 1;
+  float v;
+  static inline VecF zero() { return {0.f}; }
+  static inline VecF set1(float a) { return {a}; }
+  static inline VecF load(const float *p) { return {*p}; }
+  static inline VecF load(const float *p, int) { return {*p}; }
+  inline void store(float *p) const { *p = v; }
+  inline void store(float *p, int) const { *p = v; }
+  inline VecF operator+(VecF b) const { return {v + b.v}; }
+  inline VecF operator-(VecF b) const { return {v - b.v}; }
+  inline VecF operator*(VecF b) const { return {v * b.v}; }
+  inline VecF operator/(VecF b) const { return {v / b.v}; }
+  static inline VecF min(VecF a, VecF b) { return {b.v < a.v ? b.v : a.v}; }
+  static inline VecF max(VecF a, VecF b) { return {a.v < b.v ? b.v : a.v}; }
+  static inline VecF round(VecF a) {
+    return {static_cast<float>(static_cast<int32_t>(a.v < 0.f ? a.v - 0.5f : a.v + 0.5f))};
+  }
+  static inline VecF ldexp(VecF a, VecF e) {
+    uint32_t bits;
+    std::memcpy(&bits, &a.v, 4);
+    bits += static_cast<uint32_t>(static_cast<int32_t>(e.v)) << 23;
+    std::memcpy(&a.v, &bits, 4);
+    return a;
+  }
+  static inline MaskF ge(VecF a, VecF b) { return {a.v >= b.v}; }
+  static inline VecF add_masked(VecF acc, MaskF m, VecF a) { return {m.m ? acc.v + a.v : acc.v}; }
+  static inline VecF blend(MaskF m, VecF a, VecF b) { return {m.m ? b.v : a.v}; }
+};
+
+#endif
+
+constexpr int W = VecF::kWidth;
+
+/*
+ * 16-bit floats. bf16 is the upper half of a float, rounded to nearest even when narrowing (the
+ * membrane potential is never NaN). fp16 uses the F16C / AVX-512 conversions, or the usual bit
+ * manipulation in the scalar code.
+ */
+#if defined(SNNGROW_CPU_AVX512)
+
+inline VecF load_bf16(const uint16_t *p) {
+  __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  return {_mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16))};
+}
+inline void store_bf16(VecF a, uint16_t *p) {
+  __m512i bits = _mm512_castps_si512(a.v);
+  __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+  bits = _mm512_add_epi32(bits, _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7fff)));
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), _mm512_cvtepi32_epi16(_mm512_srli_epi32(bits, 16)));
+}
+inline VecF load_fp16(const uint16_t *p) {
+  return {_mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)))};
+}
+inline void store_fp16(VecF a, uint16_t *p) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), _mm512_cvtps_ph(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+}
+
+#elif defined(SNNGROW_CPU_AVX2)
+
+inline VecF load_bf16(const uint16_t *p) {
+  __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  return {_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16))};
+}
+inline void store_bf16(VecF a, uint16_t *p) {
+  __m256i bits = _mm256_castps_si256(a.v);
+  __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+  bits = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff))), 16);
+  __m128i h = _mm_packus_epi32(_mm256_castsi256_si128(bits), _mm256_extracti128_si256(bits, 1));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(p), h);
+}
+inline VecF load_fp16(const uint16_t *p) {
+  return {_mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)))};
+}
+inline void store_fp16(VecF a, uint16_t *p) {
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm256_cvtps_ph(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+}
+
+#else
+
+inline VecF load_bf16(const uint16_t *p) {
+  uint32_t bits = static_cast<uint32_t>(*p) << 16;
+  VecF a;
+  std::memcpy(&a.v, &bits, 4);
+  return a;
+}
+inline void store_bf16(VecF a, uint16_t *p) {
+  uint32_t bits;
+  std::memcpy(&bits, &a.v, 4);
+  *p = static_cast<uint16_t>((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+}
+inline VecF load_fp16(const uint16_t *p) {
+  const uint32_t h = *p;
+  const uint32_t sign = (h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  uint32_t bits;
+  VecF a;
+  if (exponent == 0) {
+    // zero or subnormal: mantissa * 2^-24
+    a.v = static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+    std::memcpy(&bits, &a.v, 4);
+    bits |= sign;
+  } else if (exponent == 31) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  std::memcpy(&a.v, &bits, 4);
+  return a;
+}
+inline void store_fp16(VecF a, uint16_t *p) {
+  uint32_t bits;
+  std::memcpy(&bits, &a.v, 4);
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  uint32_t magnitude = bits & 0x7fffffff;
+  if (magnitude >= 0x477ff000) {
+    // rounds to infinity, or NaN
+    *p = static_cast<uint16_t>(sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00));
+  } else if (magnitude < 0x38800000) {
+    // subnormal: adding 0.5 lines the mantissa up so that the float addition rounds it
+    float f;
+    std::memcpy(&f, &magnitude, 4);
+    f += 0.5f;
+    std::memcpy(&magnitude, &f, 4);
+    *p = static_cast<uint16_t>(sign | (magnitude - 0x3f000000));
+  } else {
+    magnitude += 0xc8000fff + ((magnitude >> 13) & 1);
+    *p = static_cast<uint16_t>(sign | (magnitude >> 13));
+  }
+}
+
+#endif
+
+template <HalfFormat Format>
+inline VecF load_half(const uint16_t *p) {
+  return Format == HalfFormat::kBF16 ? load_bf16(p) : load_fp16(p);
+}
+
+template <HalfFormat Format>
+inline void store_half(VecF a, uint16_t *p) {
+  if (Format == HalfFormat::kBF16) {
+    store_bf16(a, p);
+  } else {
+    store_fp16(a, p);
+  }
+}
+
+/// dst[0, n) = src[0, n) widened to float, the tail goes through a full vector on the stack.
+template <HalfFormat Format>
+void widen_half(const uint16_t *src, float *dst, int64_t n) {
+  int64_t i = 0;
+  for (; i + W <= n; i += W) load_half<Format>(src + i).store(dst + i);
+  if (i < n) {
+    uint16_t tail[W] = {};
+    std::memcpy(tail, src + i, static_cast<size_t>(n - i) * sizeof(uint16_t));
+    load_half<Format>(tail).store(dst + i, static_cast<int>(n - i));
+  }
+}
+
+/// dst[0, n) = src[0, n) rounded to 16 bits.
+template <HalfFormat Format>
+void narrow_half(const float *src, uint16_t *dst, int64_t n) {
+  int64_t i = 0;
+  for (; i + W <= n; i += W) store_half<Format>(VecF::load(src + i), dst + i);
+  if (i < n) {
+    uint16_t tail[W];
+    store_half<Format>(VecF::load(src + i, static_cast<int>(n - i)), tail);
+    std::memcpy(dst + i, tail, static_cast<size_t>(n - i) * sizeof(uint16_t));
+  }
+}
+
+/// e^x with the Cephes polynomial (about 2 ulp), x is clamped to [-87, 88] so that the result stays
+/// a normal float.
+inline VecF exp(VecF x) {
+  x = VecF::min(VecF::max(x, VecF::set1(-87.f)), VecF::set1(88.f));
+  VecF e = VecF::round(x * VecF::set1(1.44269504088896341f));
+  VecF r = x - e * VecF::set1(0.693359375f) + e * VecF::set1(2.12194440e-4f);
+  VecF p = VecF::set1(1.9875691500e-4f);
+  p = p * r + VecF::set1(1.3981999507e-3f);
+  p = p * r + VecF::set1(8.3334519073e-3f);
+  p = p * r + VecF::set1(4.1665795894e-2f);
+  p = p * r + VecF::set1(1.6666665459e-1f);
+  p = p * r + VecF::set1(5.0000001201e-1f);
+  return VecF::ldexp(p * r * r + r + VecF::set1(1.f), e);
+}
+
+/*
+ * Spike compaction: writes the indices of the set bytes of s[0, n) to idx and returns how many
+ * there are. This is what turns a spike row into an event list for the GEMM kernels.
+ */
+inline int64_t compact_spikes(const bool *s, int64_t n, int32_t *idx, int32_t offset) {
+  int64_t count = 0;
+  int64_t i = 0;
+#if defined(SNNGROW_CPU_AVX512)
+  for (; i + 64 <= n; i += 64) {
+    __m512i b = _mm512_loadu_si512(s + i);
+    uint64_t bits = _mm512_test_epi8_mask(b, b);
+    while (bits) {
+      idx[count++] = offset + static_cast<int32_t>(i + ctz64(bits));
+      bits &= bits - 1;
+    }
+  }
+#elif defined(SNNGROW_CPU_AVX2)
+  for (; i + 32 <= n; i += 32) {
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    uint64_t bits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(b, _mm256_setzero_si256())));
+    while (bits) {
+      idx[count++] = offset + static_cast<int32_t>(i + ctz64(bits));
+      bits &= bits - 1;
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    idx[count] = offset + static_cast<int32_t>(i);
+    count += s[i] ? 1 : 0;
+  }
+  return count;
+}
+
+/*
+ * Spike x dense GEMM. Every row of A is compacted into an event list in chunks of kEventChunk
+ * columns, then the selected rows of B are summed into C with a register block of kUnroll vectors.
+ */
+constexpr int64_t kEventChunk = 1024;
+constexpr int kUnroll = 4;
+
+inline void accumulate_rows(const int32_t *idx, int64_t count, const float *B, int64_t ldb,
+                            float *c, int64_t N, bool first) {
+  int64_t n = 0;
+  for (; n + kUnroll * W <= N; n += kUnroll * W) {
+    VecF acc[kUnroll];
+    for (int u = 0; u < kUnroll; ++u) acc[u] = first ? VecF::zero() : VecF::load(c + n + u * W);
+    for (int64_t e = 0; e < count; ++e) {
+      const float *b = B + static_cast<int64_t>(idx[e]) * ldb + n;
+      for (int u = 0; u < kUnroll; ++u) acc[u] = acc[u] + VecF::load(b + u * W);
+    }
+    for (int u = 0; u < kUnroll; ++u) acc[u].store(c + n + u * W);
+  }
+  for (; n < N; n += W) {
+    int rem = static_cast<int>(N - n < W ? N - n : W);
+    VecF acc = first ? VecF::zero() : VecF::load(c + n, rem);
+    for (int64_t e = 0; e < count; ++e) {
+      acc = acc + VecF::load(B + static_cast<int64_t>(idx[e]) * ldb + n, rem);
+    }
+    acc.store(c + n, rem);
+  }
+}
+
+inline int64_t row_of(const int64_t *rows, int64_t m) {
+  return rows ? rows[m] : m;
+}
+
+/// Start of row m of C, see GemmAddressing for the layout.
+inline float *c_row(float *C, int64_t ldc, int64_t m, const GemmAddressing &addr) {
+  int64_t r = row_of(addr.c_rows, m);
+  if (addr.row_group > 0) {
+    return C + (r / addr.row_group) * addr.group_stride + (r % addr.row_group) * ldc;
+  }
+  return C + r * ldc;
+}
+
+/// accumulate_rows over the column blocks of a permuted C row, the event list is shared by them.
+inline void accumulate_blocks(const int32_t *idx, int64_t count, const float *B, int64_t ldb,
+                              float *c, int64_t N, bool first, const GemmAddressing &addr) {
+  if (addr.col_block <= 0 || addr.col_block >= N) {
+    accumulate_rows(idx, count, B, ldb, c, N, first);
+    return;
+  }
+  for (int64_t n0 = 0, blk = 0; n0 < N; n0 += addr.col_block, ++blk) {
+    int64_t len = N - n0 < addr.col_block ? N - n0 : addr.col_block;
+    accumulate_rows(idx, count, B + n0, ldb, c + blk * addr.block_stride, len, first);
+  }
+}
+
+void spike_gemm_sd(const bool *A, int64_t lda, const float *B, int64_t ldb,
+                   float *C, int64_t ldc, int64_t m_begin, int64_t m_end,
+                   int64_t N, int64_t K, const GemmAddressing &addr) {
+  int32_t idx[kEventChunk];
+  for (int64_t m = m_begin; m < m_end; ++m) {
+    const bool *a = A + row_of(addr.a_rows, m) * lda;
+    float *c = c_row(C, ldc, m, addr);
+    if (K == 0) {
+      accumulate_blocks(idx, 0, B, ldb, c, N, true, addr);
+      continue;
+    }
+    for (int64_t k0 = 0; k0 < K; k0 += kEventChunk) {
+      int64_t len = K - k0 < kEventChunk ? K - k0 : kEventChunk;
+      int64_t count = compact_spikes(a + k0, len, idx, static_cast<int32_t>(k0));
+      if (count == 0 && k0 != 0) continue;
+      accumulate_blocks(idx, count, B, ldb, c, N, k0 == 0, addr);
+    }
+  }
+}
+
+/*
+ * Packed spike x dense GEMM, the event list of a row comes straight from the set bits of its words.
+ */
+void spike_gemm_pd(const uint64_t *A, int64_t lda, const float *B, int64_t ldb,
+                   float *C, int64_t ldc, int64_t m_begin, int64_t m_end, int64_t N, int64_t K) {
+  constexpr int64_t kChunkWords = kEventChunk / 64;
+  int32_t idx[kEventChunk];
+  const int64_t words = (K + 63) / 64;
+  for (int64_t m = m_begin; m < m_end; ++m) {
+    const uint64_t *a = A + m * lda;
+    float *c = C + m * ldc;
+    bool first = true;
+    for (int64_t w0 = 0; w0 < words; w0 += kChunkWords) {
+      const int64_t w_end = words - w0 < kChunkWords ? words : w0 + kChunkWords;
+      int64_t count = 0;
+      for (int64_t w = w0; w < w_end; ++w) {
+        for (uint64_t bits = a[w]; bits; bits &= bits - 1) {
+          idx[count++] = static_cast<int32_t>(w * 64 + ctz64(bits));
+        }
+      }
+      if (count == 0 && !first) continue;
+      accumulate_rows(idx, count, B, ldb, c, N, first);
+      first = false;
+    }
+    if (first) accumulate_rows(idx, 0, B, ldb, c, N, true);
+  }
+}
+
+/*
+ * Sparse (CSR) spike x dense GEMM, the events of a row are already an index list.
+ */
+void spike_gemm_csr(const int64_t *crow, const int64_t *col, const float *B, int64_t ldb,
+                    float *C, int64_t ldc, int64_t m_begin, int64_t m_end, int64_t N) {
+  int32_t idx[kEventChunk];
+  for (int64_t m = m_begin; m < m_end; ++m) {
+    float *c = C + m * ldc;
+    const int64_t e_end = crow[m + 1];
+    int64_t e0 = crow[m];
+    bool first = true;  // an empty row still zeroes its output
+    do {
+      const int64_t count = e_end - e0 < kEventChunk ? e_end - e0 : kEventChunk;
+      for (int64_t e = 0; e < count; ++e) idx[e] = static_cast<int32_t>(col[e0 + e]);
+      accumulate_rows(idx, count, B, ldb, c, N, first);
+      e0 += count;
+      first = false;
+    } while (e0 < e_end);
+  }
+}
+
+/*
+ * Time-to-first-spike linear layer. The inputs are bucketed by spike time (counting sort, T <= 255),
+ * every step adds the weight rows of the inputs firing at it and fires the outputs that crossed the
+ * threshold, each output at most once.
+ */
+void ttfs_linear(const uint8_t *times, int64_t K, const float *W, int64_t ldw, const float *bias,
+                 float threshold, int64_t T, int64_t N, float *v, int32_t *order, uint8_t *out) {
+  int64_t start[kNeverFires + 1] = {0};
+  for (int64_t k = 0; k < K; ++k) {
+    if (times[k] < T) ++start[times[k] + 1];
+  }
+  for (int64_t t = 0; t < T; ++t) start[t + 1] += start[t];
+  int64_t fill[kNeverFires];
+  for (int64_t t = 0; t < T; ++t) fill[t] = start[t];
+  for (int64_t k = 0; k < K; ++k) {
+    if (times[k] < T) order[fill[times[k]]++] = static_cast<int32_t>(k);
+  }
+
+  for (int64_t n = 0; n < N; ++n) {
+    v[n] = bias ? bias[n] : 0.f;
+    out[n] = kNeverFires;
+  }
+  int64_t remaining = N;
+  for (int64_t t = 0; t < T && remaining > 0; ++t) {
+    const int64_t count = start[t + 1] - start[t];
+    if (count > 0) accumulate_rows(order + start[t], count, W, ldw, v, N, false);
+    for (int64_t n = 0; n < N; ++n) {
+      if (out[n] == kNeverFires && v[n] >= threshold) {
+        out[n] = static_cast<uint8_t>(t);
+        --remaining;
+      }
+    }
+    // without further input the potentials are final
+    if (start[t + 1] == start[T]) break;
+  }
+}
+
+/// c[0, n) += b[0, n)
+inline void add_row(float *c, const float *b, int64_t n) {
+  int64_t i = 0;
+  for (; i + W <= n; i += W) (VecF::load(c + i) + VecF::load(b + i)).store(c + i);
+  if (i < n) {
+    const int rem = static_cast<int>(n - i);
+    (VecF::load(c + i, rem) + VecF::load(b + i, rem)).store(c + i, rem);
+  }
+}
+
+/*
+ * Event-driven conv2d: every input spike adds the weight slice of its channel to the outputs its
+ * receptive field covers. The output is channels-last so each addition is a contiguous vector row.
+ */
+void spike_conv2d_csr(const int64_t *crow, const int64_t *col, const float *weight, float *out,
+                      const Conv2dParams &p) {
+  const int64_t O = p.out_channels;
+  for (int64_t row = 0; row < p.channels * p.height; ++row) {
+    const int64_t c = row / p.height;
+    const int64_t y = row % p.height;
+    for (int64_t e = crow[row]; e < crow[row + 1]; ++e) {
+      const int64_t x = col[e];
+      for (int64_t ky = 0; ky < p.kernel_h; ++ky) {
+        const int64_t ny = y + p.pad_h - ky;
+        if (ny < 0 || ny % p.stride_h != 0 || ny / p.stride_h >= p.out_height) continue;
+        const int64_t oy = ny / p.stride_h;
+        for (int64_t kx = 0; kx < p.kernel_w; ++kx) {
+          const int64_t nx = x + p.pad_w - kx;
+          if (nx < 0 || nx % p.stride_w != 0 || nx / p.stride_w >= p.out_width) continue;
+          const int64_t ox = nx / p.stride_w;
+          add_row(out + (oy * p.out_width + ox) * O, weight + ((c * p.kernel_h + ky) * p.kernel_w + kx) * O, O);
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Dense x spike GEMM. A block of kRows rows of C is held in registers while K is swept once; each
+ * spike row of B becomes a lane mask that gates the broadcast A value.
+ */
+constexpr int kRows = 4;
+constexpr int kCols = 2;
+
+template <int Rows>
+inline void gemm_ds_block(const float *const *A, const bool *B, int64_t ldb,
+                          float *const *C, int rem, int64_t K) {
+  VecF acc[Rows][kCols];
+  for (int r = 0; r < Rows; ++r)
+    for (int u = 0; u < kCols; ++u) acc[r][u] = VecF::zero();
+  const int cols = rem >= kCols * W ? kCols : 1;
+  for (int64_t k = 0; k < K; ++k) {
+    const bool *b = B + k * ldb;
+    MaskF mask[kCols];
+    if (rem >= kCols * W) {
+      for (int u = 0; u < kCols; ++u) mask[u] = MaskF::from_spikes(b + u * W);
+    } else {
+      mask[0] = rem >= W ? MaskF::from_spikes(b) : MaskF::from_spikes(b, rem);
+    }
+    for (int r = 0; r < Rows; ++r) {
+      float a = A[r][k];
+      if (a == 0.f) continue;
+      VecF av = VecF::set1(a);
+      for (int u = 0; u < cols; ++u) acc[r][u] = VecF::add_masked(acc[r][u], mask[u], av);
+    }
+  }
+  for (int r = 0; r < Rows; ++r) {
+    if (rem >= kCols * W) {
+      for (int u = 0; u < kCols; ++u) acc[r][u].store(C[r] + u * W);
+    } else if (rem >= W) {
+      acc[r][0].store(C[r]);
+    } else {
+      acc[r][0].store(C[r], rem);
+    }
+  }
+}
+
+template <int Rows>
+inline void gemm_ds_rows(const float *A, int64_t lda, const bool *B, int64_t ldb,
+                         float *C, int64_t ldc, int64_t m, int64_t N, int64_t K,
+                         const GemmAddressing &addr) {
+  const float *a[Rows];
+  float *c[Rows];
+  for (int r = 0; r < Rows; ++r) {
+    a[r] = A + row_of(addr.a_rows, m + r) * lda;
+    c[r] = c_row(C, ldc, m + r, addr);
+  }
+  const int64_t block = addr.col_block > 0 && addr.col_block < N ? addr.col_block : N;
+  for (int64_t n0 = 0, blk = 0; n0 < N; n0 += block, ++blk) {
+    const int64_t n_end = N - n0 < block ? N : n0 + block;
+    for (int64_t n = n0; n < n_end;) {
+      int rem = static_cast<int>(n_end - n < kCols * W ? n_end - n : kCols * W);
+      float *cn[Rows];
+      for (int r = 0; r < Rows; ++r) cn[r] = c[r] + blk * addr.block_stride + (n - n0);
+      gemm_ds_block<Rows>(a, B + n, ldb, cn, rem, K);
+      n += rem >= kCols * W ? kCols * W : (rem >= W ? W : rem);
+    }
+  }
+}
+
+void spike_gemm_ds(const float *A, int64_t lda, const bool *B, int64_t ldb,
+                   float *C, int64_t ldc, int64_t m_begin, int64_t m_end,
+                   int64_t N, int64_t K, const GemmAddressing &addr) {
+  int64_t m = m_begin;
+  for (; m + kRows <= m_end; m += kRows) {
+    gemm_ds_rows<kRows>(A, lda, B, ldb, C, ldc, m, N, K, addr);
+  }
+  for (; m < m_end; ++m) {
+    gemm_ds_rows<1>(A, lda, B, ldb, C, ldc, m, N, K, addr);
+  }
+}
+
+/*
+ * Bit packing
+ */
+
+void pack_spikes(const bool *src, int64_t n, uint64_t *dst) {
+  int64_t w = 0;
+  int64_t i = 0;
+#if defined(SNNGROW_CPU_AVX512)
+  for (; i + 64 <= n; i += 64) {
+    __m512i b = _mm512_loadu_si512(src + i);
+    dst[w++] = _mm512_test_epi8_mask(b, b);
+  }
+#elif defined(SNNGROW_CPU_AVX2)
+  const __m256i zero = _mm256_setzero_si256();
+  for (; i + 64 <= n; i += 64) {
+    __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 32));
+    uint64_t bits_lo = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(lo, zero)));
+    uint64_t bits_hi = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(hi, zero)));
+    dst[w++] = bits_lo | (bits_hi << 32);
+  }
+#else
+  for (; i + 64 <= n; i += 64) {
+    uint64_t bits = 0;
+    for (int j = 0; j < 64; ++j) bits |= static_cast<uint64_t>(src[i + j]) << j;
+    dst[w++] = bits;
+  }
+#endif
+  if (i < n) {
+    uint64_t bits = 0;
+    for (int j = 0; i + j < n; ++j) bits |= static_cast<uint64_t>(src[i + j]) << j;
+    dst[w++] = bits;
+  }
+}
+
+void bit_indices(const uint64_t *src, int64_t nwords, int64_t *dst) {
+  int64_t count = 0;
+  for (int64_t w = 0; w < nwords; ++w) {
+    for (uint64_t bits = src[w]; bits; bits &= bits - 1) dst[count++] = w * 64 + ctz64(bits);
+  }
+}
+
+void unpack_spikes(const uint64_t *src, int64_t n, bool *dst) {
+  int64_t w = 0;
+  int64_t i = 0;
+#if defined(SNNGROW_CPU_AVX512)
+  const __m512i one = _mm512_set1_epi8(1);
+  for (; i + 64 <= n; i += 64) {
+    _mm512_storeu_si512(dst + i, _mm512_maskz_mov_epi8(src[w++], one));
+  }
+  if (i < n) {
+    __mmask64 tail = (~0ULL) >> (64 - (n - i));
+    _mm512_mask_storeu_epi8(dst + i, tail, _mm512_maskz_mov_epi8(src[w], one));
+  }
+#elif defined(SNNGROW_CPU_AVX2)
+  for (; i + 64 <= n; i += 64) {
+    uint64_t bits = src[w++];
+    for (int j = 0; j < 8; ++j) {
+      uint64_t bytes = _pdep_u64(bits >> (8 * j), 0x0101010101010101ULL);
+      std::memcpy(dst + i + 8 * j, &bytes, 8);
+    }
+  }
+  if (i < n) {
+    uint64_t bits = src[w];
+    for (int j = 0; i + j < n; ++j) dst[i + j] = (bits >> j) & 1;
+  }
+#else
+  for (; i < n; i += 64) {
+    uint64_t bits = src[w++];
+    for (int j = 0; j < 64 && i + j < n; ++j) dst[i + j] = (bits >> j) & 1;
+  }
+#endif
+}
+
+int64_t popcount(const uint64_t *src, int64_t nwords) {
+  int64_t count = 0;
+  int64_t i = 0;
+#if defined(SNNGROW_CPU_VPOPCNT)
+  __m512i acc = _mm512_setzero_si512();
+  for (; i + 8 <= nwords; i += 8) {
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_loadu_si512(src + i)));
+  }
+  count = _mm512_reduce_add_epi64(acc);
+#elif defined(SNNGROW_CPU_AVX512)
+  // nibble lookup, the byte sums are folded into 64-bit lanes with sad
+  const __m512i lut = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4));
+  const __m512i low = _mm512_set1_epi8(0x0f);
+  __m512i acc = _mm512_setzero_si512();
+  for (; i + 8 <= nwords; i += 8) {
+    __m512i v = _mm512_loadu_si512(src + i);
+    __m512i lo = _mm512_shuffle_epi8(lut, _mm512_and_si512(v, low));
+    __m512i hi = _mm512_shuffle_epi8(lut, _mm512_and_si512(_mm512_srli_epi16(v, 4), low));
+    acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_add_epi8(lo, hi), _mm512_setzero_si512()));
+  }
+  count = _mm512_reduce_add_epi64(acc);
+#endif
+  for (; i < nwords; ++i) count += popcount64(src[i]);
+  return count;
+}
+
+/*
+ * Bit-matrix transpose. A 64 x 64 block (one word per row) is transposed in place in six stages:
+ * stage j swaps the upper-right and lower-left j x j sub-blocks of every 2j x 2j block. The stages
+ * with j at least one vector of words work on whole vectors, the last ones on single words.
+ */
+#if defined(SNNGROW_CPU_AVX512)
+
+constexpr int kWordsPerVec = 8;
+
+inline void transpose_stage(uint64_t *a, int j, uint64_t mask) {
+  const __m512i m = _mm512_set1_epi64(static_cast<long long>(mask));
+  const __m128i shift = _mm_cvtsi32_si128(j);
+  for (int base = 0; base < 64; base += 2 * j) {
+    for (int i = 0; i < j; i += kWordsPerVec) {
+      __m512i lo = _mm512_loadu_si512(a + base + i);
+      __m512i hi = _mm512_loadu_si512(a + base + j + i);
+      __m512i t = _mm512_and_si512(_mm512_xor_si512(_mm512_srl_epi64(lo, shift), hi), m);
+      _mm512_storeu_si512(a + base + j + i, _mm512_xor_si512(hi, t));
+      _mm512_storeu_si512(a + base + i, _mm512_xor_si512(lo, _mm512_sll_epi64(t, shift)));
+    }
+  }
+}
+
+#elif defined(SNNGROW_CPU_AVX2)
+
+constexpr int kWordsPerVec = 4;
+
+inline void transpose_stage(uint64_t *a, int j, uint64_t mask) {
+  const __m256i m = _mm256_set1_epi64x(static_cast<long long>(mask));
+  const __m128i shift = _mm_cvtsi32_si128(j);
+  for (int base = 0; base < 64; base += 2 * j) {
+    for (int i = 0; i < j; i += kWordsPerVec) {
+      __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + base + i));
+      __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + base + j + i));
+      __m256i t = _mm256_and_si256(_mm256_xor_si256(_mm256_srl_epi64(lo, shift), hi), m);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + base + j + i), _mm256_xor_si256(hi, t));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(a + base + i), _mm256_xor_si256(lo, _mm256_sll_epi64(t, shift)));
+    }
+  }
+}
+
+#else
+
+constexpr int kWordsPerVec = 64;
+
+inline void transpose_stage(uint64_t *, int, uint64_t) {}
+
+#endif
+
+inline void transpose64(uint64_t *a) {
+  uint64_t mask = 0x00000000FFFFFFFFULL;
+  for (int j = 32; j != 0; j >>= 1, mask ^= mask << j) {
+    if (j >= kWordsPerVec) {
+      transpose_stage(a, j, mask);
+      continue;
+    }
+    for (int base = 0; base < 64; base += 2 * j) {
+      for (int i = base; i < base + j; ++i) {
+        uint64_t t = ((a[i] >> j) ^ a[i + j]) & mask;
+        a[i + j] ^= t;
+        a[i] ^= t << j;
+      }
+    }
+  }
+}
+
+void transpose_bits(const uint64_t *src, int64_t rows, int64_t cols, uint64_t *dst,
+                    int64_t block_begin, int64_t block_end) {
+  const int64_t src_words = (cols + 63) / 64;
+  const int64_t dst_words = (rows + 63) / 64;
+  alignas(64) uint64_t block[64];
+  for (int64_t cb = block_begin; cb < block_end; ++cb) {
+    const int64_t out_rows = cols - cb * 64 < 64 ? cols - cb * 64 : 64;
+    for (int64_t rb = 0; rb < dst_words; ++rb) {
+      const int64_t in_rows = rows - rb * 64 < 64 ? rows - rb * 64 : 64;
+      const uint64_t *s = src + rb * 64 * src_words + cb;
+      int64_t i = 0;
+      for (; i < in_rows; ++i) block[i] = s[i * src_words];
+      for (; i < 64; ++i) block[i] = 0;
+      transpose64(block);
+      uint64_t *d = dst + cb * 64 * dst_words + rb;
+      for (i = 0; i < out_rows; ++i) d[i * dst_words] = block[i];
+    }
+  }
+}
+
+void first_spike(const uint64_t *src, int64_t nwords, int64_t n, int64_t none, int64_t *dst) {
+  if (nwords == 1) {
+    // trains of up to 64 steps: one tzcnt per neuron
+    for (int64_t i = 0; i < n; ++i) dst[i] = src[i] ? ctz64(src[i]) : none;
+    return;
+  }
+  for (int64_t i = 0; i < n; ++i) {
+    const uint64_t *s = src + i * nwords;
+    int64_t t = none;
+    for (int64_t w = 0; w < nwords; ++w) {
+      if (s[w]) {
+        t = w * 64 + ctz64(s[w]);
+        break;
+      }
+    }
+    dst[i] = t;
+  }
+}
+
+/*
+ * Word-parallel logic. The loops are plain word loops that the compiler vectorizes for the variant
+ * ISA, the operation is a template argument so that there is no branch inside them.
+ */
+template <BitOp Op>
+inline uint64_t apply_bit_op(uint64_t a, uint64_t b) {
+  switch (Op) {
+    case BitOp::kAnd: return a & b;
+    case BitOp::kOr: return a | b;
+    case BitOp::kXor: return a ^ b;
+    case BitOp::kAndNot: return a & ~b;
+    default: return ~a;
+  }
+}
+
+template <BitOp Op>
+void bitwise_words_impl(const uint64_t *a, const uint64_t *b, uint64_t *dst, int64_t nwords) {
+  if (Op == BitOp::kNot) {
+    for (int64_t w = 0; w < nwords; ++w) dst[w] = ~a[w];
+    return;
+  }
+  for (int64_t w = 0; w < nwords; ++w) dst[w] = apply_bit_op<Op>(a[w], b[w]);
+}
+
+void bitwise_words(const uint64_t *a, const uint64_t *b, uint64_t *dst, int64_t nwords, BitOp op) {
+  switch (op) {
+    case BitOp::kAnd: bitwise_words_impl<BitOp::kAnd>(a, b, dst, nwords); break;
+    case BitOp::kOr: bitwise_words_impl<BitOp::kOr>(a, b, dst, nwords); break;
+    case BitOp::kXor: bitwise_words_impl<BitOp::kXor>(a, b, dst, nwords); break;
+    case BitOp::kAndNot: bitwise_words_impl<BitOp::kAndNot>(a, b, dst, nwords); break;
+    case BitOp::kNot: bitwise_words_impl<BitOp::kNot>(a, b, dst, nwords); break;
+  }
+}
+
+template <BitOp Op>
+void reduce_words_impl(const uint64_t *src, int64_t rows, int64_t ld, int64_t nwords, uint64_t *dst) {
+  for (int64_t w = 0; w < nwords; ++w) dst[w] = src[w];
+  for (int64_t r = 1; r < rows; ++r) {
+    const uint64_t *s = src + r * ld;
+    for (int64_t w = 0; w < nwords; ++w) dst[w] = apply_bit_op<Op>(dst[w], s[w]);
+  }
+}
+
+void reduce_words(const uint64_t *src, int64_t rows, int64_t ld, int64_t nwords, uint64_t *dst,
+                  BitOp op) {
+  if (op == BitOp::kAnd) {
+    reduce_words_impl<BitOp::kAnd>(src, rows, ld, nwords, dst);
+  } else {
+    reduce_words_impl<BitOp::kOr>(src, rows, ld, nwords, dst);
+  }
+}
+
+/// Column counts visit the set bits only, their cost follows the spike count.
+void count_columns(const uint64_t *src, int64_t rows, int64_t ld, int64_t nwords, int64_t *counts) {
+  for (int64_t r = 0; r < rows; ++r) {
+    const uint64_t *s = src + r * ld;
+    for (int64_t w = 0; w < nwords; ++w) {
+      for (uint64_t bits = s[w]; bits; bits &= bits - 1) ++counts[w * 64 + ctz64(bits)];
+    }
+  }
+}
+
+/*
+ * Neuron update
+ */
+
+template <NeuronMode Mode>
+inline VecF charge(VecF x, VecF v, VecF tau, VecF decay, VecF v_reset) {
+  switch (Mode) {
+    case NeuronMode::kIF: return v + x;
+    case NeuronMode::kLIFDecayInputReset0: return v + (x - v) / tau;
+    case NeuronMode::kLIFDecayInput: return v + (x - (v - v_reset)) / tau;
+    case NeuronMode::kLIFNoDecayInputReset0: return v * decay + x;
+    case NeuronMode::kLIFNoDecayInput: return v - (v - v_reset) / tau + x;
+  }
+  return v;
+}
+
+template <NeuronMode Mode, bool HardReset>
+void neuron_step_impl(const float *x, float *v, bool *spike_b, float *spike_f, int64_t n,
+                      const NeuronParams &p) {
+  const VecF tau = VecF::set1(p.tau);
+  const VecF decay = VecF::set1(p.decay);
+  const VecF v_threshold = VecF::set1(p.v_threshold);
+  const VecF v_reset = VecF::set1(p.v_reset);
+  const VecF one = VecF::set1(1.f);
+  const VecF zero = VecF::zero();
+  for (int64_t i = 0; i < n; i += W) {
+    const int rem = static_cast<int>(n - i < W ? n - i : W);
+    VecF xv = rem == W ? VecF::load(x + i) : VecF::load(x + i, rem);
+    VecF vv = rem == W ? VecF::load(v + i) : VecF::load(v + i, rem);
+    vv = charge<Mode>(xv, vv, tau, decay, v_reset);
+    MaskF spike = VecF::ge(vv, v_threshold);
+    vv = HardReset ? VecF::blend(spike, vv, v_reset) : VecF::blend(spike, vv, vv - v_threshold);
+    if (rem == W) {
+      vv.store(v + i);
+      if (spike_b) spike.store_spikes(spike_b + i);
+      if (spike_f) VecF::blend(spike, zero, one).store(spike_f + i);
+    } else {
+      vv.store(v + i, rem);
+      if (spike_b) spike.store_spikes(spike_b + i, rem);
+      if (spike_f) VecF::blend(spike, zero, one).store(spike_f + i, rem);
+    }
+  }
+}
+
+template <NeuronMode Mode>
+void neuron_step_mode(const float *x, float *v, bool *spike_b, float *spike_f, int64_t n,
+                      const NeuronParams &p) {
+  if (p.hard_reset) {
+    neuron_step_impl<Mode, true>(x, v, spike_b, spike_f, n, p);
+  } else {
+    neuron_step_impl<Mode, false>(x, v, spike_b, spike_f, n, p);
+  }
+}
+
+void neuron_step(const float *x, float *v, bool *spike_b, float *spike_f, int64_t n,
+                 const NeuronParams &p) {
+  switch (p.mode) {
+    case NeuronMode::kIF:
+      neuron_step_mode<NeuronMode::kIF>(x, v, spike_b, spike_f, n, p); break;
+    case NeuronMode::kLIFDecayInputReset0:
+      neuron_step_mode<NeuronMode::kLIFDecayInputReset0>(x, v, spike_b, spike_f, n, p); break;
+    case NeuronMode::kLIFDecayInput:
+      neuron_step_mode<NeuronMode::kLIFDecayInput>(x, v, spike_b, spike_f, n, p); break;
+    case NeuronMode::kLIFNoDecayInputReset0:
+      neuron_step_mode<NeuronMode::kLIFNoDecayInputReset0>(x, v, spike_b, spike_f, n, p); break;
+    case NeuronMode::kLIFNoDecayInput:
+      neuron_step_mode<NeuronMode::kLIFNoDecayInput>(x, v, spike_b, spike_f, n, p); break;
+  }
+}
+
+/*
+ * Event-driven neuron update. Without input the LIF equations only decay the potential towards its
+ * rest value (v_reset in the kLIFDecayInput / kLIFNoDecayInput modes, 0 otherwise) by `decay` per
+ * step, so a neuron last updated in step last[i] is brought to step t - 1 by the closed form
+ * rest + (v - rest) * decay^(t - last[i] - 1), computed as exp(dt * log(decay)), before the regular
+ * charge - fire - reset of step t. IF neurons do not decay. The lanes are gathered into stack buffers
+ * and scattered back.
+ */
+template <NeuronMode Mode, bool HardReset>
+void neuron_event_step_impl(const int64_t *index, const float *x, int64_t count, float *v, int64_t *last,
+                            int64_t t, bool *spike_out, const NeuronParams &p) {
+  constexpr bool kDecayToReset = Mode == NeuronMode::kLIFDecayInput || Mode == NeuronMode::kLIFNoDecayInput;
+  const VecF log_decay = VecF::set1(Mode == NeuronMode::kIF ? 0.f : std::log(p.decay));
+  const VecF rest = VecF::set1(kDecayToReset ? p.v_reset : 0.f);
+  const VecF tau = VecF::set1(p.tau);
+  const VecF decay = VecF::set1(p.decay);
+  const VecF v_threshold = VecF::set1(p.v_threshold);
+  const VecF v_reset = VecF::set1(p.v_reset);
+  const VecF one = VecF::set1(1.f);
+  for (int64_t c = 0; c < count; c += W) {
+    const int rem = static_cast<int>(count - c < W ? count - c : W);
+    float vb[W] = {};
+    float db[W] = {};
+    for (int j = 0; j < rem; ++j) {
+      const int64_t i = index[c + j];
+      vb[j] = v[i];
+      db[j] = static_cast<float>(t - last[i] - 1);
+    }
+    VecF vv = VecF::load(vb);
+    const VecF dt = VecF::load(db);
+    // neurons updated in the previous step keep v exactly
+    vv = VecF::blend(VecF::ge(dt, one), vv, rest + (vv - rest) * exp(dt * log_decay));
+    vv = charge<Mode>(rem == W ? VecF::load(x + c) : VecF::load(x + c, rem), vv, tau, decay, v_reset);
+    MaskF spike = VecF::ge(vv, v_threshold);
+    vv = HardReset ? VecF::blend(spike, vv, v_reset) : VecF::blend(spike, vv, vv - v_threshold);
+    vv.store(vb);
+    if (rem == W) {
+      spike.store_spikes(spike_out + c);
+    } else {
+      spike.store_spikes(spike_out + c, rem);
+    }
+    for (int j = 0; j < rem; ++j) {
+      const int64_t i = index[c + j];
+      v[i] = vb[j];
+      last[i] = t;
+    }
+  }
+}
+
+template <NeuronMode Mode>
+void neuron_event_step_mode(const int64_t *index, const float *x, int64_t count, float *v, int64_t *last,
+                            int64_t t, bool *spike, const NeuronParams &p) {
+  if (p.hard_reset) {
+    neuron_event_step_impl<Mode, true>(index, x, count, v, last, t, spike, p);
+  } else {
+    neuron_event_step_impl<Mode, false>(index, x, count, v, last, t, spike, p);
+  }
+}
+
+void neuron_event_step(const int64_t *index, const float *x, int64_t count, float *v, int64_t *last, int64_t t,
+                       bool *spike, const NeuronParams &p) {
+  switch (p.mode) {
+    case NeuronMode::kIF:
+      neuron_event_step_mode<NeuronMode::kIF>(index, x, count, v, last, t, spike, p); break;
+    case NeuronMode::kLIFDecayInputReset0:
+      neuron_event_step_mode<NeuronMode::kLIFDecayInputReset0>(index, x, count, v, last, t, spike, p); break;
+    case NeuronMode::kLIFDecayInput:
+      neuron_event_step_mode<NeuronMode::kLIFDecayInput>(index, x, count, v, last, t, spike, p); break;
+    case NeuronMode::kLIFNoDecayInputReset0:
+      neuron_event_step_mode<NeuronMode::kLIFNoDecayInputReset0>(index, x, count, v, last, t, spike, p); break;
+    case NeuronMode::kLIFNoDecayInput:
+      neuron_event_step_mode<NeuronMode::kLIFNoDecayInput>(index, x, count, v, last, t, spike, p); break;
+  }
+}
+
+/*
+ * Neuron update with a threshold and an input bias per channel, e.g. after a BatchNorm folded into
+ * the neuron. Channels of one neuron (inner == 1, the features of a linear layer) load the
+ * thresholds as vectors, otherwise they are broadcast over the inner run of the channel.
+ */
+template <NeuronMode Mode, bool HardReset>
+inline void neuron_step_channel_vec(const float *x, float *v, bool *spike_b, float *spike_f, int rem,
+                                    VecF v_threshold, VecF bias, const NeuronParams &p) {
+  const VecF tau = VecF::set1(p.tau);
+  const VecF decay = VecF::set1(p.decay);
+  const VecF v_reset = VecF::set1(p.v_reset);
+  VecF xv = (rem == W ? VecF::load(x) : VecF::load(x, rem)) + bias;
+  VecF vv = rem == W ? VecF::load(v) : VecF::load(v, rem);
+  vv = charge<Mode>(xv, vv, tau, decay, v_reset);
+  MaskF spike = VecF::ge(vv, v_threshold);
+  vv = HardReset ? VecF::blend(spike, vv, v_reset) : VecF::blend(spike, vv, vv - v_threshold);
+  const VecF spike_v = VecF::blend(spike, VecF::zero(), VecF::set1(1.f));
+  if (rem == W) {
+    vv.store(v);
+    if (spike_b) spike.store_spikes(spike_b);
+    if (spike_f) spike_v.store(spike_f);
+  } else {
+    vv.store(v, rem);
+    if (spike_b) spike.store_spikes(spike_b, rem);
+    if (spike_f) spike_v.store(spike_f, rem);
+  }
+}
+
+template <NeuronMode Mode, bool HardReset>
+void neuron_step_channels_impl(const float *x, float *v, bool *spike_b, float *spike_f, int64_t channels,
+                               int64_t inner, const float *v_threshold, const float *bias,
+                               const NeuronParams &p) {
+  if (inner == 1) {
+    for (int64_t c = 0; c < channels; c += W) {
+      const int rem = static_cast<int>(channels - c < W ? channels - c : W);
+      const VecF threshold = rem == W ? VecF::load(v_threshold + c) : VecF::load(v_threshold + c, rem);
+      const VecF b = !bias ? VecF::zero() : rem == W ? VecF::load(bias + c) : VecF::load(bias + c, rem);
+      neuron_step_channel_vec<Mode, HardReset>(x + c, v + c, spike_b ? spike_b + c : nullptr,
+                                               spike_f ? spike_f + c : nullptr, rem, threshold, b, p);
+    }
+    return;
+  }
+  for (int64_t c = 0; c < channels; ++c) {
+    const VecF threshold = VecF::set1(v_threshold[c]);
+    const VecF b = bias ? VecF::set1(bias[c]) : VecF::zero();
+    for (int64_t j = c * inner, end = (c + 1) * inner; j < end; j += W) {
+      const int rem = static_cast<int>(end - j < W ? end - j : W);
+      neuron_step_channel_vec<Mode, HardReset>(x + j, v + j, spike_b ? spike_b + j : nullptr,
+                                               spike_f ? spike_f + j : nullptr, rem, threshold, b, p);
+    }
+  }
+}
+
+template <NeuronMode Mode>
+void neuron_step_channels_mode(const float *x, float *v, bool *spike_b, float *spike_f, int64_t channels,
+                               int64_t inner, const float *v_threshold, const float *bias,
+                               const NeuronParams &p) {
+  if (p.hard_reset) {
+    neuron_step_channels_impl<Mode, true>(x, v, spike_b, spike_f, channels, inner, v_threshold, bias, p);
+  } else {
+    neuron_step_channels_impl<Mode, false>(x, v, spike_b, spike_f, channels, inner, v_threshold, bias, p);
+  }
+}
+
+void neuron_step_channels(const float *x, float *v, bool *spike_b, float *spike_f, int64_t channels,
+                          int64_t inner, const float *v_threshold, const float *bias, const NeuronParams &p) {
+  switch (p.mode) {
+    case NeuronMode::kIF:
+      neuron_step_channels_mode<NeuronMode::kIF>(x, v, spike_b, spike_f, channels, inner, v_threshold, bias, p);
+      break;
+    case NeuronMode::kLIFDecayInputReset0:
+      neuron_step_channels_mode<NeuronMode::kLIFDecayInputReset0>(x, v, spike_b, spike_f, channels, inner,
+                                                                  v_threshold, bias, p);
+      break;
+    case NeuronMode::kLIFDecayInput:
+      neuron_step_channels_mode<NeuronMode::kLIFDecayInput>(x, v, spike_b, spike_f, channels, inner,
+                                                            v_threshold, bias, p);
+      break;
+    case NeuronMode::kLIFNoDecayInputReset0:
+      neuron_step_channels_mode<NeuronMode::kLIFNoDecayInputReset0>(x, v, spike_b, spike_f, channels, inner,
+                                                                    v_threshold, bias, p);
+      break;
+    case NeuronMode::kLIFNoDecayInput:
+      neuron_step_channels_mode<NeuronMode::kLIFNoDecayInput>(x, v, spike_b, spike_f, channels, inner,
+                                                              v_threshold, bias, p);
+      break;
+  }
+}
+
+/*
+ * Neuron update on a 16-bit membrane potential, in blocks of 64 neurons that are widened into a
+ * float buffer on the stack, updated by neuron_step and rounded back.
+ */
+template <HalfFormat Format>
+void neuron_step_half_format(const float *x, uint16_t *v, bool *spike_b, float *spike_f, int64_t n,
+                             const NeuronParams &p) {
+  float buf[64];
+  for (int64_t i = 0; i < n; i += 64) {
+    const int64_t len = n - i < 64 ? n - i : 64;
+    widen_half<Format>(v + i, buf, len);
+    neuron_step(x + i, buf, spike_b ? spike_b + i : nullptr, spike_f ? spike_f + i : nullptr, len, p);
+    narrow_half<Format>(buf, v + i, len);
+  }
+}
+
+void neuron_step_half(const float *x, uint16_t *v, bool *spike_b, float *spike_f, int64_t n,
+                      const NeuronParams &p, HalfFormat format) {
+  if (format == HalfFormat::kBF16) {
+    neuron_step_half_format<HalfFormat::kBF16>(x, v, spike_b, spike_f, n, p);
+  } else {
+    neuron_step_half_format<HalfFormat::kFP16>(x, v, spike_b, spike_f, n, p);
+  }
+}
+
+/*
+ * Multi-step neuron update. Neurons are processed in groups of 64 whose potentials stay in vector
+ * registers for all T steps, and the spikes of a group at one step form exactly one packed word.
+ */
+template <NeuronMode Mode, bool HardReset>
+void neuron_multistep_impl(const float *x, float *v, bool *spike_b, float *spike_f, uint64_t *spike_w,
+                           float *v_seq, float *v_max, float *v_margin, int64_t T, int64_t ld, int64_t ldw, int64_t n,
+                           const NeuronParams &p) {
+  constexpr int kGroupVecs = 64 / W;
+  const VecF tau = VecF::set1(p.tau);
+  const VecF decay = VecF::set1(p.decay);
+  const VecF v_threshold = VecF::set1(p.v_threshold);
+  const VecF v_reset = VecF::set1(p.v_reset);
+  const VecF one = VecF::set1(1.f);
+  const VecF zero = VecF::zero();
+  for (int64_t g = 0; g < n; g += 64) {
+    const int64_t len = n - g < 64 ? n - g : 64;
+    const int vecs = static_cast<int>((len + W - 1) / W);
+    VecF vs[kGroupVecs];
+    VecF vm[kGroupVecs];
+    VecF mg[kGroupVecs];
+    for (int j = 0; j < vecs; ++j) {
+      const int rem = static_cast<int>(len - j * W < W ? len - j * W : W);
+      vs[j] = rem == W ? VecF::load(v + g + j * W) : VecF::load(v + g + j * W, rem);
+      vm[j] = VecF::set1(-3.402823466e+38f);
+      mg[j] = VecF::set1(3.402823466e+38f);
+    }
+    for (int64_t t = 0; t < T; ++t) {
+      const int64_t offset = t * ld + g;
+      uint64_t word = 0;
+      for (int j = 0; j < vecs; ++j) {
+        const int rem = static_cast<int>(len - j * W < W ? len - j * W : W);
+        const int64_t i = offset + j * W;
+        VecF vv = charge<Mode>(rem == W ? VecF::load(x + i) : VecF::load(x + i, rem), vs[j], tau, decay, v_reset);
+        MaskF spike = VecF::ge(vv, v_threshold);
+        vs[j] = HardReset ? VecF::blend(spike, vv, v_reset) : VecF::blend(spike, vv, vv - v_threshold);
+        if (v_max) vm[j] = VecF::max(vm[j], vv);
+        if (v_margin) mg[j] = VecF::min(mg[j], VecF::max(vv - v_threshold, v_threshold - vv));
+        if (rem == W) {
+          if (spike_b) spike.store_spikes(spike_b + i);
+          if (spike_f) VecF::blend(spike, zero, one).store(spike_f + i);
+          if (v_seq) vv.store(v_seq + i);
+        } else {
+          if (spike_b) spike.store_spikes(spike_b + i, rem);
+          if (spike_f) VecF::blend(spike, zero, one).store(spike_f + i, rem);
+          if (v_seq) vv.store(v_seq + i, rem);
+        }
+        // lanes past the tail are masked out of the word
+        word |= (spike.bits() & ((1ULL << rem) - 1)) << (j * W);
+      }
+      if (spike_w) spike_w[t * ldw + g / 64] = word;
+    }
+    for (int j = 0; j < vecs; ++j) {
+      const int rem = static_cast<int>(len - j * W < W ? len - j * W : W);
+      if (rem == W) {
+        vs[j].store(v + g + j * W);
+        if (v_max) vm[j].store(v_max + g + j * W);
+        if (v_margin) mg[j].store(v_margin + g + j * W);
+      } else {
+        vs[j].store(v + g + j * W, rem);
+        if (v_max) vm[j].store(v_max + g + j * W, rem);
+        if (v_margin) mg[j].store(v_margin + g + j * W, rem);
+      }
+    }
+  }
+}
+
+template <NeuronMode Mode>
+void neuron_multistep_mode(const float *x, float *v, bool *spike_b, float *spike_f, uint64_t *spike_w,
+                           float *v_seq, float *v_max, float *v_margin, int64_t T, int64_t ld, int64_t ldw, int64_t n,
+                           const NeuronParams &p) {
+  if (p.hard_reset) {
+    neuron_multistep_impl<Mode, true>(x, v, spike_b, spike_f, spike_w, v_seq, v_max, v_margin, T, ld, ldw, n, p);
+  } else {
+    neuron_multistep_impl<Mode, false>(x, v, spike_b, spike_f, spike_w, v_seq, v_max, v_margin, T, ld, ldw, n, p);
+  }
+}
+
+void neuron_multistep(const float *x, float *v, bool *spike_b, float *spike_f, uint64_t *spike_w,
+                      float *v_seq, float *v_max, float *v_margin, int64_t T, int64_t ld, int64_t ldw, int64_t n,
+                      const NeuronParams &p) {
+  switch (p.mode) {
+    case NeuronMode::kIF:
+      neuron_multistep_mode<NeuronMode::kIF>(x, v, spike_b, spike_f, spike_w, v_seq, v_max, v_margin, T, ld, ldw, n, p); break;
+    case NeuronMode::kLIFDecayInputReset0:
+      neuron_multistep_mode<NeuronMode::kLIFDecayInputReset0>(x, v, spike_b, spike_f, spike_w, v_seq, v_max, v_margin, T, ld, ldw, n, p); break;
+    case NeuronMode::kLIFDecayInput:
+      neuron_multistep_mode<NeuronMode::kLIFDecayInput>(x, v, spike_b, spike_f, spike_w, v_seq, v_max, v_margin, T, ld, ldw, n, p); break;
+    case NeuronMode::kLIFNoDecayInputReset0:
+      neuron_multistep_mode<NeuronMode::kLIFNoDecayInputReset0>(x, v, spike_b, spike_f, spike_w, v_seq, v_max, v_margin, T, ld, ldw, n, p); break;
+    case NeuronMode::kLIFNoDecayInput:
+      neuron_multistep_mode<NeuronMode::kLIFNoDecayInput>(x, v, spike_b, spike_f, spike_w, v_seq, v_max, v_margin, T, ld, ldw, n, p); break;
+  }
+}
+
+/*
+ * Fix-up of a time block of the parallel-in-time multi-step update. The block was first run from
+ * the guess (v_reset, or 0 for a soft reset) while the previous blocks were still running. Between
+ * resets the charge is the linear recurrence H = a * v + ..., so a start that differs from the
+ * guess by d moves the potential k steps later by a^k * d. Lanes that stay below the threshold from
+ * both starts (v_max + a * max(d, 0) < v_threshold, a <= 1) keep their silent spikes and only get
+ * the closed-form end state. A soft reset subtracts the same v_threshold in both runs, so the shift
+ * also survives the resets as long as the spikes agree: lanes whose charged potential never came
+ * closer to the threshold than the shift (v_margin > a * |d|, with some slack for rounding) keep
+ * their spikes too and take the closed form. The other lanes are run again from the true start;
+ * with a hard reset a lane is done at the first step where it fires in both runs, from then on both
+ * are equal, with a soft reset once the decayed shift a^k * |d| is below v_margin while the spikes
+ * agree so far.
+ */
+template <NeuronMode Mode, bool HardReset>
+void neuron_multistep_fixup_impl(const float *x, const float *v_in, const float *v_max, const float *v_margin, float *v,
+                                 bool *spike_b, float *spike_f, int64_t L, int64_t ld, int64_t n,
+                                 const NeuronParams &p) {
+  const float a = p.mode == NeuronMode::kIF ? 1.f : p.decay;
+  float a_pow = 1.f;
+  for (int64_t t = 0; t < L; ++t) a_pow *= a;
+  const VecF decay_step = VecF::set1(a);
+  const VecF decay_block = VecF::set1(a_pow);
+  const VecF guess = VecF::set1(HardReset ? p.v_reset : 0.f);
+  const VecF tau = VecF::set1(p.tau);
+  const VecF decay = VecF::set1(p.decay);
+  const VecF v_threshold = VecF::set1(p.v_threshold);
+  const VecF v_reset = VecF::set1(p.v_reset);
+  // rounding of the L steps of both runs, relative to the size of the potentials
+  const VecF slack = VecF::set1(1e-5f * static_cast<float>(L + 1) * (std::fabs(p.v_threshold) + 1.f));
+  const VecF half = VecF::set1(0.5f);
+  const VecF one = VecF::set1(1.f);
+  const VecF zero = VecF::zero();
+  for (int64_t i = 0; i < n; i += W) {
+    const int rem = static_cast<int>(n - i < W ? n - i : W);
+    const uint64_t lanes = (1ULL << rem) - 1;
+    VecF vin = rem == W ? VecF::load(v_in + i) : VecF::load(v_in + i, rem);
+    VecF vmax = rem == W ? VecF::load(v_max + i) : VecF::load(v_max + i, rem);
+    VecF vspec = rem == W ? VecF::load(v + i) : VecF::load(v + i, rem);
+    VecF d = vin - guess;
+    // lanes whose guessed spikes hold, they take the closed-form end state
+    uint64_t closed = ~VecF::ge(vmax + decay_step * VecF::max(d, zero), v_threshold).bits() & lanes;
+    VecF vmargin = zero;
+    VecF shift = decay_step * VecF::max(d, zero - d);
+    if (!HardReset) {
+      vmargin = rem == W ? VecF::load(v_margin + i) : VecF::load(v_margin + i, rem);
+      closed |= ~VecF::ge(shift + slack, vmargin).bits() & lanes;
+    }
+    VecF v_end = vspec + decay_block * d;
+    if (closed != lanes) {
+      uint64_t done = closed;
+      uint64_t merged = 0;
+      uint64_t agree = lanes;
+      VecF vv = vin;
+      for (int64_t t = 0; t < L && done != lanes; ++t) {
+        const int64_t k = t * ld + i;
+        VecF hv = charge<Mode>(rem == W ? VecF::load(x + k) : VecF::load(x + k, rem), vv, tau, decay, v_reset);
+        MaskF spike = VecF::ge(hv, v_threshold);
+        MaskF guessed = spike_b ? (rem == W ? MaskF::from_spikes(spike_b + k) : MaskF::from_spikes(spike_b + k, rem))
+                                : VecF::ge(rem == W ? VecF::load(spike_f + k) : VecF::load(spike_f + k, rem), half);
+        vv = HardReset ? VecF::blend(spike, hv, v_reset) : VecF::blend(spike, hv, hv - v_threshold);
+        if (rem == W) {
+          if (spike_b) spike.store_spikes(spike_b + k);
+          if (spike_f) VecF::blend(spike, zero, one).store(spike_f + k);
+        } else {
+          if (spike_b) spike.store_spikes(spike_b + k, rem);
+          if (spike_f) VecF::blend(spike, zero, one).store(spike_f + k, rem);
+        }
+        if (HardReset) {
+          const uint64_t both = spike.bits() & guessed.bits() & lanes & ~done;
+          merged |= both;
+          done |= both;
+        } else {
+          // with the spikes equal so far the shift of the later steps is at most a^(t + 2) * |d|,
+          // which decays below the margin after a few steps of a leaky neuron
+          agree &= ~(spike.bits() ^ guessed.bits());
+          shift = shift * decay_step;
+          const uint64_t hold = agree & ~VecF::ge(shift + slack, vmargin).bits() & lanes & ~done;
+          closed |= hold;
+          done |= hold;
+        }
+      }
+      // closed lanes take the closed form, merged lanes the guessed end state, the rest ran through
+      v_end = VecF::blend(MaskF::from_bits(merged), VecF::blend(MaskF::from_bits(closed), vv, v_end), vspec);
+    }
+    if (rem == W) {
+      v_end.store(v + i);
+    } else {
+      v_end.store(v + i, rem);
+    }
+  }
+}
+
+template <NeuronMode Mode>
+void neuron_multistep_fixup_mode(const float *x, const float *v_in, const float *v_max, const float *v_margin, float *v,
+                                 bool *spike_b, float *spike_f, int64_t L, int64_t ld, int64_t n,
+                                 const NeuronParams &p) {
+  if (p.hard_reset) {
+    neuron_multistep_fixup_impl<Mode, true>(x, v_in, v_max, v_margin, v, spike_b, spike_f, L, ld, n, p);
+  } else {
+    neuron_multistep_fixup_impl<Mode, false>(x, v_in, v_max, v_margin, v, spike_b, spike_f, L, ld, n, p);
+  }
+}
+
+void neuron_multistep_fixup(const float *x, const float *v_in, const float *v_max, const float *v_margin, float *v,
+                            bool *spike_b, float *spike_f, int64_t L, int64_t ld, int64_t n, const NeuronParams &p) {
+  switch (p.mode) {
+    case NeuronMode::kIF:
+      neuron_multistep_fixup_mode<NeuronMode::kIF>(x, v_in, v_max, v_margin, v, spike_b, spike_f, L, ld, n, p); break;
+    case NeuronMode::kLIFDecayInputReset0:
+      neuron_multistep_fixup_mode<NeuronMode::kLIFDecayInputReset0>(x, v_in, v_max, v_margin, v, spike_b, spike_f, L, ld, n, p); break;
+    case NeuronMode::kLIFDecayInput:
+      neuron_multistep_fixup_mode<NeuronMode::kLIFDecayInput>(x, v_in, v_max, v_margin, v, spike_b, spike_f, L, ld, n, p); break;
+    case NeuronMode::kLIFNoDecayInputReset0:
+      neuron_multistep_fixup_mode<NeuronMode::kLIFNoDecayInputReset0>(x, v_in, v_max, v_margin, v, spike_b, spike_f, L, ld, n, p); break;
+    case NeuronMode::kLIFNoDecayInput:
+      neuron_multistep_fixup_mode<NeuronMode::kLIFNoDecayInput>(x, v_in, v_max, v_margin, v, spike_b, spike_f, L, ld, n, p); break;
+  }
+}
+
+/*
+ * Multi-step neuron backward. The same groups of 64 neurons are swept from step T - 1 down to 0 and
+ * the gradient of their potentials is carried in registers. With H the charged potential, S the
+ * spike and V the potential after the reset:
+ *   dL/dS = grad_spike + dL/dV * dV/dS      (dV/dS = v_reset - H, or -v_threshold; 0 if detached)
+ *   dL/dH = dL/dS * surrogate'(H - v_threshold) + dL/dV * dV/dH      (dV/dH = 1 - S, or 1)
+ * and dL/dH is passed to the input and to the previous potential through the charge equation.
+ */
+template <bool HardReset, Surrogate Kind>
+void neuron_multistep_backward_impl(const float *grad_spike, const float *grad_v, const float *v_seq,
+                                    float *grad_x, float *grad_v0, int64_t T, int64_t ld, int64_t n,
+                                    const NeuronParams &p, const NeuronGradParams &q) {
+  constexpr int kGroupVecs = 64 / W;
+  // dH/dx and dH/dv of the charge equation, all of them are linear
+  const bool input_decays = p.mode == NeuronMode::kLIFDecayInputReset0 || p.mode == NeuronMode::kLIFDecayInput;
+  const VecF dh_dx = VecF::set1(input_decays ? 1.f / p.tau : 1.f);
+  const VecF dh_dv = VecF::set1(p.mode == NeuronMode::kIF ? 1.f : p.decay);
+  const VecF v_threshold = VecF::set1(p.v_threshold);
+  const VecF v_reset = VecF::set1(p.v_reset);
+  // surrogate'(u) = scale * sg * (1 - sg) with sg = sigmoid(slope * u), or scale / (1 + (slope * u)^2)
+  const VecF scale = VecF::set1(Kind == Surrogate::kSigmoid ? q.alpha : q.alpha / 2.f);
+  const VecF slope = VecF::set1(Kind == Surrogate::kSigmoid ? q.alpha : 1.57079632679489662f * q.alpha);
+  const VecF one = VecF::set1(1.f);
+  const VecF zero = VecF::zero();
+  for (int64_t g = 0; g < n; g += 64) {
+    const int64_t len = n - g < 64 ? n - g : 64;
+    const int vecs = static_cast<int>((len + W - 1) / W);
+    VecF gv[kGroupVecs];
+    for (int j = 0; j < vecs; ++j) {
+      const int rem = static_cast<int>(len - j * W < W ? len - j * W : W);
+      if (grad_v) {
+        gv[j] = rem == W ? VecF::load(grad_v + g + j * W) : VecF::load(grad_v + g + j * W, rem);
+      } else {
+        gv[j] = zero;
+      }
+    }
+    for (int64_t t = T - 1; t >= 0; --t) {
+      const int64_t offset = t * ld + g;
+      for (int j = 0; j < vecs; ++j) {
+        const int rem = static_cast<int>(len - j * W < W ? len - j * W : W);
+        const int64_t i = offset + j * W;
+        VecF h = rem == W ? VecF::load(v_seq + i) : VecF::load(v_seq + i, rem);
+        VecF gs = rem == W ? VecF::load(grad_spike + i) : VecF::load(grad_spike + i, rem);
+        VecF u = slope * (h - v_threshold);
+        VecF sg;
+        if (Kind == Surrogate::kSigmoid) {
+          VecF s = one / (one + exp(zero - u));
+          sg = scale * s * (one - s);
+        } else {
+          sg = scale / (one + u * u);
+        }
+        VecF gh;
+        if (HardReset) {
+          if (!q.detach_reset) gs = gs + gv[j] * (v_reset - h);
+          gh = gs * sg + VecF::blend(VecF::ge(h, v_threshold), gv[j], zero);
+        } else {
+          if (!q.detach_reset) gs = gs - gv[j] * v_threshold;
+          gh = gs * sg + gv[j];
+        }
+        if (rem == W) {
+          (gh * dh_dx).store(grad_x + i);
+        } else {
+          (gh * dh_dx).store(grad_x + i, rem);
+        }
+        gv[j] = gh * dh_dv;
+      }
+    }
+    for (int j = 0; j < vecs; ++j) {
+      const int rem = static_cast<int>(len - j * W < W ? len - j * W : W);
+      if (rem == W) {
+        gv[j].store(grad_v0 + g + j * W);
+      } else {
+        gv[j].store(grad_v0 + g + j * W, rem);
+      }
+    }
+  }
+}
+
+template <bool HardReset>
+void neuron_multistep_backward_reset(const float *grad_spike, const float *grad_v, const float *v_seq,
+                                     float *grad_x, float *grad_v0, int64_t T, int64_t ld, int64_t n,
+                                     const NeuronParams &p, const NeuronGradParams &q) {
+  switch (q.surrogate) {
+    case Surrogate::kSigmoid:
+      neuron_multistep_backward_impl<HardReset, Surrogate::kSigmoid>(grad_spike, grad_v, v_seq, grad_x, grad_v0,
+                                                                     T, ld, n, p, q);
+      break;
+    case Surrogate::kATan:
+      neuron_multistep_backward_impl<HardReset, Surrogate::kATan>(grad_spike, grad_v, v_seq, grad_x, grad_v0,
+                                                                  T, ld, n, p, q);
+      break;
+  }
+}
+
+void neuron_multistep_backward(const float *grad_spike, const float *grad_v, const float *v_seq,
+                               float *grad_x, float *grad_v0, int64_t T, int64_t ld, int64_t n,
+                               const NeuronParams &p, const NeuronGradParams &q) {
+  if (p.hard_reset) {
+    neuron_multistep_backward_reset<true>(grad_spike, grad_v, v_seq, grad_x, grad_v0, T, ld, n, p, q);
+  } else {
+    neuron_multistep_backward_reset<false>(grad_spike, grad_v, v_seq, grad_x, grad_v0, T, ld, n, p, q);
+  }
+}
+
+/*
+ * Pooling. Max pooling of spikes is a logical OR, done separably: the kernel_h input rows of a
+ * window are OR-ed into a row buffer (a plain byte loop that the compiler vectorizes for the
+ * variant ISA), then every output pixel ORs kernel_w bytes of that buffer.
+ */
+void spike_max_pool2d(const bool *src, bool *dst, const Pool2dParams &p) {
+  bool *row = new bool[p.width > 0 ? p.width : 1];
+  for (int64_t oh = 0; oh < p.out_height; ++oh) {
+    int64_t h0 = oh * p.stride_h - p.pad_h;
+    int64_t h_begin = h0 < 0 ? 0 : h0;
+    int64_t h_end = h0 + p.kernel_h < p.height ? h0 + p.kernel_h : p.height;
+    for (int64_t w = 0; w < p.width; ++w) row[w] = false;
+    for (int64_t h = h_begin; h < h_end; ++h) {
+      const bool *s = src + h * p.width;
+      for (int64_t w = 0; w < p.width; ++w) row[w] = row[w] | s[w];
+    }
+    bool *d = dst + oh * p.out_width;
+    for (int64_t ow = 0; ow < p.out_width; ++ow) {
+      int64_t w0 = ow * p.stride_w - p.pad_w;
+      int64_t w_begin = w0 < 0 ? 0 : w0;
+      int64_t w_end = w0 + p.kernel_w < p.width ? w0 + p.kernel_w : p.width;
+      bool any = false;
+      for (int64_t w = w_begin; w < w_end; ++w) any = any | row[w];
+      d[ow] = any;
+    }
+  }
+  delete[] row;
+}
+
+} // namespace
+
+const KernelTable kKernelTable = {
+  SNNGROW_CPU_ISA,
+  SNNGROW_CPU_ISA_NAME,
+  spike_gemm_sd,
+  spike_gemm_ds,
+  spike_gemm_pd,
+  spike_gemm_csr,
+  spike_conv2d_csr,
+  ttfs_linear,
+  bit_indices,
+  pack_spikes,
+  unpack_spikes,
+  popcount,
+  transpose_bits,
+  first_spike,
+  bitwise_words,
+  reduce_words,
+  count_columns,
+  neuron_step,
+  neuron_event_step,
+  neuron_step_half,
+  neuron_step_channels,
+  neuron_multistep,
+  neuron_multistep_fixup,
+  neuron_multistep_backward,
+  spike_max_pool2d,
+};
+
+} // namespace SNNGROW_CPU_NS
+} // namespace cpu
+} // namespace snngrow
@@ -0,0 +1,48 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+
+/*! \file snngrow/snngrow_backend/spike_cpu/kernels_scalar.cpp
+    \brief Portable variant of the CPU spike kernels, always available.
+
+    Compiled with the baseline flags of the extension, so it is also the only variant on non-x86
+    hosts.
+*/
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "kernels.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define SNNGROW_CPU_NS scalar
+#define SNNGROW_CPU_ISA CpuIsa::kScalar
+#define SNNGROW_CPU_ISA_NAME "scalar"
+#include "kernels_impl.h"
+
+namespace snngrow {
+namespace cpu {
+namespace scalar {
+
+const KernelTable *kernel_table() { return &kKernelTable; }
+
+} // namespace scalar
+} // namespace cpu
+} // namespace snngrow
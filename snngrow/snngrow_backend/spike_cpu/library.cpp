@@ -0,0 +1,330 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+/*! \file snngrow/snngrow_backend/spike_cpu/library.cpp
+    \brief torch.library registration of the spike ops as torch.ops.snngrow.*.
+
+    Unlike the pybind entry points, custom ops are visible to the dispatcher, so torch.compile and
+    graph capture trace through them instead of breaking the graph. Fake (meta) kernels and the
+    autograd formulas are registered from python, see snngrow/base/library.py. CUDA kernels of the
+    same schemas are registered next to the CUDA pybind module.
+
+    It also registers the boxed fallback of the spike tensors (SpikeTensorImpl, see spike_tensor.h), so that
+    the ops on snngrow.base.SpikeTensor run on its bool spikes without coming back to python.
+*/
+#include <torch/library.h>
+
+#include <vector>
+
+#include "spike_ops.h"
+#include "spike_tensor.h"
+
+namespace {
+
+at::Tensor spike_gemm_op(const at::Tensor &tensor1, const at::Tensor &tensor2) {
+    return spike_gemm_cpu(tensor1.contiguous(), tensor2.contiguous());
+}
+
+at::Tensor pack_spikes_op(const at::Tensor &spikes) {
+    return pack_spikes_cpu(spikes.contiguous());
+}
+
+at::Tensor unpack_spikes_op(const at::Tensor &packed, int64_t n) {
+    return unpack_spikes_cpu(packed.contiguous(), n);
+}
+
+at::Tensor neuron_step_op(const at::Tensor &x, at::Tensor &v, int64_t mode, double tau,
+                          double v_threshold, c10::optional<double> v_reset, bool spike_out) {
+    return neuron_step_cpu(x, v, mode, tau, v_threshold, v_reset, spike_out);
+}
+
+at::Tensor neuron_multistep_op(const at::Tensor &x_seq, at::Tensor &v, int64_t mode, double tau,
+                               double v_threshold, c10::optional<double> v_reset, int64_t spike_format) {
+    return neuron_multistep_cpu(x_seq, v, mode, tau, v_threshold, v_reset, spike_format);
+}
+
+// Functional training form of neuron_multistep: v is not modified, the potential after the last step
+// is returned next to the spikes and the charged potentials v_seq that the backward needs. surrogate,
+// alpha and detach_reset are only read by the autograd formula.
+std::tuple<at::Tensor, at::Tensor, at::Tensor> neuron_multistep_train_op(
+        const at::Tensor &x_seq, const at::Tensor &v, int64_t mode, double tau, double v_threshold,
+        c10::optional<double> v_reset, int64_t surrogate, double alpha, bool detach_reset) {
+    auto v_out = v.contiguous().clone();
+    at::Tensor spike, v_seq;
+    std::tie(spike, v_seq) = neuron_multistep_train_cpu(x_seq, v_out, mode, tau, v_threshold, v_reset);
+    return std::make_tuple(spike, v_out, v_seq);
+}
+
+std::tuple<at::Tensor, at::Tensor> neuron_multistep_backward_op(
+        const at::Tensor &grad_spike, const c10::optional<at::Tensor> &grad_v, const at::Tensor &v_seq,
+        int64_t mode, double tau, double v_threshold, c10::optional<double> v_reset, int64_t surrogate,
+        double alpha, bool detach_reset) {
+    return neuron_multistep_backward_cpu(grad_spike, grad_v, v_seq, mode, tau, v_threshold, v_reset, surrogate,
+                                         alpha, detach_reset);
+}
+
+at::Tensor spike_gemm(const at::Tensor &tensor1, const at::Tensor &tensor2) {
+    // through the dispatcher, spike tensors may live on CUDA
+    static auto op = c10::Dispatcher::singleton()
+                         .findSchemaOrThrow("snngrow::spike_gemm", "")
+                         .typed<at::Tensor(const at::Tensor &, const at::Tensor &)>();
+    return op.call(tensor1, tensor2);
+}
+
+// Spike tensors. The fallback runs an op on the bool spikes of its spike tensor arguments and wraps the
+// results again: bool results (views, joins, logic) are spikes as they are, dense ones are thresholded at 0
+// as in SpikeTensor.from_dense, and results written to an argument (in-place and out= ops) are that
+// argument. mm / bmm / addmm of spikes and a float32 operand run on the spike GEMM and return the dense
+// product, they fall back to float spikes otherwise. mul of two spike tensors is their logical and, mul
+// with a dense operand keeps it where a spike fired.
+
+struct SpikeTensorOps {
+    c10::OperatorHandle mm = c10::Dispatcher::singleton().findSchemaOrThrow("aten::mm", "");
+    c10::OperatorHandle bmm = c10::Dispatcher::singleton().findSchemaOrThrow("aten::bmm", "");
+    c10::OperatorHandle addmm = c10::Dispatcher::singleton().findSchemaOrThrow("aten::addmm", "");
+    c10::OperatorHandle mul = c10::Dispatcher::singleton().findSchemaOrThrow("aten::mul", "Tensor");
+};
+
+const SpikeTensorOps &spike_tensor_ops() {
+    static const SpikeTensorOps ops;
+    return ops;
+}
+
+const at::Tensor &spikes_or_tensor(const at::Tensor &tensor) {
+    auto *impl = spike_tensor_impl(tensor);
+    return impl ? impl->elem() : tensor;
+}
+
+// a @ b of a spike tensor and a float32 tensor on the same device, undefined when the spike GEMM does
+// not apply.
+at::Tensor spike_mm(const at::Tensor &a, const at::Tensor &b) {
+    const bool a_spikes = is_spike_tensor(a);
+    const auto &dense = a_spikes ? b : a;
+    if (a_spikes == is_spike_tensor(b) || dense.scalar_type() != at::kFloat || a.device() != b.device() ||
+        a.dim() != 2 || b.dim() != 2 || (!a.device().is_cpu() && !a.is_cuda())) {
+        return {};
+    }
+    return spike_gemm(spikes_or_tensor(a).contiguous(), spikes_or_tensor(b).contiguous());
+}
+
+// Batched a @ b of [B, M, K] and [B, K, N] operands, all batches run as one grouped CPU GEMM.
+at::Tensor spike_bmm(const at::Tensor &a, const at::Tensor &b) {
+    const bool a_spikes = is_spike_tensor(a);
+    const auto &dense = a_spikes ? b : a;
+    if (a_spikes == is_spike_tensor(b) || dense.scalar_type() != at::kFloat || !a.device().is_cpu() ||
+        b.device() != a.device() || a.dim() != 3 || b.dim() != 3) {
+        return {};
+    }
+    auto out = at::empty({a.size(0), a.size(1), b.size(2)}, dense.options());
+    // every batch writes its slice of out in place
+    auto slices = out.unbind(0);
+    spike_gemm_grouped_cpu(spikes_or_tensor(a).contiguous().unbind(0), spikes_or_tensor(b).contiguous().unbind(0),
+                           std::vector<c10::optional<at::Tensor>>(slices.begin(), slices.end()));
+    return out;
+}
+
+// Runs mm / bmm / addmm on the spike GEMM, false when it does not apply.
+bool spike_matmul(const c10::OperatorHandle &op, torch::jit::Stack &stack) {
+    const auto &ops = spike_tensor_ops();
+    at::Tensor out;
+    if (op == ops.mm || op == ops.bmm) {
+        const auto &a = torch::jit::peek(stack, 0, 2).toTensor();
+        const auto &b = torch::jit::peek(stack, 1, 2).toTensor();
+        out = op == ops.mm ? spike_mm(a, b) : spike_bmm(a, b);
+        if (!out.defined()) {
+            return false;
+        }
+        torch::jit::drop(stack, 2);
+    } else {
+        // addmm(bias, mat1, mat2, *, beta, alpha) = beta * bias + alpha * mat1 @ mat2
+        out = spike_mm(torch::jit::peek(stack, 1, 5).toTensor(), torch::jit::peek(stack, 2, 5).toTensor());
+        if (!out.defined()) {
+            return false;
+        }
+        auto bias = torch::jit::peek(stack, 0, 5).toTensor();
+        const auto beta = torch::jit::peek(stack, 3, 5).toScalar();
+        const auto alpha = torch::jit::peek(stack, 4, 5).toScalar();
+        if (is_spike_tensor(bias)) {
+            bias = spikes_or_tensor(bias).to(out.scalar_type());
+        }
+        if (alpha.toDouble() != 1) {
+            out.mul_(alpha);
+        }
+        if (beta.toDouble() != 0) {
+            out.add_(bias, beta);
+        }
+        torch::jit::drop(stack, 5);
+    }
+    torch::jit::push(stack, std::move(out));
+    return true;
+}
+
+void spike_mul(torch::jit::Stack &stack) {
+    auto other = torch::jit::pop(stack).toTensor();
+    auto self = torch::jit::pop(stack).toTensor();
+    at::Tensor out;
+    if (is_spike_tensor(self) && is_spike_tensor(other)) {
+        out = make_spike_tensor(spikes_or_tensor(self) & spikes_or_tensor(other));
+    } else {
+        const auto &spikes = spikes_or_tensor(is_spike_tensor(self) ? self : other);
+        auto dense = is_spike_tensor(self) ? other : self;
+        dense = dense.to(c10::promoteTypes(at::kFloat, dense.scalar_type()));
+        out = at::where(spikes, dense, at::zeros({}, dense.options()));
+    }
+    torch::jit::push(stack, std::move(out));
+}
+
+// Replaces the spike tensors among the last num_arguments values of the stack by convert(spikes). Lists
+// are rebuilt, they may be shared with the caller.
+template <typename Convert>
+void unwrap_spike_arguments(torch::jit::Stack &stack, size_t num_arguments, const Convert &convert) {
+    for (auto it = stack.end() - num_arguments; it != stack.end(); ++it) {
+        if (it->isTensor()) {
+            if (is_spike_tensor(it->toTensor())) {
+                *it = convert(spikes_or_tensor(it->toTensor()));
+            }
+        } else if (it->isTensorList()) {
+            auto list = it->toTensorList();
+            c10::List<at::Tensor> tensors;
+            tensors.reserve(list.size());
+            for (size_t i = 0; i < list.size(); ++i) {
+                at::Tensor tensor = list.get(i);
+                tensors.push_back(is_spike_tensor(tensor) ? convert(spikes_or_tensor(tensor)) : tensor);
+            }
+            *it = std::move(tensors);
+        } else if (it->isOptionalTensorList()) {
+            // the indices of index / index_put
+            auto list = it->toOptionalTensorList();
+            c10::List<c10::optional<at::Tensor>> tensors;
+            tensors.reserve(list.size());
+            for (size_t i = 0; i < list.size(); ++i) {
+                c10::optional<at::Tensor> tensor = list.get(i);
+                if (tensor.has_value() && is_spike_tensor(*tensor)) {
+                    tensor = convert(spikes_or_tensor(*tensor));
+                }
+                tensors.push_back(std::move(tensor));
+            }
+            *it = std::move(tensors);
+        }
+    }
+}
+
+at::Tensor as_spike_tensor(const at::Tensor &tensor) {
+    if (!tensor.defined() || is_spike_tensor(tensor)) {
+        return tensor;
+    }
+    return make_spike_tensor(tensor.scalar_type() == at::kBool ? tensor : tensor.ge(0));
+}
+
+void spike_tensor_fallback(const c10::OperatorHandle &op, torch::jit::Stack *stack) {
+    const auto &ops = spike_tensor_ops();
+    if (op == ops.mul) {
+        spike_mul(*stack);
+        return;
+    }
+    const auto &schema = op.schema();
+    const size_t num_arguments = schema.arguments().size();
+    if (op == ops.mm || op == ops.bmm || op == ops.addmm) {
+        if (!spike_matmul(op, *stack)) {
+            unwrap_spike_arguments(*stack, num_arguments, [](const at::Tensor &spikes) {
+                return spikes.to(at::kFloat);
+            });
+            op.callBoxed(stack);
+        }
+        return;
+    }
+
+    // the arguments that in-place and out= results alias
+    std::vector<c10::IValue> arguments;
+    if (schema.is_mutable()) {
+        arguments.assign(stack->end() - num_arguments, stack->end());
+    }
+    unwrap_spike_arguments(*stack, num_arguments, [](const at::Tensor &spikes) { return spikes; });
+    op.callBoxed(stack);
+
+    const auto &returns = schema.returns();
+    for (size_t i = 0; i < returns.size(); ++i) {
+        auto &value = (*stack)[stack->size() - returns.size() + i];
+        const auto *alias = returns[i].alias_info();
+        size_t written = num_arguments;
+        if (alias != nullptr && alias->isWrite()) {
+            for (written = 0; written < num_arguments; ++written) {
+                const auto *argument_alias = schema.arguments()[written].alias_info();
+                if (argument_alias != nullptr && *argument_alias == *alias) {
+                    break;
+                }
+            }
+        }
+        if (written < num_arguments) {
+            value = arguments[written];
+            if (auto *impl = value.isTensor() ? spike_tensor_impl(value.toTensor()) : nullptr) {
+                impl->refresh_sizes();
+            }
+        } else if (value.isTensor()) {
+            value = as_spike_tensor(value.toTensor());
+        } else if (value.isTensorList()) {
+            auto list = value.toTensorList();
+            c10::List<at::Tensor> tensors;
+            tensors.reserve(list.size());
+            for (size_t j = 0; j < list.size(); ++j) {
+                tensors.push_back(as_spike_tensor(list.get(j)));
+            }
+            value = std::move(tensors);
+        }
+    }
+}
+
+} // namespace
+
+TORCH_LIBRARY(snngrow, m) {
+    m.def("spike_gemm(Tensor tensor1, Tensor tensor2) -> Tensor");
+    m.def("pack_spikes(Tensor spikes) -> Tensor");
+    m.def("unpack_spikes(Tensor packed, int n) -> Tensor");
+    // v is the membrane potential, updated in place; torch.compile functionalizes the mutation
+    m.def("neuron_step(Tensor x, Tensor(a!) v, int mode, float tau, float v_threshold, "
+          "float? v_reset, bool spike_out) -> Tensor");
+    m.def("neuron_multistep(Tensor x_seq, Tensor(a!) v, int mode, float tau, float v_threshold, "
+          "float? v_reset, int spike_format) -> Tensor");
+    // differentiable form of neuron_multistep for training, returns (spike, v, v_seq)
+    m.def("neuron_multistep_train(Tensor x_seq, Tensor v, int mode, float tau, float v_threshold, "
+          "float? v_reset, int surrogate, float alpha, bool detach_reset) -> (Tensor, Tensor, Tensor)");
+    m.def("neuron_multistep_backward(Tensor grad_spike, Tensor? grad_v, Tensor v_seq, int mode, float tau, "
+          "float v_threshold, float? v_reset, int surrogate, float alpha, bool detach_reset) -> (Tensor, Tensor)");
+}
+
+TORCH_LIBRARY_IMPL(snngrow, CPU, m) {
+    m.impl("spike_gemm", &spike_gemm_op);
+    m.impl("pack_spikes", &pack_spikes_op);
+    m.impl("unpack_spikes", &unpack_spikes_op);
+    m.impl("neuron_step", &neuron_step_op);
+    m.impl("neuron_multistep", &neuron_multistep_op);
+    m.impl("neuron_multistep_train", &neuron_multistep_train_op);
+    m.impl("neuron_multistep_backward", &neuron_multistep_backward_op);
+}
+
+TORCH_LIBRARY_IMPL(_, PrivateUse3, m) {
+    m.fallback(torch::CppFunction::makeFromBoxedFunction<&spike_tensor_fallback>());
+}
+
+// The CompositeExplicitAutograd kernels of these ops would run on the spike tensor itself and read its
+// storage, which it does not have. The other composite kernels either build on ops that reach the fallback,
+// e.g. the views on as_strided, or make dense float32 results, as the factories *_like and new_*.
+TORCH_LIBRARY_IMPL(aten, PrivateUse3, m) {
+    for (const char *name : {"alias", "as_strided_", "clone", "copy_", "_to_copy", "_unsafe_view"}) {
+        m.impl(name, torch::CppFunction::makeFromBoxedFunction<&spike_tensor_fallback>());
+    }
+}
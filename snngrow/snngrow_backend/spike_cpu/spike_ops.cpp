@@ -0,0 +1,1217 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+/*! \file snngrow/snngrow_backend/spike_cpu/spike_ops.cpp
+    \brief ATen entry points of the CPU spike kernels.
+
+    The functions in here check and shape the tensors, split the work with at::parallel_for and call
+    the kernel table of the active ISA variant.
+*/
+#include <ATen/Parallel.h>
+#include <c10/util/accumulate.h>
+#include <torch/extension.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "isa.h"
+#include "spike_ops.h"
+#include "spike_tensor.h"
+
+using snngrow::cpu::kernels;
+
+namespace {
+
+void check_cpu(const at::Tensor &tensor, const char *name) {
+    TORCH_CHECK(tensor.device().is_cpu(), name, " must be a CPU tensor");
+}
+
+/// Rows per task for kernels that do `work_per_row` elementary operations per row.
+int64_t row_grain(int64_t work_per_row) {
+    return std::max<int64_t>(1, at::internal::GRAIN_SIZE / std::max<int64_t>(1, work_per_row));
+}
+
+uint64_t *words_ptr(const at::Tensor &packed) {
+    return reinterpret_cast<uint64_t *>(packed.data_ptr<int64_t>());
+}
+
+/// Shared checks of the spike GEMM entry points: a [*, K] and a [K, N] operand on the CPU, one of
+/// them bool spikes and the other float32.
+void check_gemm_operands(const at::Tensor &tensor1, const at::Tensor &tensor2, const char *name) {
+    // Check if the input tensors are on the same device
+    if (tensor1.device() != tensor2.device()) {
+        AT_ERROR("Input tensors must be on the same device");
+    }
+    check_cpu(tensor1, "tensor1");
+
+    // Check if the input tensors are contiguous
+    if (!tensor1.is_contiguous() || !tensor2.is_contiguous()) {
+        AT_ERROR("Input tensors must be contiguous");
+    }
+
+    TORCH_CHECK(tensor1.dim() >= 2 && tensor2.dim() == 2,
+        name, "(): expected a [*, K] and a [K, N] operand, but got shapes ",
+        tensor1.sizes(), " and ", tensor2.sizes());
+    TORCH_CHECK(tensor1.scalar_type() == at::kBool
+                    ? tensor2.scalar_type() == at::kFloat
+                    : tensor1.scalar_type() == at::kFloat && tensor2.scalar_type() == at::kBool,
+        name, "(): expected one bool and one float32 operand, but got ",
+        tensor1.scalar_type(), " and ", tensor2.scalar_type());
+    TORCH_CHECK(tensor2.size(0) == tensor1.size(-1), "matmul(): shapes ", tensor1.sizes(), " and ",
+        tensor2.sizes(), " cannot be multiplied");
+}
+
+/// Index array of a gathered / scattered GEMM, checked against the number of rows it addresses.
+at::Tensor check_rows(const c10::optional<at::Tensor> &rows, int64_t limit, const char *name) {
+    if (!rows.has_value() || !rows->defined()) {
+        return at::Tensor();
+    }
+    check_cpu(*rows, name);
+    TORCH_CHECK(rows->scalar_type() == at::kLong && rows->dim() == 1,
+        name, " must be a 1D int64 tensor");
+    auto index = rows->contiguous();
+    const int64_t *ptr = index.data_ptr<int64_t>();
+    for (int64_t i = 0; i < index.numel(); ++i) {
+        TORCH_CHECK(ptr[i] >= 0 && ptr[i] < limit, name, "[", i, "] = ", ptr[i],
+            " is out of range for ", limit, " rows");
+    }
+    return index;
+}
+
+/// check_rows for indices that are written, a repeated index would be written by several threads.
+at::Tensor check_unique_rows(const c10::optional<at::Tensor> &rows, int64_t limit, const char *name) {
+    auto index = check_rows(rows, limit, name);
+    if (!index.defined()) {
+        return index;
+    }
+    const int64_t *ptr = index.data_ptr<int64_t>();
+    std::vector<int64_t> sorted(ptr, ptr + index.numel());
+    std::sort(sorted.begin(), sorted.end());
+    auto repeated = std::adjacent_find(sorted.begin(), sorted.end());
+    TORCH_CHECK(repeated == sorted.end(), name, " must not contain duplicates, but ", *repeated,
+        " appears more than once");
+    return index;
+}
+
+/// Rows [0, M) of tensor1 @ tensor2 into C with the kernels of the active ISA.
+void launch_spike_gemm(const at::Tensor &tensor1, const at::Tensor &tensor2, float *C, int64_t ldc,
+                       int64_t M, const snngrow::cpu::GemmAddressing &addr) {
+    const int64_t K = tensor1.size(-1);
+    const int64_t N = tensor2.size(1);
+    if (M == 0 || N == 0) {
+        return;
+    }
+
+    const auto &k = kernels();
+    if (tensor1.scalar_type() == at::kBool) {
+        const bool *A = tensor1.data_ptr<bool>();
+        const float *B = tensor2.data_ptr<float>();
+        at::parallel_for(0, M, row_grain(N * K / 4), [&](int64_t begin, int64_t end) {
+            k.spike_gemm_sd(A, K, B, N, C, ldc, begin, end, N, K, addr);
+        });
+    } else {
+        const float *A = tensor1.data_ptr<float>();
+        const bool *B = tensor2.data_ptr<bool>();
+        at::parallel_for(0, M, row_grain(N * K), [&](int64_t begin, int64_t end) {
+            k.spike_gemm_ds(A, K, B, N, C, ldc, begin, end, N, K, addr);
+        });
+    }
+}
+
+/// CSR spikes with rows rows and cols columns: crow [rows + 1] is non-decreasing from 0 to nnz and
+/// every column index of col [nnz] is in range. The kernels index with them unchecked.
+void check_csr(const at::Tensor &crow, const at::Tensor &col, int64_t rows, int64_t cols,
+               const char *name) {
+    check_cpu(crow, "crow");
+    check_cpu(col, "col");
+    TORCH_CHECK(crow.scalar_type() == at::kLong && crow.dim() == 1 &&
+                col.scalar_type() == at::kLong && col.dim() == 1 &&
+                crow.is_contiguous() && col.is_contiguous(),
+        name, "(): expected contiguous 1D int64 crow and col indices");
+    TORCH_CHECK(crow.numel() == rows + 1, name, "(): expected ", rows + 1,
+        " row offsets, but got ", crow.numel());
+    const int64_t *offsets = crow.data_ptr<int64_t>();
+    TORCH_CHECK(offsets[0] == 0 && offsets[rows] == col.numel(), name,
+        "(): row offsets must run from 0 to the number of events ", col.numel());
+    for (int64_t r = 0; r < rows; ++r) {
+        TORCH_CHECK(offsets[r] <= offsets[r + 1], name, "(): row offsets must be non-decreasing");
+    }
+    const int64_t *index = col.data_ptr<int64_t>();
+    for (int64_t e = 0; e < col.numel(); ++e) {
+        TORCH_CHECK(index[e] >= 0 && index[e] < cols, name, "(): column index ", index[e],
+            " is out of range for ", cols, " columns");
+    }
+}
+
+/// One problem of a grouped spike GEMM, the operands are checked and the output allocated.
+struct GroupedGemmProblem {
+    const void *A;
+    const void *B;
+    float *C;
+    int64_t M, N, K;
+    bool spikes_a;
+};
+
+/// A range of rows of one grouped problem, the unit that is scheduled on the thread pool.
+struct GroupedGemmTile {
+    int64_t problem;
+    int64_t m_begin, m_end;
+};
+
+/// Neuron parameters of the IF / LIF ops, mode is a NeuronMode.
+snngrow::cpu::NeuronParams neuron_params(int64_t mode, double tau, double v_threshold,
+                                         c10::optional<double> v_reset, const char *name) {
+    TORCH_CHECK(mode >= 0 && mode <= static_cast<int64_t>(snngrow::cpu::NeuronMode::kLIFNoDecayInput),
+        name, "(): unknown neuron mode ", mode);
+    snngrow::cpu::NeuronParams params;
+    params.mode = static_cast<snngrow::cpu::NeuronMode>(mode);
+    params.tau = static_cast<float>(tau);
+    params.decay = static_cast<float>(1. - 1. / tau);
+    params.v_threshold = static_cast<float>(v_threshold);
+    params.v_reset = static_cast<float>(v_reset.value_or(0.));
+    params.hard_reset = v_reset.has_value();
+    return params;
+}
+
+} // namespace
+
+at::Tensor spike_gemm_cpu(at::Tensor tensor1, at::Tensor tensor2) {
+    check_gemm_operands(tensor1, tensor2, "spike_gemm_cpu");
+    const auto spike_mul_dense = (tensor1.scalar_type() == at::kBool);
+
+    // Leading dimensions of tensor1 are folded into the rows, this is a view since it is contiguous
+    auto output_shape = at::DimVector(tensor1.sizes().begin(), tensor1.sizes().end() - 1);
+    const int64_t M = c10::multiply_integers(output_shape);
+    output_shape.push_back(tensor2.size(1));
+    auto out = at::empty(output_shape, (spike_mul_dense ? tensor2 : tensor1).options());
+
+    launch_spike_gemm(tensor1, tensor2, out.data_ptr<float>(), tensor2.size(1), M, {nullptr, nullptr});
+    return out;
+}
+
+at::Tensor spike_gemm_packed_cpu(at::Tensor packed, at::Tensor tensor2) {
+    check_cpu(packed, "packed");
+    check_cpu(tensor2, "tensor2");
+    TORCH_CHECK(packed.scalar_type() == at::kLong && packed.dim() >= 1 &&
+                tensor2.scalar_type() == at::kFloat && tensor2.dim() == 2,
+        "spike_gemm_packed_cpu(): expected packed [*, words] spikes and a float32 [K, N] operand");
+    const int64_t K = tensor2.size(0);
+    const int64_t N = tensor2.size(1);
+    const int64_t words = (K + 63) / 64;
+    TORCH_CHECK(packed.size(-1) == words, "spike_gemm_packed_cpu(): ", K, " spikes need ", words,
+        " words per row, but got ", packed.size(-1));
+    auto A = packed.contiguous();
+    auto B = tensor2.contiguous();
+
+    auto output_shape = at::DimVector(A.sizes().begin(), A.sizes().end() - 1);
+    const int64_t M = c10::multiply_integers(output_shape);
+    output_shape.push_back(N);
+    auto out = at::empty(output_shape, B.options());
+    if (M == 0 || N == 0) {
+        return out;
+    }
+
+    const auto &k = kernels();
+    const uint64_t *a = words_ptr(A);
+    const float *b = B.data_ptr<float>();
+    float *c = out.data_ptr<float>();
+    at::parallel_for(0, M, row_grain(N * K / 4), [&](int64_t begin, int64_t end) {
+        k.spike_gemm_pd(a, words, b, N, c, N, begin, end, N, K);
+    });
+    return out;
+}
+
+at::Tensor spike_gemm_csr_cpu(at::Tensor crow, at::Tensor col, at::Tensor tensor2) {
+    check_cpu(tensor2, "tensor2");
+    TORCH_CHECK(tensor2.scalar_type() == at::kFloat && tensor2.dim() == 2,
+        "spike_gemm_csr_cpu(): expected a float32 [K, N] operand");
+    const int64_t K = tensor2.size(0);
+    const int64_t N = tensor2.size(1);
+    const int64_t M = crow.numel() - 1;
+    TORCH_CHECK(M >= 0, "spike_gemm_csr_cpu(): crow must hold at least one offset");
+    check_csr(crow, col, M, K, "spike_gemm_csr_cpu");
+    auto B = tensor2.contiguous();
+    auto out = at::empty({M, N}, B.options());
+    if (M == 0 || N == 0) {
+        return out;
+    }
+
+    const auto &k = kernels();
+    const int64_t *offsets = crow.data_ptr<int64_t>();
+    const int64_t *index = col.data_ptr<int64_t>();
+    const float *b = B.data_ptr<float>();
+    float *c = out.data_ptr<float>();
+    // balance on events rather than rows, the cost of a row is its event count
+    const int64_t events_per_row = std::max<int64_t>(1, col.numel() / M);
+    at::parallel_for(0, M, row_grain(N * events_per_row), [&](int64_t begin, int64_t end) {
+        k.spike_gemm_csr(offsets, index, b, N, c, N, begin, end, N);
+    });
+    return out;
+}
+
+at::Tensor spike_conv2d_csr_cpu(at::Tensor crow, at::Tensor col, at::Tensor weight,
+                                int64_t batch, int64_t height, int64_t width,
+                                std::vector<int64_t> stride, std::vector<int64_t> padding) {
+    check_cpu(weight, "weight");
+    TORCH_CHECK(weight.scalar_type() == at::kFloat && weight.dim() == 4,
+        "spike_conv2d_csr_cpu(): expected a float32 [out_channels, channels, kh, kw] weight");
+    TORCH_CHECK(stride.size() == 1 || stride.size() == 2,
+        "spike_conv2d_csr_cpu(): stride must be an int or a pair of ints");
+    TORCH_CHECK(padding.size() == 1 || padding.size() == 2,
+        "spike_conv2d_csr_cpu(): padding must be an int or a pair of ints");
+
+    snngrow::cpu::Conv2dParams params;
+    params.out_channels = weight.size(0);
+    params.channels = weight.size(1);
+    params.kernel_h = weight.size(2);
+    params.kernel_w = weight.size(3);
+    params.height = height;
+    params.width = width;
+    params.stride_h = stride.front();
+    params.stride_w = stride.back();
+    params.pad_h = padding.front();
+    params.pad_w = padding.back();
+    TORCH_CHECK(params.stride_h > 0 && params.stride_w > 0 && params.pad_h >= 0 && params.pad_w >= 0,
+        "spike_conv2d_csr_cpu(): stride must be positive and padding non-negative");
+    TORCH_CHECK(batch >= 0 && height >= 0 && width >= 0,
+        "spike_conv2d_csr_cpu(): invalid input shape");
+    params.out_height = (height + 2 * params.pad_h - params.kernel_h) / params.stride_h + 1;
+    params.out_width = (width + 2 * params.pad_w - params.kernel_w) / params.stride_w + 1;
+    TORCH_CHECK(params.out_height > 0 && params.out_width > 0,
+        "spike_conv2d_csr_cpu(): input of shape [", height, ", ", width, "] is too small for the kernel");
+    const int64_t rows_per_sample = params.channels * height;
+    check_csr(crow, col, batch * rows_per_sample, width, "spike_conv2d_csr_cpu");
+
+    // [C, kh, kw, O] so that an event adds contiguous rows of out_channels weights
+    auto w = weight.permute({1, 2, 3, 0}).contiguous();
+    auto out = at::zeros({batch, params.out_height, params.out_width, params.out_channels}, w.options());
+    if (batch == 0 || params.out_channels == 0) {
+        return out.permute({0, 3, 1, 2});
+    }
+
+    const auto &k = kernels();
+    const int64_t *offsets = crow.data_ptr<int64_t>();
+    const int64_t *index = col.data_ptr<int64_t>();
+    const float *w_ptr = w.data_ptr<float>();
+    float *dst = out.data_ptr<float>();
+    const int64_t out_sample = params.out_height * params.out_width * params.out_channels;
+    const int64_t events_per_sample = std::max<int64_t>(1, col.numel() / batch);
+    const int64_t work = events_per_sample * params.kernel_h * params.kernel_w * params.out_channels;
+    // every task owns whole samples, so the scattered additions never collide
+    at::parallel_for(0, batch, row_grain(work), [&](int64_t begin, int64_t end) {
+        for (int64_t n = begin; n < end; ++n) {
+            k.spike_conv2d_csr(offsets + n * rows_per_sample, index, w_ptr, dst + n * out_sample, params);
+        }
+    });
+    // NCHW view of the channels-last result
+    return out.permute({0, 3, 1, 2});
+}
+
+at::Tensor ttfs_linear_cpu(at::Tensor times, at::Tensor weight_t, c10::optional<at::Tensor> bias,
+                           double threshold, int64_t T) {
+    check_cpu(times, "times");
+    check_cpu(weight_t, "weight_t");
+    TORCH_CHECK(times.scalar_type() == at::kByte && times.dim() >= 1,
+        "ttfs_linear_cpu(): expected uint8 [*, K] spike times");
+    TORCH_CHECK(weight_t.scalar_type() == at::kFloat && weight_t.dim() == 2 && weight_t.size(0) == times.size(-1),
+        "ttfs_linear_cpu(): expected a float32 [K, N] weight for ", times.size(-1), " inputs, but got ",
+        weight_t.sizes());
+    TORCH_CHECK(T >= 0 && T <= snngrow::cpu::kNeverFires,
+        "ttfs_linear_cpu(): spike times are uint8, T must be at most ", int(snngrow::cpu::kNeverFires));
+    const int64_t K = weight_t.size(0);
+    const int64_t N = weight_t.size(1);
+    at::Tensor b;
+    if (bias.has_value() && bias->defined()) {
+        check_cpu(*bias, "bias");
+        TORCH_CHECK(bias->scalar_type() == at::kFloat && bias->numel() == N,
+            "ttfs_linear_cpu(): expected a float32 bias of ", N, " elements");
+        b = bias->contiguous();
+    }
+    TORCH_CHECK(N <= std::numeric_limits<int32_t>::max() && K <= std::numeric_limits<int32_t>::max(),
+        "ttfs_linear_cpu(): layer is too large");
+
+    auto input = times.contiguous();
+    auto W = weight_t.contiguous();
+    auto output_shape = at::DimVector(input.sizes().begin(), input.sizes().end() - 1);
+    const int64_t M = c10::multiply_integers(output_shape);
+    output_shape.push_back(N);
+    auto out = at::empty(output_shape, input.options());
+    if (M == 0 || N == 0) {
+        return out;
+    }
+
+    const auto &k = kernels();
+    const uint8_t *src = input.data_ptr<uint8_t>();
+    const float *w = W.data_ptr<float>();
+    const float *b_ptr = b.defined() ? b.data_ptr<float>() : nullptr;
+    uint8_t *dst = out.data_ptr<uint8_t>();
+    at::parallel_for(0, M, row_grain(N * K / 4), [&](int64_t begin, int64_t end) {
+        auto v = at::empty({N}, W.options());
+        auto order = at::empty({std::max<int64_t>(K, 1)}, W.options().dtype(at::kInt));
+        for (int64_t m = begin; m < end; ++m) {
+            k.ttfs_linear(src + m * K, K, w, N, b_ptr, static_cast<float>(threshold), T, N,
+                          v.data_ptr<float>(), order.data_ptr<int32_t>(), dst + m * N);
+        }
+    });
+    return out;
+}
+
+std::tuple<at::Tensor, at::Tensor> spike_csr_from_packed_cpu(at::Tensor packed) {
+    check_cpu(packed, "packed");
+    TORCH_CHECK(packed.scalar_type() == at::kLong && packed.dim() >= 1,
+        "spike_csr_from_packed_cpu(): expected an int64 tensor of packed words");
+    auto input = packed.contiguous();
+    const int64_t words = input.size(-1);
+    const int64_t rows = c10::multiply_integers(input.sizes().begin(), input.sizes().end() - 1);
+    auto crow = at::empty({rows + 1}, input.options());
+    int64_t *offsets = crow.data_ptr<int64_t>();
+    offsets[0] = 0;
+
+    const auto &k = kernels();
+    const uint64_t *src = words_ptr(input);
+    at::parallel_for(0, rows, row_grain(words * 64), [&](int64_t begin, int64_t end) {
+        for (int64_t r = begin; r < end; ++r) {
+            offsets[r + 1] = k.popcount(src + r * words, words);
+        }
+    });
+    for (int64_t r = 0; r < rows; ++r) {
+        offsets[r + 1] += offsets[r];
+    }
+
+    auto col = at::empty({offsets[rows]}, input.options());
+    int64_t *index = col.data_ptr<int64_t>();
+    at::parallel_for(0, rows, row_grain(words * 64), [&](int64_t begin, int64_t end) {
+        for (int64_t r = begin; r < end; ++r) {
+            k.bit_indices(src + r * words, words, index + offsets[r]);
+        }
+    });
+    return std::make_tuple(crow, col);
+}
+
+at::Tensor spike_gemm_gather_cpu(at::Tensor tensor1, at::Tensor tensor2,
+                                 c10::optional<at::Tensor> a_rows,
+                                 c10::optional<at::Tensor> out,
+                                 c10::optional<at::Tensor> out_rows) {
+    check_gemm_operands(tensor1, tensor2, "spike_gemm_gather_cpu");
+    TORCH_CHECK(tensor1.dim() == 2, "spike_gemm_gather_cpu(): expected a 2D first operand, but got shape ",
+        tensor1.sizes());
+    const int64_t N = tensor2.size(1);
+    auto a_index = check_rows(a_rows, tensor1.size(0), "a_rows");
+    const int64_t M = a_index.defined() ? a_index.numel() : tensor1.size(0);
+    const bool scatter = out_rows.has_value() && out_rows->defined();
+
+    at::Tensor result;
+    if (out.has_value() && out->defined()) {
+        result = *out;
+        check_cpu(result, "out");
+        TORCH_CHECK(result.scalar_type() == at::kFloat && result.dim() == 2 && result.size(1) == N &&
+                    result.stride(1) == 1,
+            "spike_gemm_gather_cpu(): out must be a float32 [rows, ", N, "] tensor with contiguous rows");
+    } else {
+        // unselected rows of a full-size output are zero
+        result = at::zeros({scatter ? tensor1.size(0) : M, N},
+                           (tensor1.scalar_type() == at::kBool ? tensor2 : tensor1).options());
+    }
+    auto c_index = check_unique_rows(out_rows, result.size(0), "out_rows");
+    TORCH_CHECK(scatter ? c_index.numel() == M : result.size(0) == M,
+        "spike_gemm_gather_cpu(): ", M, " selected rows do not match the ",
+        scatter ? c_index.numel() : result.size(0), " output rows");
+
+    snngrow::cpu::GemmAddressing addr{};
+    addr.a_rows = a_index.defined() ? a_index.data_ptr<int64_t>() : nullptr;
+    addr.c_rows = scatter ? c_index.data_ptr<int64_t>() : nullptr;
+    launch_spike_gemm(tensor1, tensor2, result.data_ptr<float>(), result.stride(0), M, addr);
+    return result;
+}
+
+std::vector<at::Tensor> spike_gemm_grouped_cpu(std::vector<at::Tensor> tensor1s,
+                                               std::vector<at::Tensor> tensor2s,
+                                               std::vector<c10::optional<at::Tensor>> outs) {
+    TORCH_CHECK(tensor1s.size() == tensor2s.size() && (outs.empty() || outs.size() == tensor1s.size()),
+        "spike_gemm_grouped_cpu(): got ", tensor1s.size(), " first operands, ", tensor2s.size(),
+        " second operands and ", outs.size(), " outputs");
+
+    std::vector<at::Tensor> results;
+    std::vector<GroupedGemmProblem> problems;
+    std::vector<GroupedGemmTile> tiles;
+    results.reserve(tensor1s.size());
+    problems.reserve(tensor1s.size());
+    for (size_t i = 0; i < tensor1s.size(); ++i) {
+        const auto &tensor1 = tensor1s[i];
+        const auto &tensor2 = tensor2s[i];
+        check_gemm_operands(tensor1, tensor2, "spike_gemm_grouped_cpu");
+        const bool spikes_a = (tensor1.scalar_type() == at::kBool);
+
+        auto output_shape = at::DimVector(tensor1.sizes().begin(), tensor1.sizes().end() - 1);
+        const int64_t M = c10::multiply_integers(output_shape);
+        const int64_t N = tensor2.size(1);
+        const int64_t K = tensor1.size(-1);
+        output_shape.push_back(N);
+        at::Tensor out;
+        if (!outs.empty() && outs[i].has_value() && outs[i]->defined()) {
+            out = *outs[i];
+            check_cpu(out, "out");
+            TORCH_CHECK(out.scalar_type() == at::kFloat && out.is_contiguous() &&
+                        out.sizes() == at::IntArrayRef(output_shape),
+                "spike_gemm_grouped_cpu(): out ", i, " must be a contiguous float32 tensor of shape ",
+                at::IntArrayRef(output_shape));
+        } else {
+            out = at::empty(output_shape, (spikes_a ? tensor2 : tensor1).options());
+        }
+        results.push_back(out);
+        if (M == 0 || N == 0) {
+            continue;
+        }
+
+        GroupedGemmProblem problem;
+        problem.A = tensor1.data_ptr();
+        problem.B = tensor2.data_ptr();
+        problem.C = out.data_ptr<float>();
+        problem.M = M;
+        problem.N = N;
+        problem.K = K;
+        problem.spikes_a = spikes_a;
+        // same rows per tile as a single launch, small problems become a single tile
+        const int64_t grain = row_grain(spikes_a ? N * K / 4 : N * K);
+        const int64_t index = static_cast<int64_t>(problems.size());
+        for (int64_t m = 0; m < M; m += grain) {
+            tiles.push_back({index, m, std::min(M, m + grain)});
+        }
+        problems.push_back(problem);
+    }
+
+    // one parallel region for all problems, so tiny GEMMs share the pool instead of each paying
+    // for a dispatch and a fork-join
+    const auto &k = kernels();
+    const snngrow::cpu::GemmAddressing addr{};
+    at::parallel_for(0, static_cast<int64_t>(tiles.size()), 1, [&](int64_t begin, int64_t end) {
+        for (int64_t t = begin; t < end; ++t) {
+            const auto &tile = tiles[t];
+            const auto &p = problems[tile.problem];
+            if (p.spikes_a) {
+                k.spike_gemm_sd(static_cast<const bool *>(p.A), p.K, static_cast<const float *>(p.B),
+                                p.N, p.C, p.N, tile.m_begin, tile.m_end, p.N, p.K, addr);
+            } else {
+                k.spike_gemm_ds(static_cast<const float *>(p.A), p.K, static_cast<const bool *>(p.B),
+                                p.N, p.C, p.N, tile.m_begin, tile.m_end, p.N, p.K, addr);
+            }
+        }
+    });
+    return results;
+}
+
+at::Tensor spike_gemm_heads_cpu(at::Tensor tensor1, at::Tensor tensor2, int64_t num_heads) {
+    check_gemm_operands(tensor1, tensor2, "spike_gemm_heads_cpu");
+    const int64_t N = tensor2.size(1);
+    TORCH_CHECK(num_heads > 0 && N % num_heads == 0,
+        "spike_gemm_heads_cpu(): ", N, " output features cannot be split into ", num_heads, " heads");
+    const int64_t D = N / num_heads;
+
+    // [*, L, K] @ [K, H * D] is written as [*, H, L, D]
+    const int64_t L = tensor1.size(-2);
+    auto output_shape = at::DimVector(tensor1.sizes().begin(), tensor1.sizes().end() - 2);
+    const int64_t M = c10::multiply_integers(output_shape) * L;
+    output_shape.push_back(num_heads);
+    output_shape.push_back(L);
+    output_shape.push_back(D);
+    auto out = at::empty(output_shape, (tensor1.scalar_type() == at::kBool ? tensor2 : tensor1).options());
+    if (L == 0) {
+        return out;
+    }
+
+    snngrow::cpu::GemmAddressing addr{};
+    addr.row_group = L;
+    addr.group_stride = num_heads * L * D;
+    addr.col_block = D;
+    addr.block_stride = L * D;
+    launch_spike_gemm(tensor1, tensor2, out.data_ptr<float>(), D, M, addr);
+    return out;
+}
+
+at::Tensor pack_spikes_cpu(at::Tensor spikes) {
+    check_cpu(spikes, "spikes");
+    TORCH_CHECK(spikes.scalar_type() == at::kBool && spikes.dim() >= 1,
+        "pack_spikes_cpu(): expected a bool tensor with at least one dimension");
+    auto input = spikes.contiguous();
+    const int64_t n = input.size(-1);
+    const int64_t words = (n + 63) / 64;
+    auto output_shape = at::DimVector(input.sizes().begin(), input.sizes().end() - 1);
+    const int64_t rows = c10::multiply_integers(output_shape);
+    output_shape.push_back(words);
+    auto out = at::empty(output_shape, input.options().dtype(at::kLong));
+    if (rows == 0 || n == 0) {
+        return out;
+    }
+
+    const auto &k = kernels();
+    const bool *src = input.data_ptr<bool>();
+    uint64_t *dst = words_ptr(out);
+    at::parallel_for(0, rows, row_grain(n), [&](int64_t begin, int64_t end) {
+        for (int64_t r = begin; r < end; ++r) {
+            k.pack_spikes(src + r * n, n, dst + r * words);
+        }
+    });
+    return out;
+}
+
+at::Tensor unpack_spikes_cpu(at::Tensor packed, int64_t n) {
+    check_cpu(packed, "packed");
+    TORCH_CHECK(packed.scalar_type() == at::kLong && packed.dim() >= 1,
+        "unpack_spikes_cpu(): expected an int64 tensor of packed words");
+    const int64_t words = (n + 63) / 64;
+    TORCH_CHECK(n >= 0 && packed.size(-1) == words, "unpack_spikes_cpu(): ", n,
+        " spikes need ", words, " words per row, but got ", packed.size(-1));
+    auto input = packed.contiguous();
+    auto output_shape = at::DimVector(input.sizes().begin(), input.sizes().end() - 1);
+    const int64_t rows = c10::multiply_integers(output_shape);
+    output_shape.push_back(n);
+    auto out = at::empty(output_shape, input.options().dtype(at::kBool));
+    if (rows == 0 || n == 0) {
+        return out;
+    }
+
+    const auto &k = kernels();
+    const uint64_t *src = words_ptr(input);
+    bool *dst = out.data_ptr<bool>();
+    at::parallel_for(0, rows, row_grain(n), [&](int64_t begin, int64_t end) {
+        for (int64_t r = begin; r < end; ++r) {
+            k.unpack_spikes(src + r * words, n, dst + r * n);
+        }
+    });
+    return out;
+}
+
+at::Tensor transpose_packed_cpu(at::Tensor packed, int64_t n) {
+    check_cpu(packed, "packed");
+    TORCH_CHECK(packed.scalar_type() == at::kLong && packed.dim() >= 2,
+        "transpose_packed_cpu(): expected an int64 tensor of packed [*, rows, words] matrices");
+    const int64_t words = (n + 63) / 64;
+    TORCH_CHECK(n >= 0 && packed.size(-1) == words, "transpose_packed_cpu(): ", n,
+        " spikes need ", words, " words per row, but got ", packed.size(-1));
+    auto input = packed.contiguous();
+    const int64_t rows = input.size(-2);
+    const int64_t out_words = (rows + 63) / 64;
+    auto output_shape = at::DimVector(input.sizes().begin(), input.sizes().end() - 2);
+    const int64_t batch = c10::multiply_integers(output_shape);
+    output_shape.push_back(n);
+    output_shape.push_back(out_words);
+    auto out = at::empty(output_shape, input.options());
+    if (batch == 0 || n == 0 || rows == 0) {
+        return out;
+    }
+
+    // tasks are 64-column blocks of one matrix, each of them writes whole rows of the result
+    const auto &k = kernels();
+    const uint64_t *src = words_ptr(input);
+    uint64_t *dst = words_ptr(out);
+    at::parallel_for(0, batch * words, row_grain(rows), [&](int64_t begin, int64_t end) {
+        for (int64_t task = begin; task < end;) {
+            const int64_t b = task / words;
+            const int64_t block_end = std::min(end - b * words, words);
+            k.transpose_bits(src + b * rows * words, rows, n, dst + b * n * out_words,
+                             task - b * words, block_end);
+            task = b * words + block_end;
+        }
+    });
+    return out;
+}
+
+at::Tensor spike_bitwise_cpu(at::Tensor a, c10::optional<at::Tensor> b, int64_t op, int64_t n) {
+    check_cpu(a, "a");
+    TORCH_CHECK(op >= 0 && op <= static_cast<int64_t>(snngrow::cpu::BitOp::kNot),
+        "spike_bitwise_cpu(): unknown op ", op);
+    const auto bit_op = static_cast<snngrow::cpu::BitOp>(op);
+    const int64_t words = (n + 63) / 64;
+    TORCH_CHECK(a.scalar_type() == at::kLong && a.dim() >= 1 && a.size(-1) == words,
+        "spike_bitwise_cpu(): expected int64 words with ", words, " words per row for ", n, " spikes");
+    auto input1 = a.contiguous();
+    at::Tensor input2;
+    if (bit_op != snngrow::cpu::BitOp::kNot) {
+        TORCH_CHECK(b.has_value() && b->defined(), "spike_bitwise_cpu(): op ", op, " needs two operands");
+        check_cpu(*b, "b");
+        TORCH_CHECK(b->scalar_type() == at::kLong && b->sizes() == a.sizes(),
+            "spike_bitwise_cpu(): operands must be int64 words of the same shape, but got ",
+            a.sizes(), " and ", b->sizes());
+        input2 = b->contiguous();
+    }
+    auto out = at::empty_like(input1);
+    const int64_t rows = words == 0 ? 0 : input1.numel() / words;
+    if (rows == 0) {
+        return out;
+    }
+
+    const auto &k = kernels();
+    const uint64_t *src1 = words_ptr(input1);
+    const uint64_t *src2 = input2.defined() ? words_ptr(input2) : nullptr;
+    uint64_t *dst = words_ptr(out);
+    // ~ sets the padding bits, they are cleared row by row to keep the packed format
+    const uint64_t tail = n % 64 ? (uint64_t{1} << (n % 64)) - 1 : ~uint64_t{0};
+    at::parallel_for(0, rows, row_grain(words), [&](int64_t begin, int64_t end) {
+        const int64_t offset = begin * words;
+        k.bitwise_words(src1 + offset, src2 ? src2 + offset : nullptr, dst + offset,
+                        (end - begin) * words, bit_op);
+        if (bit_op == snngrow::cpu::BitOp::kNot) {
+            for (int64_t r = begin; r < end; ++r) {
+                dst[r * words + words - 1] &= tail;
+            }
+        }
+    });
+    return out;
+}
+
+at::Tensor spike_reduce_cpu(at::Tensor packed, int64_t op) {
+    check_cpu(packed, "packed");
+    TORCH_CHECK(op == static_cast<int64_t>(snngrow::cpu::BitOp::kAnd) ||
+                op == static_cast<int64_t>(snngrow::cpu::BitOp::kOr),
+        "spike_reduce_cpu(): op must be and / or, but got ", op);
+    TORCH_CHECK(packed.scalar_type() == at::kLong && packed.dim() == 2 && packed.size(0) > 0,
+        "spike_reduce_cpu(): expected a non-empty int64 [rows, words] tensor");
+    auto input = packed.contiguous();
+    const int64_t rows = input.size(0);
+    const int64_t words = input.size(1);
+    auto out = at::empty({words}, input.options());
+    if (words == 0) {
+        return out;
+    }
+
+    const auto &k = kernels();
+    const uint64_t *src = words_ptr(input);
+    uint64_t *dst = words_ptr(out);
+    const auto bit_op = static_cast<snngrow::cpu::BitOp>(op);
+    at::parallel_for(0, words, row_grain(rows), [&](int64_t begin, int64_t end) {
+        k.reduce_words(src + begin, rows, words, end - begin, dst + begin, bit_op);
+    });
+    return out;
+}
+
+at::Tensor spike_count_columns_cpu(at::Tensor packed, int64_t n) {
+    check_cpu(packed, "packed");
+    const int64_t words = (n + 63) / 64;
+    TORCH_CHECK(packed.scalar_type() == at::kLong && packed.dim() == 3 && packed.size(2) == words,
+        "spike_count_columns_cpu(): expected int64 [rows, groups, ", words, "] words for ", n, " spikes");
+    auto input = packed.contiguous();
+    const int64_t rows = input.size(0);
+    const int64_t groups = input.size(1);
+    auto counts = at::zeros({groups, words * 64}, input.options());
+    if (rows == 0 || groups == 0 || words == 0) {
+        return counts.narrow(1, 0, n);
+    }
+
+    const auto &k = kernels();
+    const uint64_t *src = words_ptr(input);
+    int64_t *dst = counts.data_ptr<int64_t>();
+    at::parallel_for(0, groups, row_grain(rows * words), [&](int64_t begin, int64_t end) {
+        for (int64_t g = begin; g < end; ++g) {
+            k.count_columns(src + g * words, rows, groups * words, words, dst + g * words * 64);
+        }
+    });
+    // the padding columns are zero
+    return counts.narrow(1, 0, n);
+}
+
+at::Tensor spike_first_time_cpu(at::Tensor packed, int64_t none) {
+    check_cpu(packed, "packed");
+    TORCH_CHECK(packed.scalar_type() == at::kLong && packed.dim() >= 1,
+        "spike_first_time_cpu(): expected an int64 tensor of packed words");
+    auto input = packed.contiguous();
+    const int64_t words = input.size(-1);
+    auto output_shape = at::DimVector(input.sizes().begin(), input.sizes().end() - 1);
+    const int64_t rows = c10::multiply_integers(output_shape);
+    auto out = at::empty(output_shape, input.options());
+    if (rows == 0) {
+        return out;
+    }
+    if (words == 0) {
+        return out.fill_(none);
+    }
+
+    const auto &k = kernels();
+    const uint64_t *src = words_ptr(input);
+    int64_t *dst = out.data_ptr<int64_t>();
+    at::parallel_for(0, rows, row_grain(words), [&](int64_t begin, int64_t end) {
+        k.first_spike(src + begin * words, words, end - begin, none, dst + begin);
+    });
+    return out;
+}
+
+at::Tensor spike_count_cpu(at::Tensor packed) {
+    check_cpu(packed, "packed");
+    TORCH_CHECK(packed.scalar_type() == at::kLong && packed.dim() >= 1,
+        "spike_count_cpu(): expected an int64 tensor of packed words");
+    auto input = packed.contiguous();
+    const int64_t words = input.size(-1);
+    auto output_shape = at::DimVector(input.sizes().begin(), input.sizes().end() - 1);
+    const int64_t rows = c10::multiply_integers(output_shape);
+    auto out = at::empty(output_shape, input.options());
+    if (rows == 0) {
+        return out;
+    }
+
+    const auto &k = kernels();
+    const uint64_t *src = words_ptr(input);
+    int64_t *dst = out.data_ptr<int64_t>();
+    at::parallel_for(0, rows, row_grain(words * 64), [&](int64_t begin, int64_t end) {
+        for (int64_t r = begin; r < end; ++r) {
+            dst[r] = k.popcount(src + r * words, words);
+        }
+    });
+    return out;
+}
+
+at::Tensor neuron_step_cpu(at::Tensor x, at::Tensor v, int64_t mode, double tau,
+                           double v_threshold, c10::optional<double> v_reset, bool spike_out) {
+    check_cpu(x, "x");
+    check_cpu(v, "v");
+    const auto state_type = v.scalar_type();
+    TORCH_CHECK(x.scalar_type() == at::kFloat &&
+                (state_type == at::kFloat || state_type == at::kBFloat16 || state_type == at::kHalf),
+        "neuron_step_cpu(): expected float32 input and a float32, bfloat16 or float16 membrane potential");
+    TORCH_CHECK(x.sizes() == v.sizes(), "neuron_step_cpu(): input shape ", x.sizes(),
+        " does not match the membrane potential shape ", v.sizes());
+    TORCH_CHECK(v.is_contiguous(), "neuron_step_cpu(): membrane potential must be contiguous");
+
+    const auto params = neuron_params(mode, tau, v_threshold, v_reset, "neuron_step_cpu");
+
+    auto input = x.contiguous();
+    auto spike = at::empty(input.sizes(), spike_out ? input.options().dtype(at::kBool) : input.options());
+    const int64_t n = input.numel();
+
+    const auto &k = kernels();
+    const float *x_ptr = input.data_ptr<float>();
+    bool *spike_b = spike_out ? spike.data_ptr<bool>() : nullptr;
+    float *spike_f = spike_out ? nullptr : spike.data_ptr<float>();
+    if (state_type != at::kFloat) {
+        // 16-bit state, the kernel computes in float and rounds v back on store
+        auto *v_ptr = reinterpret_cast<uint16_t *>(v.data_ptr());
+        const auto format = state_type == at::kBFloat16 ? snngrow::cpu::HalfFormat::kBF16
+                                                       : snngrow::cpu::HalfFormat::kFP16;
+        at::parallel_for(0, n, at::internal::GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+            k.neuron_step_half(x_ptr + begin, v_ptr + begin, spike_b ? spike_b + begin : nullptr,
+                               spike_f ? spike_f + begin : nullptr, end - begin, params, format);
+        });
+        return spike;
+    }
+    float *v_ptr = v.data_ptr<float>();
+    at::parallel_for(0, n, at::internal::GRAIN_SIZE, [&](int64_t begin, int64_t end) {
+        k.neuron_step(x_ptr + begin, v_ptr + begin, spike_b ? spike_b + begin : nullptr,
+                      spike_f ? spike_f + begin : nullptr, end - begin, params);
+    });
+    return spike;
+}
+
+at::Tensor neuron_event_step_cpu(at::Tensor index, at::Tensor x, at::Tensor v, at::Tensor last, int64_t t,
+                                 int64_t mode, double tau, double v_threshold, c10::optional<double> v_reset) {
+    check_cpu(x, "x");
+    check_cpu(v, "v");
+    check_cpu(last, "last");
+    TORCH_CHECK(v.scalar_type() == at::kFloat && v.is_contiguous() && last.scalar_type() == at::kLong &&
+                last.is_contiguous() && last.numel() == v.numel(),
+        "neuron_event_step_cpu(): expected contiguous float32 v and int64 last of the same size");
+    auto indices = check_unique_rows(index, v.numel(), "index");
+    const int64_t count = indices.numel();
+    TORCH_CHECK(x.scalar_type() == at::kFloat && x.dim() == 1 && x.size(0) == count,
+        "neuron_event_step_cpu(): expected one float32 input per index");
+    const auto params = neuron_params(mode, tau, v_threshold, v_reset, "neuron_event_step_cpu");
+
+    auto input = x.contiguous();
+    auto spike = at::empty({count}, input.options().dtype(at::kBool));
+    const auto &k = kernels();
+    const int64_t *index_ptr = indices.data_ptr<int64_t>();
+    const float *x_ptr = input.data_ptr<float>();
+    float *v_ptr = v.data_ptr<float>();
+    int64_t *last_ptr = last.data_ptr<int64_t>();
+    bool *spike_ptr = spike.data_ptr<bool>();
+    // the indices were checked to be unique, so the events can be split between threads
+    at::parallel_for(0, count, at::internal::GRAIN_SIZE / 8, [&](int64_t begin, int64_t end) {
+        k.neuron_event_step(index_ptr + begin, x_ptr + begin, end - begin, v_ptr, last_ptr, t, spike_ptr + begin,
+                            params);
+    });
+    return spike;
+}
+
+at::Tensor neuron_step_channels_cpu(at::Tensor x, at::Tensor v, int64_t mode, double tau, at::Tensor v_threshold,
+                                    c10::optional<at::Tensor> bias, c10::optional<double> v_reset, bool spike_out) {
+    check_cpu(x, "x");
+    check_cpu(v, "v");
+    check_cpu(v_threshold, "v_threshold");
+    TORCH_CHECK(x.scalar_type() == at::kFloat && v.scalar_type() == at::kFloat &&
+                v_threshold.scalar_type() == at::kFloat,
+        "neuron_step_channels_cpu(): expected float32 input, membrane potential and thresholds");
+    TORCH_CHECK(x.sizes() == v.sizes(), "neuron_step_channels_cpu(): input shape ", x.sizes(),
+        " does not match the membrane potential shape ", v.sizes());
+    TORCH_CHECK(v.is_contiguous(), "neuron_step_channels_cpu(): membrane potential must be contiguous");
+    // v_threshold is [C, 1, ..., 1], broadcast against the trailing dimensions of x
+    const int64_t dims = v_threshold.dim();
+    const int64_t channels = v_threshold.numel();
+    TORCH_CHECK(dims >= 1 && x.dim() >= dims && x.size(-dims) == channels && v_threshold.size(0) == channels,
+        "neuron_step_channels_cpu(): thresholds of shape ", v_threshold.sizes(),
+        " are not [C, 1, ...] for the input shape ", x.sizes());
+    auto thresholds = v_threshold.contiguous();
+    at::Tensor biases;
+    if (bias.has_value()) {
+        check_cpu(*bias, "bias");
+        TORCH_CHECK(bias->scalar_type() == at::kFloat && bias->numel() == channels,
+            "neuron_step_channels_cpu(): expected float32 biases with one value per channel");
+        biases = bias->contiguous();
+    }
+    const auto params = neuron_params(mode, tau, 1., v_reset, "neuron_step_channels_cpu");
+
+    auto input = x.contiguous();
+    auto spike = at::empty(input.sizes(), spike_out ? input.options().dtype(at::kBool) : input.options());
+    int64_t inner = 1;
+    for (int64_t d = x.dim() - dims + 1; d < x.dim(); ++d) inner *= x.size(d);
+    const int64_t units = channels == 0 || inner == 0 ? 0 : input.numel() / inner;
+
+    const auto &k = kernels();
+    const float *x_ptr = input.data_ptr<float>();
+    float *v_ptr = v.data_ptr<float>();
+    bool *spike_b = spike_out ? spike.data_ptr<bool>() : nullptr;
+    float *spike_f = spike_out ? nullptr : spike.data_ptr<float>();
+    const float *threshold_ptr = thresholds.data_ptr<float>();
+    const float *bias_ptr = biases.defined() ? biases.data_ptr<float>() : nullptr;
+    // a unit is one channel of one sample, a range of units is split at the sample boundaries
+    at::parallel_for(0, units, row_grain(inner), [&](int64_t begin, int64_t end) {
+        while (begin < end) {
+            const int64_t c = begin % channels;
+            const int64_t count = std::min(end - begin, channels - c);
+            const int64_t offset = begin * inner;
+            k.neuron_step_channels(x_ptr + offset, v_ptr + offset, spike_b ? spike_b + offset : nullptr,
+                                   spike_f ? spike_f + offset : nullptr, count, inner, threshold_ptr + c,
+                                   bias_ptr ? bias_ptr + c : nullptr, params);
+            begin += count;
+        }
+    });
+    return spike;
+}
+
+at::Tensor neuron_multistep_cpu(at::Tensor x_seq, at::Tensor v, int64_t mode, double tau,
+                                double v_threshold, c10::optional<double> v_reset, int64_t spike_format) {
+    check_cpu(x_seq, "x_seq");
+    check_cpu(v, "v");
+    TORCH_CHECK(x_seq.scalar_type() == at::kFloat && v.scalar_type() == at::kFloat,
+        "neuron_multistep_cpu(): expected float32 input and membrane potential");
+    TORCH_CHECK(x_seq.dim() >= 2 && x_seq.sizes().slice(1) == v.sizes(), "neuron_multistep_cpu(): input shape ",
+        x_seq.sizes(), " is not [T] + the membrane potential shape ", v.sizes());
+    TORCH_CHECK(v.is_contiguous(), "neuron_multistep_cpu(): membrane potential must be contiguous");
+    TORCH_CHECK(spike_format >= 0 && spike_format <= 2,
+        "neuron_multistep_cpu(): spike_format must be 0 (float), 1 (bool) or 2 (packed)");
+    const auto params = neuron_params(mode, tau, v_threshold, v_reset, "neuron_multistep_cpu");
+
+    auto input = x_seq.contiguous();
+    const int64_t T = input.size(0);
+    const int64_t n = v.numel();
+    const auto &k = kernels();
+    const float *x_ptr = input.data_ptr<float>();
+    float *v_ptr = v.data_ptr<float>();
+
+    if (spike_format != 2) {
+        auto spike = at::empty(input.sizes(), spike_format == 1 ? input.options().dtype(at::kBool) : input.options());
+        bool *spike_b = spike_format == 1 ? spike.data_ptr<bool>() : nullptr;
+        float *spike_f = spike_format == 1 ? nullptr : spike.data_ptr<float>();
+        at::parallel_for(0, n, row_grain(T), [&](int64_t begin, int64_t end) {
+            k.neuron_multistep(x_ptr + begin, v_ptr + begin, spike_b ? spike_b + begin : nullptr,
+                               spike_f ? spike_f + begin : nullptr, nullptr, nullptr, nullptr, nullptr, T, n,
+                               0, end - begin, params);
+        });
+        return spike;
+    }
+
+    // packed along the last dimension: every task owns whole words of a row of neurons
+    const int64_t row = v.dim() > 0 ? v.size(-1) : 1;
+    const int64_t rows = row > 0 ? n / row : 0;
+    const int64_t words = (row + 63) / 64;
+    auto packed_shape = at::DimVector(input.sizes().begin(), input.sizes().end() - (v.dim() > 0 ? 1 : 0));
+    packed_shape.push_back(words);
+    auto spike = at::empty(packed_shape, input.options().dtype(at::kLong));
+    uint64_t *spike_w = words_ptr(spike);
+    at::parallel_for(0, rows * words, row_grain(T * 64), [&](int64_t begin, int64_t end) {
+        for (int64_t u = begin; u < end; ++u) {
+            const int64_t r = u / words;
+            const int64_t w = u % words;
+            const int64_t offset = r * row + w * 64;
+            k.neuron_multistep(x_ptr + offset, v_ptr + offset, nullptr, nullptr, spike_w + u, nullptr, nullptr,
+                               nullptr, T, n, rows * words, std::min<int64_t>(64, row - w * 64), params);
+        }
+    });
+    return spike;
+}
+
+at::Tensor neuron_multistep_scan_cpu(at::Tensor x_seq, at::Tensor v, int64_t mode, double tau,
+                                     double v_threshold, c10::optional<double> v_reset, int64_t spike_format,
+                                     int64_t time_blocks) {
+    // shorter blocks do not pay for their fix-up
+    constexpr int64_t kMinBlockSteps = 16;
+    check_cpu(x_seq, "x_seq");
+    check_cpu(v, "v");
+    TORCH_CHECK(x_seq.scalar_type() == at::kFloat && v.scalar_type() == at::kFloat,
+        "neuron_multistep_scan_cpu(): expected float32 input and membrane potential");
+    TORCH_CHECK(x_seq.dim() >= 2 && x_seq.sizes().slice(1) == v.sizes(), "neuron_multistep_scan_cpu(): input shape ",
+        x_seq.sizes(), " is not [T] + the membrane potential shape ", v.sizes());
+    TORCH_CHECK(v.is_contiguous(), "neuron_multistep_scan_cpu(): membrane potential must be contiguous");
+    TORCH_CHECK(spike_format == 0 || spike_format == 1,
+        "neuron_multistep_scan_cpu(): spike_format must be 0 (float) or 1 (bool)");
+    const auto params = neuron_params(mode, tau, v_threshold, v_reset, "neuron_multistep_scan_cpu");
+
+    const int64_t T = x_seq.size(0);
+    int64_t blocks = time_blocks > 0 ? time_blocks : at::get_num_threads();
+    blocks = std::min(blocks, T / kMinBlockSteps);
+    // without a leak the start error of a soft reset block never decays, nearly every neuron that
+    // fires would be run twice
+    const bool no_leak_soft_reset = !params.hard_reset && params.mode == snngrow::cpu::NeuronMode::kIF;
+    if (blocks <= 1 || no_leak_soft_reset) {
+        return neuron_multistep_cpu(x_seq, v, mode, tau, v_threshold, v_reset, spike_format);
+    }
+    const int64_t L = (T + blocks - 1) / blocks;
+    blocks = (T + L - 1) / L;
+
+    auto input = x_seq.contiguous();
+    const int64_t n = v.numel();
+    auto spike = at::empty(input.sizes(), spike_format == 1 ? input.options().dtype(at::kBool) : input.options());
+    // end state of every block, blocks after the first start from the value right after a reset
+    auto state = at::empty({blocks, n}, v.options());
+    state[0].copy_(v.reshape(-1));
+    state.slice(0, 1).fill_(params.hard_reset ? params.v_reset : 0.f);
+    auto v_max = at::empty({blocks, n}, v.options());
+    // with a soft reset the spikes of a block whose potential stays this far from the threshold
+    // survive the correction of its start
+    auto v_margin = params.hard_reset ? at::Tensor() : at::empty({blocks, n}, v.options());
+
+    const auto &k = kernels();
+    const float *x_ptr = input.data_ptr<float>();
+    bool *spike_b = spike_format == 1 ? spike.data_ptr<bool>() : nullptr;
+    float *spike_f = spike_format == 1 ? nullptr : spike.data_ptr<float>();
+    float *state_ptr = state.data_ptr<float>();
+    float *v_max_ptr = v_max.data_ptr<float>();
+    float *v_margin_ptr = params.hard_reset ? nullptr : v_margin.data_ptr<float>();
+    auto block_steps = [&](int64_t b) { return std::min(L, T - b * L); };
+
+    // speculative pass, all blocks at once
+    at::parallel_for(0, blocks * n, row_grain(L), [&](int64_t begin, int64_t end) {
+        while (begin < end) {
+            const int64_t b = begin / n;
+            const int64_t i = begin % n;
+            const int64_t len = std::min(n - i, end - begin);
+            const int64_t offset = b * L * n + i;
+            k.neuron_multistep(x_ptr + offset, state_ptr + b * n + i, spike_b ? spike_b + offset : nullptr,
+                               spike_f ? spike_f + offset : nullptr, nullptr, nullptr, v_max_ptr + b * n + i,
+                               v_margin_ptr ? v_margin_ptr + b * n + i : nullptr, block_steps(b), n, 0, len, params);
+            begin += len;
+        }
+    });
+    // fix-up pass, block by block since each one starts from the end state of the previous one
+    for (int64_t b = 1; b < blocks; ++b) {
+        at::parallel_for(0, n, row_grain(L), [&](int64_t begin, int64_t end) {
+            const int64_t offset = b * L * n + begin;
+            k.neuron_multistep_fixup(x_ptr + offset, state_ptr + (b - 1) * n + begin, v_max_ptr + b * n + begin,
+                                     v_margin_ptr ? v_margin_ptr + b * n + begin : nullptr, state_ptr + b * n + begin,
+                                     spike_b ? spike_b + offset : nullptr, spike_f ? spike_f + offset : nullptr,
+                                     block_steps(b), n, end - begin, params);
+        });
+    }
+    v.view(-1).copy_(state[blocks - 1]);
+    return spike;
+}
+
+std::tuple<at::Tensor, at::Tensor> neuron_multistep_train_cpu(at::Tensor x_seq, at::Tensor v, int64_t mode,
+                                                              double tau, double v_threshold,
+                                                              c10::optional<double> v_reset) {
+    check_cpu(x_seq, "x_seq");
+    check_cpu(v, "v");
+    TORCH_CHECK(x_seq.scalar_type() == at::kFloat && v.scalar_type() == at::kFloat,
+        "neuron_multistep_train_cpu(): expected float32 input and membrane potential");
+    TORCH_CHECK(x_seq.dim() >= 2 && x_seq.sizes().slice(1) == v.sizes(), "neuron_multistep_train_cpu(): input shape ",
+        x_seq.sizes(), " is not [T] + the membrane potential shape ", v.sizes());
+    TORCH_CHECK(v.is_contiguous(), "neuron_multistep_train_cpu(): membrane potential must be contiguous");
+    const auto params = neuron_params(mode, tau, v_threshold, v_reset, "neuron_multistep_train_cpu");
+
+    auto input = x_seq.contiguous();
+    auto spike = at::empty(input.sizes(), input.options());
+    auto v_seq = at::empty(input.sizes(), input.options());
+    const int64_t T = input.size(0);
+    const int64_t n = v.numel();
+    const auto &k = kernels();
+    const float *x_ptr = input.data_ptr<float>();
+    float *v_ptr = v.data_ptr<float>();
+    float *spike_ptr = spike.data_ptr<float>();
+    float *v_seq_ptr = v_seq.data_ptr<float>();
+    at::parallel_for(0, n, row_grain(T), [&](int64_t begin, int64_t end) {
+        k.neuron_multistep(x_ptr + begin, v_ptr + begin, nullptr, spike_ptr + begin, nullptr, v_seq_ptr + begin,
+                           nullptr, nullptr, T, n, 0, end - begin, params);
+    });
+    return std::make_tuple(spike, v_seq);
+}
+
+std::tuple<at::Tensor, at::Tensor> neuron_multistep_backward_cpu(at::Tensor grad_spike,
+                                                                 c10::optional<at::Tensor> grad_v,
+                                                                 at::Tensor v_seq, int64_t mode, double tau,
+                                                                 double v_threshold,
+                                                                 c10::optional<double> v_reset,
+                                                                 int64_t surrogate, double alpha,
+                                                                 bool detach_reset) {
+    check_cpu(grad_spike, "grad_spike");
+    check_cpu(v_seq, "v_seq");
+    TORCH_CHECK(grad_spike.scalar_type() == at::kFloat && v_seq.scalar_type() == at::kFloat,
+        "neuron_multistep_backward_cpu(): expected float32 gradients and potentials");
+    TORCH_CHECK(v_seq.dim() >= 2 && grad_spike.sizes() == v_seq.sizes(),
+        "neuron_multistep_backward_cpu(): gradient shape ", grad_spike.sizes(),
+        " does not match the saved potentials ", v_seq.sizes());
+    TORCH_CHECK(surrogate >= 0 && surrogate <= static_cast<int64_t>(snngrow::cpu::Surrogate::kATan),
+        "neuron_multistep_backward_cpu(): unknown surrogate function ", surrogate);
+    const auto params = neuron_params(mode, tau, v_threshold, v_reset, "neuron_multistep_backward_cpu");
+    snngrow::cpu::NeuronGradParams grad_params;
+    grad_params.surrogate = static_cast<snngrow::cpu::Surrogate>(surrogate);
+    grad_params.alpha = static_cast<float>(alpha);
+    grad_params.detach_reset = detach_reset;
+
+    auto grad_s = grad_spike.contiguous();
+    auto saved = v_seq.contiguous();
+    const int64_t T = saved.size(0);
+    const int64_t n = saved.numel() / std::max<int64_t>(T, 1);
+    at::Tensor grad_last;
+    if (grad_v.has_value() && grad_v->defined()) {
+        check_cpu(*grad_v, "grad_v");
+        TORCH_CHECK(grad_v->scalar_type() == at::kFloat && grad_v->numel() == n,
+            "neuron_multistep_backward_cpu(): expected a float32 gradient of the final potential with ", n,
+            " elements");
+        grad_last = grad_v->contiguous();
+    }
+    auto grad_x = at::empty(saved.sizes(), saved.options());
+    auto grad_v0 = at::empty(saved.sizes().slice(1), saved.options());
+
+    const auto &k = kernels();
+    const float *gs_ptr = grad_s.data_ptr<float>();
+    const float *gv_ptr = grad_last.defined() ? grad_last.data_ptr<float>() : nullptr;
+    const float *v_seq_ptr = saved.data_ptr<float>();
+    float *gx_ptr = grad_x.data_ptr<float>();
+    float *gv0_ptr = grad_v0.data_ptr<float>();
+    at::parallel_for(0, n, row_grain(T), [&](int64_t begin, int64_t end) {
+        k.neuron_multistep_backward(gs_ptr + begin, gv_ptr ? gv_ptr + begin : nullptr, v_seq_ptr + begin,
+                                    gx_ptr + begin, gv0_ptr + begin, T, n, end - begin, params, grad_params);
+    });
+    return std::make_tuple(grad_x, grad_v0);
+}
+
+at::Tensor spike_max_pool2d_cpu(at::Tensor spikes, std::vector<int64_t> kernel_size,
+                                std::vector<int64_t> stride, std::vector<int64_t> padding) {
+    check_cpu(spikes, "spikes");
+    TORCH_CHECK(spikes.scalar_type() == at::kBool && (spikes.dim() == 3 || spikes.dim() == 4),
+        "spike_max_pool2d_cpu(): expected a bool tensor of shape [N, C, H, W] or [C, H, W]");
+    TORCH_CHECK(kernel_size.size() == 1 || kernel_size.size() == 2,
+        "spike_max_pool2d_cpu(): kernel_size must be an int or a pair of ints");
+    if (stride.empty()) {
+        stride = kernel_size;
+    }
+    TORCH_CHECK(stride.size() == 1 || stride.size() == 2,
+        "spike_max_pool2d_cpu(): stride must be an int or a pair of ints");
+    TORCH_CHECK(padding.size() == 1 || padding.size() == 2,
+        "spike_max_pool2d_cpu(): padding must be an int or a pair of ints");
+
+    snngrow::cpu::Pool2dParams params;
+    params.kernel_h = kernel_size.front();
+    params.kernel_w = kernel_size.back();
+    params.stride_h = stride.front();
+    params.stride_w = stride.back();
+    params.pad_h = padding.front();
+    params.pad_w = padding.back();
+    TORCH_CHECK(params.kernel_h > 0 && params.kernel_w > 0 && params.stride_h > 0 && params.stride_w > 0,
+        "spike_max_pool2d_cpu(): kernel_size and stride must be positive");
+    TORCH_CHECK(params.pad_h >= 0 && params.pad_w >= 0 &&
+                2 * params.pad_h <= params.kernel_h && 2 * params.pad_w <= params.kernel_w,
+        "spike_max_pool2d_cpu(): pad should be at most half of the kernel size");
+
+    auto input = spikes.contiguous();
+    params.height = input.size(-2);
+    params.width = input.size(-1);
+    params.out_height = (params.height + 2 * params.pad_h - params.kernel_h) / params.stride_h + 1;
+    params.out_width = (params.width + 2 * params.pad_w - params.kernel_w) / params.stride_w + 1;
+    TORCH_CHECK(params.out_height > 0 && params.out_width > 0,
+        "spike_max_pool2d_cpu(): input of shape ", input.sizes(), " is too small for the kernel");
+
+    auto output_shape = at::DimVector(input.sizes().begin(), input.sizes().end() - 2);
+    const int64_t planes = c10::multiply_integers(output_shape);
+    output_shape.push_back(params.out_height);
+    output_shape.push_back(params.out_width);
+    auto out = at::empty(output_shape, input.options());
+    if (planes == 0) {
+        return out;
+    }
+
+    const auto &k = kernels();
+    const bool *src = input.data_ptr<bool>();
+    bool *dst = out.data_ptr<bool>();
+    const int64_t in_plane = params.height * params.width;
+    const int64_t out_plane = params.out_height * params.out_width;
+    at::parallel_for(0, planes, row_grain(in_plane * params.kernel_h), [&](int64_t begin, int64_t end) {
+        for (int64_t c = begin; c < end; ++c) {
+            k.spike_max_pool2d(src + c * in_plane, dst + c * out_plane, params);
+        }
+    });
+    return out;
+}
+
+void init_spike_cpu(pybind11::module &m) {
+    // pick the kernel variant at import time rather than on the first call
+    kernels();
+
+    m.def("spike_gemm_cpu", &spike_gemm_cpu, "Bool Spike Matrix Multiplication GEMM CPU");
+    m.def("spike_gemm_packed_cpu", &spike_gemm_packed_cpu, "Packed Spike Matrix Multiplication GEMM CPU");
+    m.def("spike_gemm_csr_cpu", &spike_gemm_csr_cpu, "CSR Spike Matrix Multiplication GEMM CPU");
+    m.def("spike_conv2d_csr_cpu", &spike_conv2d_csr_cpu, "Event Driven CSR Spike Conv2d CPU",
+          pybind11::arg("crow"), pybind11::arg("col"), pybind11::arg("weight"), pybind11::arg("batch"),
+          pybind11::arg("height"), pybind11::arg("width"), pybind11::arg("stride"), pybind11::arg("padding"));
+    m.def("ttfs_linear_cpu", &ttfs_linear_cpu, "Time To First Spike Linear CPU",
+          pybind11::arg("times"), pybind11::arg("weight_t"), pybind11::arg("bias"),
+          pybind11::arg("threshold"), pybind11::arg("T"));
+    m.def("spike_csr_from_packed_cpu", &spike_csr_from_packed_cpu, "CSR event indices of packed spikes CPU");
+    m.def("spike_gemm_gather_cpu", &spike_gemm_gather_cpu, "Row Gather / Scatter Spike GEMM CPU, out_rows must be unique",
+          pybind11::arg("tensor1"), pybind11::arg("tensor2"), pybind11::arg("a_rows") = pybind11::none(),
+          pybind11::arg("out") = pybind11::none(), pybind11::arg("out_rows") = pybind11::none());
+    m.def("spike_gemm_heads_cpu", &spike_gemm_heads_cpu, "Head Split Output Spike GEMM CPU");
+    m.def("spike_gemm_grouped_cpu", &spike_gemm_grouped_cpu, "Grouped Spike GEMM CPU",
+          pybind11::arg("tensor1s"), pybind11::arg("tensor2s"),
+          pybind11::arg("outs") = std::vector<c10::optional<at::Tensor>>());
+    m.def("pack_spikes_cpu", &pack_spikes_cpu, "Pack bool spikes into int64 words CPU");
+    m.def("unpack_spikes_cpu", &unpack_spikes_cpu, "Unpack int64 words into bool spikes CPU");
+    m.def("transpose_packed_cpu", &transpose_packed_cpu, "Transpose packed spike matrices CPU");
+    m.def("spike_bitwise_cpu", &spike_bitwise_cpu, "Word parallel logic on packed spikes CPU",
+          pybind11::arg("a"), pybind11::arg("b"), pybind11::arg("op"), pybind11::arg("n"));
+    m.def("spike_reduce_cpu", &spike_reduce_cpu, "And / or of the rows of packed spikes CPU");
+    m.def("spike_count_columns_cpu", &spike_count_columns_cpu, "Spike counts over the rows of packed spikes CPU");
+    m.def("spike_first_time_cpu", &spike_first_time_cpu, "Lowest set bit of every packed row CPU");
+    m.def("spike_count_cpu", &spike_count_cpu, "Count the spikes of every packed row CPU");
+    m.def("neuron_step_cpu", &neuron_step_cpu, "IF / LIF charge, fire and reset step CPU");
+    m.def("neuron_event_step_cpu", &neuron_event_step_cpu,
+          "Event-driven IF / LIF step CPU with lazy decay of the neurons without input");
+    m.def("neuron_step_channels_cpu", &neuron_step_channels_cpu,
+          "IF / LIF step CPU with a threshold and an input bias per channel");
+    m.def("neuron_multistep_cpu", &neuron_multistep_cpu, "Multi-step IF / LIF forward CPU");
+    m.def("neuron_multistep_scan_cpu", &neuron_multistep_scan_cpu,
+          "Multi-step IF / LIF forward CPU, parallel over time blocks", pybind11::arg("x_seq"),
+          pybind11::arg("v"), pybind11::arg("mode"), pybind11::arg("tau"), pybind11::arg("v_threshold"),
+          pybind11::arg("v_reset"), pybind11::arg("spike_format") = 0, pybind11::arg("time_blocks") = 0);
+    m.def("neuron_multistep_train_cpu", &neuron_multistep_train_cpu,
+          "Multi-step IF / LIF forward CPU that keeps the charged potentials for BPTT");
+    m.def("neuron_multistep_backward_cpu", &neuron_multistep_backward_cpu,
+          "Multi-step IF / LIF BPTT backward CPU");
+    m.def("spike_max_pool2d_cpu", &spike_max_pool2d_cpu, "Spike Max Pooling CPU");
+    m.def("spike_tensor", &make_spike_tensor, "Wrap bool spikes as a spike tensor");
+    m.def("is_spike_tensor", &is_spike_tensor, "Whether a tensor is a spike tensor");
+    m.def("spike_tensor_elem", &spike_tensor_elem, "Bool spikes of a spike tensor");
+    m.def("cpu_isa", &snngrow::cpu::cpu_isa, "Name of the active CPU kernel variant");
+    m.def("available_cpu_isas", &snngrow::cpu::available_cpu_isas, "CPU kernel variants supported by this host");
+    m.def("set_cpu_isa", &snngrow::cpu::set_cpu_isa, "Select a CPU kernel variant");
+}
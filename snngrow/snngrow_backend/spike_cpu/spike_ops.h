@@ -0,0 +1,160 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+/*! \file snngrow/snngrow_backend/spike_cpu/spike_ops.h
+    \brief ATen entry points of the CPU spike kernels.
+*/
+#pragma once
+
+#include <torch/extension.h>
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+/// Bool spike x float (or float x bool spike) matrix multiplication on the CPU. The first operand
+/// may have leading batch dimensions, which are folded into its rows.
+at::Tensor spike_gemm_cpu(at::Tensor tensor1, at::Tensor tensor2);
+
+/// Packed spikes [*, (K + 63) / 64] x float32 [K, N], the leading dimensions are folded into the
+/// rows. Only the set bits are visited, there is no bool intermediate.
+at::Tensor spike_gemm_packed_cpu(at::Tensor packed, at::Tensor tensor2);
+
+/// CSR spikes [M, K] (row offsets crow [M + 1], column indices col [nnz]) x float32 [K, N]. Each row
+/// walks its event list directly, the cost is proportional to the number of spikes.
+at::Tensor spike_gemm_csr_cpu(at::Tensor crow, at::Tensor col, at::Tensor tensor2);
+
+/// Event-driven conv2d (dilation 1, no groups) of CSR spikes [batch, C, height, width], the rows of
+/// the CSR are (n, c, y) and the columns x. weight is [O, C, kh, kw]. Returns [batch, O, OH, OW]
+/// stored channels-last, bias is left to the caller.
+at::Tensor spike_conv2d_csr_cpu(at::Tensor crow, at::Tensor col, at::Tensor weight,
+                                int64_t batch, int64_t height, int64_t width,
+                                std::vector<int64_t> stride, std::vector<int64_t> padding);
+
+/// Time-to-first-spike linear layer: uint8 input spike times [*, K] (>= T: never) and a float32
+/// [K, N] weight give uint8 output spike times [*, N], 255 for outputs that never fire. Outputs
+/// integrate the weights of the inputs fired so far (plus bias) and fire once at threshold.
+at::Tensor ttfs_linear_cpu(at::Tensor times, at::Tensor weight_t, c10::optional<at::Tensor> bias,
+                           double threshold, int64_t T);
+
+/// CSR row offsets [rows + 1] and column indices [nnz] of the spikes of packed [*, words] rows.
+std::tuple<at::Tensor, at::Tensor> spike_csr_from_packed_cpu(at::Tensor packed);
+
+/// Spike GEMM on selected rows: row m of the problem multiplies row a_rows[m] of the 2D tensor1
+/// with tensor2 and is written to row out_rows[m] of out. Missing index arrays are the identity.
+/// Without out, the result has one row per selected row, or as many rows as tensor1 if out_rows is
+/// given, with zeros in the rows that were not computed. Scattered rows must be unique.
+at::Tensor spike_gemm_gather_cpu(at::Tensor tensor1, at::Tensor tensor2,
+                                 c10::optional<at::Tensor> a_rows,
+                                 c10::optional<at::Tensor> out,
+                                 c10::optional<at::Tensor> out_rows);
+
+/// Independent spike GEMMs tensor1s[i] @ tensor2s[i] (each as in spike_gemm_cpu) run in a single
+/// parallel region. outs is empty or holds an optional preallocated output per problem, the
+/// outputs are returned.
+std::vector<at::Tensor> spike_gemm_grouped_cpu(std::vector<at::Tensor> tensor1s,
+                                               std::vector<at::Tensor> tensor2s,
+                                               std::vector<c10::optional<at::Tensor>> outs);
+
+/// [*, L, K] @ [K, H * D] written directly in the head split layout [*, H, L, D] that multi-head
+/// attention consumes, without a permute + contiguous copy of the projection.
+at::Tensor spike_gemm_heads_cpu(at::Tensor tensor1, at::Tensor tensor2, int64_t num_heads);
+
+/// Packs the last dimension of a bool tensor into int64 words, bit j of word w is element
+/// w * 64 + j.
+at::Tensor pack_spikes_cpu(at::Tensor spikes);
+
+/// Inverse of pack_spikes_cpu, n is the length of the unpacked last dimension.
+at::Tensor unpack_spikes_cpu(at::Tensor packed, int64_t n);
+
+/// Transposes the last two dimensions of packed [*, rows, words] spike matrices with n columns into
+/// packed [*, n, (rows + 63) / 64] matrices, 64 x 64 bit blocks at a time.
+at::Tensor transpose_packed_cpu(at::Tensor packed, int64_t n);
+
+/// Word-parallel a op b on packed spikes with n spikes per row, op is a snngrow::cpu::BitOp and b
+/// is ignored for kNot. The padding bits of the result stay zero.
+at::Tensor spike_bitwise_cpu(at::Tensor a, c10::optional<at::Tensor> b, int64_t op, int64_t n);
+
+/// And (all) / or (any) over the rows of packed [rows, words] spikes, returns [words].
+at::Tensor spike_reduce_cpu(at::Tensor packed, int64_t op);
+
+/// Spike counts over dimension 0 of packed [rows, groups, words] spikes with n spikes per row,
+/// returns int64 [groups, n].
+at::Tensor spike_count_columns_cpu(at::Tensor packed, int64_t n);
+
+/// Position of the first set bit of every row of a packed tensor, none for rows without spikes.
+at::Tensor spike_first_time_cpu(at::Tensor packed, int64_t none);
+
+/// Number of spikes in every row of a packed tensor.
+at::Tensor spike_count_cpu(at::Tensor packed);
+
+/// One charge - fire - reset step of an IF / LIF population, v is updated in place. v may be stored
+/// in bfloat16 or float16, it is computed in float and rounded to nearest even. Returns bool spikes
+/// if spike_out is set, otherwise spikes in the dtype of x.
+at::Tensor neuron_step_cpu(at::Tensor x, at::Tensor v, int64_t mode, double tau,
+                           double v_threshold, c10::optional<double> v_reset, bool spike_out);
+
+/// Event-driven step t of an IF / LIF population v (any shape, indexed flat): only the neurons of the
+/// int64 index receive the inputs x; a repeated index is rejected, events for the same neuron must be
+/// summed first. Each of them first decays in closed form over the silent steps since last[index]
+/// (int64, the shape of v), which is set to t. Returns bool spikes per index.
+at::Tensor neuron_event_step_cpu(at::Tensor index, at::Tensor x, at::Tensor v, at::Tensor last, int64_t t,
+                                 int64_t mode, double tau, double v_threshold, c10::optional<double> v_reset);
+
+/// neuron_step_cpu with a threshold and an optional input bias per channel, v_threshold and bias have
+/// the broadcast shape [C, 1, ..., 1] of a channel dimension of x, e.g. [C, 1, 1] for [N, C, H, W].
+at::Tensor neuron_step_channels_cpu(at::Tensor x, at::Tensor v, int64_t mode, double tau, at::Tensor v_threshold,
+                                    c10::optional<at::Tensor> bias, c10::optional<double> v_reset, bool spike_out);
+
+/// T charge - fire - reset steps of an IF / LIF population on x_seq [T, *v.shape] in one call, v is
+/// updated in place and stays in registers across the steps. spike_format 0 returns spikes in the
+/// dtype of x, 1 bool spikes and 2 packed words [T, *v.shape[:-1], (v.shape[-1] + 63) / 64].
+at::Tensor neuron_multistep_cpu(at::Tensor x_seq, at::Tensor v, int64_t mode, double tau,
+                                double v_threshold, c10::optional<double> v_reset, int64_t spike_format);
+
+/// neuron_multistep_cpu split into time_blocks blocks of steps (0: one per thread) that run in
+/// parallel: every block first runs from the potential right after a reset, then the blocks are
+/// corrected in order from their true start, which for silent neurons, and with a soft reset for
+/// neurons whose spikes cannot change, is a closed-form linear update. spike_format is 0 (float) or
+/// 1 (bool). Falls back to neuron_multistep_cpu for short sequences and for IF with a soft reset.
+at::Tensor neuron_multistep_scan_cpu(at::Tensor x_seq, at::Tensor v, int64_t mode, double tau,
+                                     double v_threshold, c10::optional<double> v_reset, int64_t spike_format,
+                                     int64_t time_blocks);
+
+/// neuron_multistep_cpu with float spikes for training. Returns (spikes, v_seq), v_seq [T, *v.shape]
+/// holds the charged potential of every step before the reset, the state the backward needs.
+std::tuple<at::Tensor, at::Tensor> neuron_multistep_train_cpu(at::Tensor x_seq, at::Tensor v, int64_t mode,
+                                                              double tau, double v_threshold,
+                                                              c10::optional<double> v_reset);
+
+/// BPTT of neuron_multistep_train_cpu in one reverse-time sweep: the spikes and the surrogate
+/// derivative (0 Sigmoid, 1 ATan) are recomputed from v_seq. grad_v is the gradient of the final
+/// potential, it may be empty. Returns (grad_x_seq, grad_v), the latter for the initial potential.
+std::tuple<at::Tensor, at::Tensor> neuron_multistep_backward_cpu(at::Tensor grad_spike,
+                                                                 c10::optional<at::Tensor> grad_v,
+                                                                 at::Tensor v_seq, int64_t mode, double tau,
+                                                                 double v_threshold,
+                                                                 c10::optional<double> v_reset,
+                                                                 int64_t surrogate, double alpha,
+                                                                 bool detach_reset);
+
+/// Max pooling of bool spikes with shape [N, C, H, W] or [C, H, W].
+at::Tensor spike_max_pool2d_cpu(at::Tensor spikes, std::vector<int64_t> kernel_size,
+                                std::vector<int64_t> stride, std::vector<int64_t> padding);
+
+/// Registers the CPU ops and selects the kernel variant of the host.
+void init_spike_cpu(pybind11::module &m);
@@ -0,0 +1,81 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+/*! \file snngrow/snngrow_backend/spike_cpu/spike_tensor.cpp
+    \brief SpikeTensorImpl, the C++ tensor behind snngrow.base.SpikeTensor.
+*/
+#include "spike_tensor.h"
+
+// The autograd and ADInplaceOrView keys of PrivateUse3 are added by the TensorImpl constructor. The sizes,
+// strides and storage offset are the ones of elem, so that the composite views, which are built on
+// as_strided, land on the same elements of elem.
+SpikeTensorImpl::SpikeTensorImpl(at::Tensor elem)
+    : c10::TensorImpl(c10::DispatchKeySet(kSpikeTensorKey), caffe2::TypeMeta::Make<float>(), elem.device()),
+      elem_(std::move(elem)) {
+    set_storage_access_should_throw();
+    set_sizes_and_strides(elem_.sizes(), elem_.strides(), elem_.storage_offset());
+}
+
+void SpikeTensorImpl::refresh_sizes() {
+    if (sizes() != elem_.sizes() || strides() != elem_.strides() || storage_offset() != elem_.storage_offset()) {
+        set_sizes_and_strides(elem_.sizes(), elem_.strides(), elem_.storage_offset());
+    }
+}
+
+c10::intrusive_ptr<c10::TensorImpl> SpikeTensorImpl::shallow_copy_and_detach(
+        const c10::VariableVersion &version_counter, bool allow_tensor_metadata_change) const {
+    auto impl = c10::make_intrusive<SpikeTensorImpl>(elem_);
+    copy_tensor_metadata(this, impl.get(), version_counter, allow_tensor_metadata_change);
+    return impl;
+}
+
+c10::intrusive_ptr<c10::TensorImpl> SpikeTensorImpl::shallow_copy_and_detach(
+        c10::VariableVersion &&version_counter, bool allow_tensor_metadata_change) const {
+    auto impl = c10::make_intrusive<SpikeTensorImpl>(elem_);
+    copy_tensor_metadata(this, impl.get(), std::move(version_counter), allow_tensor_metadata_change);
+    return impl;
+}
+
+void SpikeTensorImpl::shallow_copy_from(const c10::intrusive_ptr<c10::TensorImpl> &impl) {
+    TORCH_CHECK(impl->key_set().has(kSpikeTensorKey), "the data of a spike tensor must be a spike tensor");
+    auto *spikes = static_cast<SpikeTensorImpl *>(impl.get());
+    copy_tensor_metadata(spikes, this, version_counter(), allow_tensor_metadata_change());
+    elem_ = spikes->elem_;
+}
+
+const char *SpikeTensorImpl::tensorimpl_type_name() const {
+    return "SpikeTensorImpl";
+}
+
+at::Tensor make_spike_tensor(at::Tensor elem) {
+    TORCH_CHECK(elem.scalar_type() == at::kBool, "spike tensors hold bool spikes, got ", elem.scalar_type());
+    return at::detail::make_tensor<SpikeTensorImpl>(std::move(elem));
+}
+
+bool is_spike_tensor(const at::Tensor &tensor) {
+    return tensor.defined() && tensor.key_set().has(kSpikeTensorKey);
+}
+
+SpikeTensorImpl *spike_tensor_impl(const at::Tensor &tensor) {
+    return is_spike_tensor(tensor) ? static_cast<SpikeTensorImpl *>(tensor.unsafeGetTensorImpl()) : nullptr;
+}
+
+at::Tensor spike_tensor_elem(const at::Tensor &tensor) {
+    auto *impl = spike_tensor_impl(tensor);
+    TORCH_CHECK(impl, "expected a spike tensor");
+    return impl->elem();
+}
@@ -0,0 +1,64 @@
+/***************************************************************************************************
+ * Copyright 2024 Beijing Institute of Technology AETAS Lab. and Utarn Technology Co., Ltd. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ **************************************************************************************************/
+
+/*! \file snngrow/snngrow_backend/spike_cpu/spike_tensor.h
+    \brief SpikeTensorImpl, the C++ tensor behind snngrow.base.SpikeTensor.
+
+    A spike tensor is a float32 tensor to autograd and to the other operands of an op, stored as a bool
+    tensor elem of the same sizes, strides and device. It carries the PrivateUse3 dispatch key, the ops
+    on it run in the boxed fallback of library.cpp on elem.
+*/
+#pragma once
+
+#include <torch/extension.h>
+
+/// Dispatch key of the spike tensors.
+constexpr c10::DispatchKey kSpikeTensorKey = c10::DispatchKey::PrivateUse3;
+
+class SpikeTensorImpl : public c10::TensorImpl {
+public:
+    explicit SpikeTensorImpl(at::Tensor elem);
+
+    const at::Tensor &elem() const {
+        return elem_;
+    }
+
+    /// Takes over the sizes and strides of elem after an in-place op changed them, e.g. unsqueeze_.
+    void refresh_sizes();
+
+    c10::intrusive_ptr<c10::TensorImpl> shallow_copy_and_detach(const c10::VariableVersion &version_counter,
+                                                                bool allow_tensor_metadata_change) const override;
+    c10::intrusive_ptr<c10::TensorImpl> shallow_copy_and_detach(c10::VariableVersion &&version_counter,
+                                                                bool allow_tensor_metadata_change) const override;
+    void shallow_copy_from(const c10::intrusive_ptr<c10::TensorImpl> &impl) override;
+
+private:
+    const char *tensorimpl_type_name() const override;
+
+    at::Tensor elem_;
+};
+
+/// Wraps bool spikes as a spike tensor, the spikes are shared, not copied.
+at::Tensor make_spike_tensor(at::Tensor elem);
+
+bool is_spike_tensor(const at::Tensor &tensor);
+
+/// The SpikeTensorImpl of tensor, nullptr if it is not a spike tensor.
+SpikeTensorImpl *spike_tensor_impl(const at::Tensor &tensor);
+
+/// The bool spikes of a spike tensor.
+at::Tensor spike_tensor_elem(const at::Tensor &tensor);